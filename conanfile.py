@@ -11,7 +11,9 @@ class ImageBinaryMatrix(ConanFile):
     generators = "CMakeDeps", "CMakeToolchain"
 
     def requirements(self):
-        self.requires("libpng/1.6.42", override=True) # opencv/4.8.1 requires libpng/1.6.40
+        # Forced as direct dependencies, 1-bit masks are written with them
+        self.requires("libpng/1.6.42", force=True) # opencv/4.8.1 requires libpng/1.6.40
+        self.requires("libtiff/4.6.0", force=True) # Same version as opencv/4.8.1
 
         self.requires("glew/2.2.0")
         self.requires("glfw/3.3.8")
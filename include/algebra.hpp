@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef __IBM_ALGEBRA_HPP__
+#define __IBM_ALGEBRA_HPP__
+
+#include "core.hpp"
+
+// Cell-wise boolean operations, computed 64 cells per word. Both operands
+// must have the same size, otherwise Exception is thrown.
+
+BinaryMatrix operator&(const BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix operator|(const BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix operator^(const BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix operator~(const BinaryMatrix &a);
+// a AND NOT b, i.e. cells of `a` missing in `b`
+BinaryMatrix andNot(const BinaryMatrix &a, const BinaryMatrix &b);
+
+BinaryMatrix &operator&=(BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix &operator|=(BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix &operator^=(BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix &andNotInPlace(BinaryMatrix &a, const BinaryMatrix &b);
+BinaryMatrix &invertInPlace(BinaryMatrix &a);
+
+// Fused "operation then count", the intermediate matrix is never stored
+
+size_t countTrue(const BinaryMatrix &a);
+size_t countAnd(const BinaryMatrix &a, const BinaryMatrix &b);
+size_t countOr(const BinaryMatrix &a, const BinaryMatrix &b);
+size_t countXor(const BinaryMatrix &a, const BinaryMatrix &b);
+size_t countAndNot(const BinaryMatrix &a, const BinaryMatrix &b);
+
+// Cells true in both, in either and in exactly one of two matrices
+struct OverlapCounts
+{
+    size_t both, either, differing;
+
+    OverlapCounts();
+};
+
+// All three from one pass over both matrices
+OverlapCounts countOverlap(const BinaryMatrix &a, const BinaryMatrix &b);
+
+// Similarity metrics
+
+// Number of cells that differ
+size_t hammingDistance(const BinaryMatrix &a, const BinaryMatrix &b);
+// |a & b| / |a | b|, two empty matrices are considered equal (1.0)
+double intersectionOverUnion(const BinaryMatrix &a, const BinaryMatrix &b);
+double intersectionOverUnion(const OverlapCounts &counts);
+// 1 - intersectionOverUnion
+double jaccardDistance(const BinaryMatrix &a, const BinaryMatrix &b);
+
+#endif
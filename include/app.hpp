@@ -6,24 +6,86 @@
 #include "std.hpp"
 #include "gui.hpp"
 #include "utils.hpp"
+#include "morphology.hpp"
+#include "statistics.hpp"
+#include "occupancy.hpp"
+#include "classifier.hpp"
+#include "algebra.hpp"
+#include "pool.hpp"
+#include "kernels.hpp"
+#include "bitmap.hpp"
+#include "exporter.hpp"
+#include "cache.hpp"
+#include "contour.hpp"
+#include "roi.hpp"
+#include "profiler.hpp"
+#include "thumbnail.hpp"
+
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
 
 struct CurrentPathInfo
 {
     std::filesystem::path executable, directory;
-    std::filesystem::path input, output;
+    std::filesystem::path input, output, cache, thumbnails;
     std::vector<std::filesystem::path> images;
 };
 
+enum CleanupOperation
+{
+    CleanupNone,
+    CleanupOpening,
+    CleanupClosing,
+    CleanupErosion,
+    CleanupDilation
+};
+
+struct GuiColorRange
+{
+    float hsvFrom[4], hsvTo[4];
+    bool exclude;
+};
+
+#define IMAGE_FILTER_LENGTH 256
+
 struct GuiInputData
 {
+    // Index into CurrentPathInfo::images
     int selectedImageFile;
+    // Case insensitive part of the names listed, and whether the list shows
+    // thumbnails
+    char imageFilter[IMAGE_FILTER_LENGTH];
+    bool showThumbnails;
     float hsvFrom[4], hsvTo[4];
+    // Ranges added on top of the main one, merged through ColorClassifier
+    std::vector<GuiColorRange> extraRanges;
     bool imagePreviewOpened, maskPreviewOpened, binaryMatrixPreview;
+    // Size of the shared processing thread pool
+    int threads;
+    // Hardware counters per processing stage, see Profiler
+    bool profiling;
+    // Threshold a coarse level on every range change, full resolution once
+    // the range stops changing
+    bool livePreview;
+    // BitmapFormat of the saved mask, MatrixFormat of the saved matrix
+    int maskFormat, matrixFormat;
+    // ContourFormat of the saved outlines and their Douglas-Peucker
+    // tolerance in cells
+    int contourFormat;
+    float contourSimplify;
+    // Morphology applied to the generated matrix, see CleanupOperation
+    int cleanupOperation, cleanupShape, cleanupSize;
+    // Processed region, dragged on the image preview, the whole image when
+    // empty
+    RegionOfInterest roi;
 
     GuiInputData();
 
     cv::Scalar hsvCV(float *hsv) const;
     ColorRange hsvToRange() const;
+    ColorRange hsvToRange(const GuiColorRange &range) const;
+    ColorClassifier hsvToClassifier() const;
     bool isImageSelected() const;
 };
 
@@ -33,7 +95,24 @@ class IBMApplication: public Application
     Image *image;
     GuiInputData data;
     std::vector<Image *> imagePool;
-    BinaryMatrix matrix;
+    BinaryMatrix matrix, previousMatrix;
+    RegionStatistics statistics;
+    // `matrix` compared to `previousMatrix` when they have the same size
+    bool isComparable;
+    double previousIoU;
+    size_t changedCells;
+    // Kept over `matrix` to skip its empty regions
+    OccupancyIndex occupancy;
+    // Thresholded matrices of earlier runs, `cachedMatrix` is the last hit
+    // and `matrixKey` the key to store the next generated matrix under
+    ResultCache cache;
+    BinaryMatrix cachedMatrix;
+    ContentHash matrixKey;
+    // Input files matching the search, and the textures of the thumbnails
+    // in view by file path
+    std::vector<int> filteredImages;
+    ThumbnailCache thumbnails;
+    std::unordered_map<std::string, Texture2D> thumbnailTextures;
     bool isImageLoaded, isMaskProcessed;
     // To refresh the image file list
     bool toRefresh;
@@ -41,6 +120,11 @@ class IBMApplication: public Application
     bool toReset;
     // To regenerate matrix and mask
     bool toRegenerate;
+    // To restart the live preview with the current range
+    bool toPreview;
+    // To rewrite the matrix preview after the live preview generated it
+    bool toRedrawMatrix;
+    std::chrono::steady_clock::time_point previewChanged;
 
   public:
     CurrentPathInfo path;
@@ -52,28 +136,41 @@ class IBMApplication: public Application
     virtual void draw();
 
     void drawMenuBar();
+    void drawProfile();
     void drawMainWindow();
+    void drawImageFileList();
 
     void drawImageTools();
 
     void drawImagePreview();
     void drawMaskPreview();
     void drawMatrixPreview();
+    void editRegion();
 
     std::string getSelectedImage() const;
 
   protected:
     std::string buildImageTitle(const std::string &addition = "") const;
     void renderImage(Texture2D &texture, const cv::Mat &mat);
+    // Stretched to `size`, e.g. a coarse mask over the full image
+    void renderImage(
+        Texture2D &texture,
+        const cv::Mat &mat,
+        const ImVec2 &size
+    );
 
     void loadImageFileList();
+    void filterImageFileList();
     void createDirectory(const std::filesystem::path &path) const;
     std::string buildOutputImageFilename() const;
 
     void loadImage(const std::string &filename);
     Image *getImageFromPool(const std::string &filename) const;
 
+    void processMask();
+    void updatePreview();
     void generateBinaryMatrix();
+    void cleanupBinaryMatrix();
 };
 
 #endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef __IBM_BITMAP_HPP__
+#define __IBM_BITMAP_HPP__
+
+#include "core.hpp"
+
+// 1-bit mask files encoded straight from the packed matrix words, true
+// cells are white like on the mask preview
+
+enum BitmapFormat
+{
+    // 1-bit grayscale PNG
+    BitmapPNG,
+    // Binary portable bitmap (P4)
+    BitmapPBM,
+    // 1-bit TIFF with CCITT Group 4 compression
+    BitmapTIFF
+};
+
+bool writePBM(const BinaryMatrix &matrix, const std::filesystem::path &path);
+bool writePNG(const BinaryMatrix &matrix, const std::filesystem::path &path);
+bool writeTIFF(const BinaryMatrix &matrix, const std::filesystem::path &path);
+
+bool writeBitmap(
+    const BinaryMatrix &matrix,
+    const std::filesystem::path &path,
+    BitmapFormat format
+);
+
+// File extension for the format, with the leading dot
+std::string bitmapExtension(BitmapFormat format);
+
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#ifndef __IBM_BUFFER_HPP__
+#define __IBM_BUFFER_HPP__
+
+#include "core.hpp"
+#include "classifier.hpp"
+
+// Entry points over memory owned by the caller: pixels are read in place and
+// bits are written in place, nothing is decoded or copied on the way. The
+// conversion buffers needed in between are per-thread and reused.
+
+enum PixelFormat
+{
+    PixelGray,
+    PixelBGR,
+    PixelBGRA,
+    PixelRGB,
+    PixelRGBA,
+    // 8-bit OpenCV HSV, hue in [0, 180)
+    PixelHSV
+};
+
+// 8 bits per channel, rows `stride` bytes apart
+struct PixelBuffer
+{
+    const uint8_t *data;
+    size_t width, height, stride;
+    PixelFormat format;
+
+    PixelBuffer(
+        const uint8_t *data,
+        size_t width,
+        size_t height,
+        size_t stride,
+        PixelFormat format
+    );
+
+    size_t channels() const;
+    bool isValid() const;
+
+    // Header over rows [begin, end) of the caller memory, which must not be
+    // written through it
+    cv::Mat view(size_t begin, size_t end) const;
+};
+
+// Packed bits in the BinaryMatrix layout, rows `stride` words apart. Only
+// the first BinaryMatrix::wordsFor(cols) words of a row are written.
+struct BitBuffer
+{
+    BinaryMatrix::Word *words;
+    size_t rows, cols, stride;
+
+    // A zero stride means BinaryMatrix::wordsFor(cols)
+    BitBuffer(
+        BinaryMatrix::Word *words,
+        size_t rows,
+        size_t cols,
+        size_t stride = 0
+    );
+    // Over the storage of `matrix`, valid until it is resized
+    BitBuffer(BinaryMatrix &matrix);
+
+    bool isValid() const;
+    BinaryMatrix::Word *row(size_t row) const;
+};
+
+// Cells of pixels inside the HSV range are true. Gray pixels are taken as
+// colors with no saturation.
+void thresholdPixels(
+    const PixelBuffer &pixels,
+    const ColorRange &range,
+    BitBuffer &bits
+);
+
+// Cells the compiled classifier accepts are true, HSV pixels are not
+// supported
+void classifyPixels(
+    const PixelBuffer &pixels,
+    const ColorClassifier &classifier,
+    BitBuffer &bits
+);
+
+// Cells whose first channel is not zero are true
+void packPixels(const PixelBuffer &pixels, BitBuffer &bits);
+
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef __IBM_CACHE_HPP__
+#define __IBM_CACHE_HPP__
+
+#include "core.hpp"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Bump whenever thresholding or packing changes the cells produced for the
+// same input, entries of other versions are never hit
+#define RESULT_CACHE_VERSION 1
+
+// 128-bit MurmurHash3 of a byte string, not meant to resist crafted inputs
+struct ContentHash
+{
+    uint64_t high, low;
+
+    // The empty hash, which is not valid
+    ContentHash();
+    ContentHash(uint64_t high, uint64_t low);
+
+    bool isValid() const;
+    bool operator==(const ContentHash &other) const;
+    bool operator!=(const ContentHash &other) const;
+
+    // 32 lowercase hex digits
+    std::string hex() const;
+
+    static ContentHash of(const void *data, size_t size);
+    // Hash of the file bytes, the empty hash when it cannot be read
+    static ContentHash ofFile(const std::filesystem::path &path);
+};
+
+// Key of the matrix thresholded from content `content` with `range` by this
+// processing version
+ContentHash resultKey(const ContentHash &content, const ColorRange &range);
+
+// Write through a uniquely named temporary file renamed over `path`, so
+// that threads and processes reading it never see a partial file. Parent
+// directories are created.
+bool writeFileAtomically(
+    const std::filesystem::path &path,
+    const std::function<void(std::ostream &)> &write
+);
+bool writeFileAtomically(
+    const std::filesystem::path &path,
+    const void *data,
+    size_t size
+);
+
+// Remove the least recently modified files with `extension` under
+// `directory` until at most `target` bytes of them are left. Returns the
+// bytes left.
+uint64_t evictOldest(
+    const std::filesystem::path &directory,
+    const std::string &extension,
+    uint64_t target
+);
+
+// Packed matrices on disk under their key, so identical inputs (copies of a
+// file included) share one entry whatever their name. Entries are written to
+// a temporary file and renamed, several processes may share the directory.
+// A hit refreshes the modification time of the entry, the least recently
+// used entries go first when the total size passes the capacity.
+class ResultCache
+{
+  protected:
+    std::filesystem::path directory;
+    uint64_t capacity;
+    // Size of the entries, exact after a scan and estimated in between
+    std::atomic<uint64_t> bytes;
+    std::atomic<size_t> hitCount, missCount;
+    // Held while evicting
+    std::mutex mutex;
+
+  public:
+    ResultCache();
+    ResultCache(const std::filesystem::path &directory, uint64_t capacity);
+
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    // Create the directory when needed and measure it, evicting down to the
+    // capacity
+    bool open(const std::filesystem::path &directory, uint64_t capacity);
+    bool isOpen() const;
+
+    // Safe to call from several threads
+    bool load(const ContentHash &key, BinaryMatrix &matrix);
+    bool store(const ContentHash &key, const BinaryMatrix &matrix);
+
+    // Remove the least recently used entries until at most `target` bytes
+    // are left
+    void evict(uint64_t target);
+
+    uint64_t size() const;
+    size_t hits() const;
+    size_t misses() const;
+
+  protected:
+    std::filesystem::path entryPath(const ContentHash &key) const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#ifndef __IBM_CLASSIFIER_HPP__
+#define __IBM_CLASSIFIER_HPP__
+
+#include "core.hpp"
+
+// Set of HSV ranges compiled into a BGR -> bit lookup table. A pixel matches
+// when it is inside any included range and outside all the excluded ones.
+// Once compiled, every pixel costs one table lookup whatever the number of
+// ranges is.
+struct ColorClassifier
+{
+    struct Rule
+    {
+        ColorRange range;
+        bool exclude;
+    };
+
+    static constexpr int MinBits = 4;
+    static constexpr int MaxBits = 8;
+
+    std::vector<Rule> rules;
+
+    // Bits kept per BGR channel: 8 gives an exact 2 MB table, every bit less
+    // shrinks it 8 times at the cost of classifying the cell center color
+    ColorClassifier(int bits = MaxBits);
+
+    void include(const ColorRange &range);
+    void exclude(const ColorRange &range);
+    void clear();
+
+    void compile();
+    bool isCompiled() const;
+    int bits() const;
+    size_t tableSize() const;
+
+    bool classify(uchar blue, uchar green, uchar red) const;
+
+    // The image must be 8-bit BGR or BGRA, the output mask is 8-bit 0/255
+    void classify(const cv::Mat &image, cv::Mat &mask) const;
+    void classify(const cv::Mat &image, BinaryMatrix &matrix) const;
+    // One row of `count` BGR(A) pixels `channels` bytes apart into packed
+    // words, all (count + 63) / 64 of them are overwritten
+    void classifyRow(
+        const uchar *pixels,
+        size_t count,
+        int channels,
+        BinaryMatrix::Word *words
+    ) const;
+
+  private:
+    using Word = BinaryMatrix::Word;
+
+    int channelBits;
+    bool compiled;
+    std::vector<Word> table;
+
+    size_t index(uchar blue, uchar green, uchar red) const;
+    bool lookup(size_t index) const;
+};
+
+#endif
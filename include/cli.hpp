@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef __IBM_CLI_HPP__
+#define __IBM_CLI_HPP__
+
+#include "core.hpp"
+
+struct CliOptions
+{
+    // Input, exactly one of them is set
+    std::string video, sequence;
+    std::filesystem::path output;
+    cv::Scalar from, to;
+    // Write one packed stream instead of a text file per frame
+    bool packed;
+    // Write outlines instead of cells, "json" or "binary", and their
+    // simplification tolerance in cells
+    std::string contours;
+    double simplify;
+    // Result cache directory, none when empty, and its size limit in MB
+    std::filesystem::path cache;
+    size_t cacheSize;
+    // Processing threads, zero means one per core
+    size_t threads;
+    // Range file to sweep over the image instead of processing frames
+    std::string sweep, image;
+    // Daemon socket, served unless one of the queries below is given
+    std::string serve;
+    bool stats, stop;
+    // Print the time and hardware counters of every processing stage
+    bool profile;
+    bool help;
+
+    CliOptions();
+
+    ColorRange colorRange() const;
+
+    // Throws Exception on invalid arguments
+    static CliOptions parse(int argc, char const *argv[]);
+    static void printUsage(const char *executable);
+};
+
+// The application runs without GUI when any option is given
+bool isCliMode(int argc, char const *argv[]);
+int cliStart(int argc, char const *argv[]);
+
+#endif
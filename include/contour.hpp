@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef __IBM_CONTOUR_HPP__
+#define __IBM_CONTOUR_HPP__
+
+#include "core.hpp"
+
+// Closed outline through cell corners: point (x, y) is the top left corner
+// of cell (y, x). The last point connects back to the first one.
+using Polygon = std::vector<cv::Point>;
+
+// Outline of one 8-connected component of true cells. Outer polygons run
+// clockwise on screen (y down), holes counterclockwise, so the true cells
+// are always on the right of an edge.
+struct Contour
+{
+    Polygon outer;
+    std::vector<Polygon> holes;
+
+    // Number of points of all the polygons
+    size_t points() const;
+};
+
+// Trace the boundaries of all the components in row-major order of their
+// first cell. Edge cells are found a word at a time: a cell differs from its
+// left neighbour where row ^ (row << 1) is set and from the cell above where
+// row ^ above is set. Only corners are emitted, straight runs of edges are
+// merged. With `epsilon` > 0 the polygons are simplified with
+// simplifyPolygon().
+std::vector<Contour> findContours(
+    const BinaryMatrix &matrix,
+    double epsilon = 0
+);
+
+// Douglas-Peucker: drop points closer than `epsilon` to the simplified
+// outline. Polygons are never reduced below 3 points.
+Polygon simplifyPolygon(const Polygon &polygon, double epsilon);
+
+enum ContourFormat
+{
+    // "IBMP" magic, uint32 version, rows, cols and number of contours, then
+    // for every contour uint32 number of polygons (outer first) and for
+    // every polygon uint32 number of points followed by the points as
+    // zigzag LEB128 varints, x then y, the first point absolute and the
+    // others relative to the previous one
+    ContourBinary,
+    // {"rows":R,"cols":C,"contours":[{"outer":[[x,y],...],"holes":[...]}]}
+    ContourJSON
+};
+
+bool exportContours(
+    const std::vector<Contour> &contours,
+    size_t rows,
+    size_t cols,
+    const std::filesystem::path &path,
+    ContourFormat format
+);
+bool exportContours(
+    const std::vector<Contour> &contours,
+    size_t rows,
+    size_t cols,
+    std::ostream &output,
+    ContourFormat format
+);
+
+// File extension for the format, with the leading dot
+std::string contourExtension(ContourFormat format);
+
+#endif
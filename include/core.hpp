@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef __IBM_CORE_HPP__
+#define __IBM_CORE_HPP__
+
+#include "std.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <opencv2/opencv.hpp>
+
+struct ColorRange
+{
+    cv::Scalar from, to;
+
+    ColorRange(const cv::Scalar &from, const cv::Scalar &to);
+
+    // Hue is circular, a range with from > to covers [from, 180) and [0, to]
+    bool wrapsHue() const;
+    bool contains(const cv::Vec3b &hsv) const;
+
+    // Inclusive 8-bit bounds of the channels for the pixel kernels, false
+    // when no pixel can match. With `wrap` the hue passes when it is >=
+    // low[0] or <= high[0].
+    bool bounds(uint8_t *low, uint8_t *high, bool &wrap) const;
+
+    // cv::inRange aware of hue wrap-around, in one pass over 8-bit HSV
+    void threshold(const cv::Mat &hsv, cv::Mat &mask) const;
+};
+
+struct Exception
+{
+    std::string message;
+
+    Exception(const std::string &message);
+};
+
+struct BinaryMatrix
+{
+    using Type = bool;
+    static const Type True = (Type)(1);
+    static const Type False = (Type)(0);
+
+    // Cells are packed 64 per word, row by row. Column `j` of a row lives in
+    // bit `j % WordBits` of word `j / WordBits`; the unused high bits of the
+    // last word in each row are always kept at zero.
+    using Word = uint64_t;
+    static constexpr size_t WordBits = 64;
+
+    size_t rows, cols;
+    // Number of words per row
+    size_t stride;
+    std::vector<Word> data;
+
+    BinaryMatrix();
+    BinaryMatrix(size_t rows, size_t cols);
+    BinaryMatrix(
+        size_t rows,
+        size_t cols,
+        const std::vector<std::vector<Type>> &data
+    );
+
+    bool isEmpty() const;
+    bool isValid() const;
+    bool hasTrue() const;
+    void clear();
+    Type at(size_t row, size_t col) const;
+    void set(size_t row, size_t col, Type value);
+    void reset(size_t rows = 0, size_t cols = 0);
+    bool isTrue(size_t row, size_t col) const;
+    bool isFalse(size_t row, size_t col) const;
+
+    // Fill from an 8-bit mask of the same size, a cell is true when the first
+    // channel of its pixel is not zero. Storage is reused when possible.
+    void assignMask(const cv::Mat &mask);
+
+    Word *row(size_t row);
+    const Word *row(size_t row) const;
+    // Mask of the valid bits in the last word of a row
+    Word lastWordMask() const;
+
+    // Return vector of rows,
+    // each element is a sum of all the row elements
+    std::vector<unsigned int> sumRows() const;
+
+    // Return vector of columns,
+    // each element is a sum of all the column
+    std::vector<unsigned int> sumCols() const;
+
+    // Flip a matrix over its diagonal
+    BinaryMatrix transpose() const;
+
+    static size_t wordsFor(size_t cols);
+    // Pack a row of `cols` pixels of `channels` bytes into wordsFor(cols)
+    // words, a cell is true when the first byte of its pixel is not zero
+    static void packRow(
+        const uint8_t *pixels,
+        size_t cols,
+        size_t channels,
+        Word *words
+    );
+
+  private:
+    using self = BinaryMatrix;
+};
+
+// Number of set bits in a word
+inline unsigned int popcount(BinaryMatrix::Word word) {
+#if defined(_MSC_VER)
+    return (unsigned int)__popcnt64(word);
+#else
+    return (unsigned int)__builtin_popcountll(word);
+#endif
+}
+
+// Index of the lowest set bit, the word must not be zero
+inline unsigned int lowestBit(BinaryMatrix::Word word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (unsigned int)index;
+#else
+    return (unsigned int)__builtin_ctzll(word);
+#endif
+}
+
+// Index of the highest set bit, the word must not be zero
+inline unsigned int highestBit(BinaryMatrix::Word word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return (unsigned int)index;
+#else
+    return 63 - (unsigned int)__builtin_clzll(word);
+#endif
+}
+
+#endif
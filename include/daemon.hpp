@@ -0,0 +1,218 @@
+#pragma once
+
+#ifndef __IBM_DAEMON_HPP__
+#define __IBM_DAEMON_HPP__
+
+#include "core.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Long running server for local clients. Requests come over a Unix domain
+// socket, pixels and result bits stay in POSIX shared memory segments the
+// client created, so only the small fixed-size records below go through the
+// socket. Every record is in the native byte order. Not available on
+// Windows, where the constructors throw.
+//
+// A request is a DaemonHeader, followed by `count` DaemonJob records for
+// DaemonBatch. The reply is a DaemonHeader with the same command, followed
+// by `count` DaemonResult records for DaemonBatch or one DaemonStatistics
+// for DaemonStats. Batches of one connection are answered in order.
+
+#define DAEMON_MAGIC 0x4d424944u
+// Segment names are "/name", macOS limits them to 31 characters
+#define DAEMON_SEGMENT_NAME 64
+#define DAEMON_ERROR_LENGTH 112
+
+enum DaemonCommand
+{
+    DaemonBatch,
+    DaemonStats,
+    DaemonShutdown
+};
+
+enum DaemonOperation
+{
+    // ColorRange::threshold of the pixels
+    DaemonThreshold,
+    // First channel not zero, see packPixels
+    DaemonPack
+};
+
+struct DaemonHeader
+{
+    uint32_t magic;
+    uint32_t command;
+    uint32_t count;
+    uint32_t reserved;
+
+    DaemonHeader(uint32_t command = DaemonBatch, uint32_t count = 0);
+};
+
+struct DaemonJob
+{
+    uint32_t operation;
+    // PixelFormat of the pixels
+    uint32_t format;
+    uint32_t width, height;
+    // Pixel rows are `pixelStride` bytes apart, starting `pixelOffset` bytes
+    // into the pixel segment
+    uint64_t pixelStride, pixelOffset;
+    // Bit rows are `bitStride` words apart, zero means packed, starting
+    // `bitOffset` bytes into the bit segment. The offset must be a multiple
+    // of 8.
+    uint64_t bitStride, bitOffset;
+    // HSV bounds of DaemonThreshold in OpenCV units
+    float from[3], to[3];
+    char pixelSegment[DAEMON_SEGMENT_NAME];
+    char bitSegment[DAEMON_SEGMENT_NAME];
+
+    DaemonJob();
+
+    void setSegments(const std::string &pixels, const std::string &bits);
+    void setRange(const ColorRange &range);
+    ColorRange colorRange() const;
+};
+
+struct DaemonResult
+{
+    // Zero on success, `error` holds the message otherwise
+    uint32_t status;
+    uint32_t reserved;
+    uint64_t trueCells;
+    // From receiving the batch to finishing the job, in microseconds
+    uint64_t latency;
+    char error[DAEMON_ERROR_LENGTH];
+
+    DaemonResult();
+
+    bool isOk() const;
+};
+
+struct DaemonStatistics
+{
+    uint64_t batches, jobs, failures;
+    // Jobs received but not finished yet, now and at most
+    uint64_t queueDepth, maxQueueDepth;
+    // Latency percentiles over the last DaemonServer::LatencyWindow jobs, in
+    // microseconds
+    uint64_t p50, p90, p99, maxLatency;
+
+    DaemonStatistics();
+};
+
+// Shared memory segment mapped read-write. The creating side unlinks it on
+// destruction, mappings of other processes stay valid until they unmap.
+class SharedSegment
+{
+  protected:
+    std::string segmentName;
+    uint8_t *bytes;
+    size_t length;
+    bool owner;
+
+  public:
+    // Create the segment, replacing any old one of the same name
+    SharedSegment(const std::string &name, size_t size);
+    ~SharedSegment();
+
+    SharedSegment(const SharedSegment &) = delete;
+    SharedSegment &operator=(const SharedSegment &) = delete;
+
+    const std::string &name() const;
+    uint8_t *data() const;
+    size_t size() const;
+};
+
+class DaemonServer
+{
+  public:
+    static constexpr size_t LatencyWindow = 4096;
+    // Mapped segments kept open between jobs
+    static constexpr size_t MappingCacheSize = 32;
+
+    DaemonServer(const std::string &socketPath);
+    ~DaemonServer();
+
+    // Serve until a DaemonShutdown request or stop(), then remove the socket
+    void run();
+    // Safe to call from a signal handler
+    void stop();
+
+    DaemonStatistics statistics();
+
+  protected:
+    struct Connection;
+
+    struct Mapping
+    {
+        uint8_t *data;
+        size_t size;
+        uint64_t device, inode;
+    };
+
+    struct Request
+    {
+        std::shared_ptr<Connection> connection;
+        DaemonHeader header;
+        std::vector<DaemonJob> jobs;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    std::string socketPath;
+    int listener;
+    std::atomic<bool> stopping;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Request> queue;
+    DaemonStatistics counters;
+    std::vector<uint64_t> latencies;
+    size_t latencyCount;
+
+    // Only touched by the worker thread
+    std::map<std::string, Mapping> mappings;
+
+    bool receive(const std::shared_ptr<Connection> &connection);
+    bool handle(
+        const std::shared_ptr<Connection> &connection,
+        const DaemonHeader &header,
+        const uint8_t *body
+    );
+    void work();
+    void process(Request &request);
+    void runJob(const DaemonJob &job, DaemonResult &result);
+    uint8_t *map(const char *name, size_t &size);
+    void unmapAll();
+};
+
+// Blocking client of a DaemonServer, one connection per instance
+class DaemonClient
+{
+  protected:
+    int descriptor;
+
+  public:
+    DaemonClient(const std::string &socketPath);
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient &) = delete;
+    DaemonClient &operator=(const DaemonClient &) = delete;
+
+    // Run the jobs as one batch, results come in the order of the jobs
+    std::vector<DaemonResult> submit(const std::vector<DaemonJob> &jobs);
+    DaemonStatistics statistics();
+    void shutdown();
+
+  protected:
+    void send(const DaemonHeader &header, const void *body, size_t size);
+    DaemonHeader receive(uint32_t command);
+};
+
+#endif
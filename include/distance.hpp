@@ -0,0 +1,33 @@
+#pragma once
+
+#ifndef __IBM_DISTANCE_HPP__
+#define __IBM_DISTANCE_HPP__
+
+#include "core.hpp"
+
+enum DistanceMetric
+{
+    // Exact straight line distance
+    DistanceEuclidean,
+    // |dx| + |dy|, the city block chamfer distance
+    DistanceManhattan
+};
+
+// Distance from every cell to the nearest true cell, zero for true cells,
+// row-major and resized to rows x cols with the storage reused. Columns and
+// then rows are processed in parallel, both passes are linear in the number
+// of cells. Without any true cell all distances are infinite, or UINT16_MAX
+// in the integer variant, which also saturates at UINT16_MAX and rounds the
+// Euclidean distances to the nearest integer.
+void distanceTransform(
+    const BinaryMatrix &matrix,
+    DistanceMetric metric,
+    std::vector<float> &distances
+);
+void distanceTransform(
+    const BinaryMatrix &matrix,
+    DistanceMetric metric,
+    std::vector<uint16_t> &distances
+);
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#ifndef __IBM_EXPORTER_HPP__
+#define __IBM_EXPORTER_HPP__
+
+#include "core.hpp"
+#include "sparse.hpp"
+
+enum MatrixFormat
+{
+    // Rows of "0"/"1" characters, one line per matrix row
+    MatrixText,
+    // Comma separated cells, one line per matrix row
+    MatrixCSV,
+    // Array of row arrays: [[0,1],[1,0]]
+    MatrixJSON
+};
+
+// Cells are turned into characters 8 at a time through a lookup table and
+// written in large blocks. Blocks of rows are formatted on the shared pool
+// when the matrix is large.
+bool exportMatrix(
+    const BinaryMatrix &matrix,
+    const std::filesystem::path &path,
+    MatrixFormat format
+);
+bool exportMatrix(
+    const BinaryMatrix &matrix,
+    std::ostream &output,
+    MatrixFormat format
+);
+
+// Sparse matrices are written in the same layouts, row by row from the
+// column lists
+bool exportMatrix(
+    const SparseBinaryMatrix &matrix,
+    const std::filesystem::path &path,
+    MatrixFormat format
+);
+bool exportMatrix(
+    const SparseBinaryMatrix &matrix,
+    std::ostream &output,
+    MatrixFormat format
+);
+
+// File extension for the format, with the leading dot
+std::string matrixExtension(MatrixFormat format);
+
+#endif
@@ -0,0 +1,522 @@
+#pragma once
+
+#ifndef __IBM_GRID_HPP__
+#define __IBM_GRID_HPP__
+
+#include "core.hpp"
+
+#include <array>
+
+// Binary grids parameterized by a storage policy. Sizes given as template
+// arguments are compile-time constants, so small tiles live on the stack
+// (or in registers) and their loops unroll; `Dynamic` sizes are given at
+// run time instead. The packed policies use the BinaryMatrix bit layout, so
+// rows move between them and BinaryMatrix word by word. Tiles of up to 8 x 8
+// cells are held in a single word.
+
+constexpr size_t Dynamic = 0;
+
+// A size that is either a template argument or a run time value
+template <size_t N>
+struct Extent
+{
+    constexpr Extent(size_t = N) {
+    }
+
+    constexpr size_t get() const {
+        return N;
+    }
+};
+
+template <>
+struct Extent<Dynamic>
+{
+    size_t value;
+
+    Extent(size_t value = 0): value(value) {
+    }
+
+    size_t get() const {
+        return this->value;
+    }
+};
+
+// The `count` low bits of a word, count from 0 to 64
+inline BinaryMatrix::Word lowBits(size_t count) {
+    return count >= BinaryMatrix::WordBits
+               ? ~BinaryMatrix::Word(0)
+               : (BinaryMatrix::Word(1) << count) - 1;
+}
+
+// 64 bits of a packed row of `words` words from bit `offset` on, bit 0 is
+// cell `offset`. Bits past the end of the row are zero.
+inline BinaryMatrix::Word readBits(
+    const BinaryMatrix::Word *row,
+    size_t words,
+    size_t offset
+) {
+    const auto index = offset / BinaryMatrix::WordBits;
+    const auto shift = offset % BinaryMatrix::WordBits;
+    if (index >= words) {
+        return 0;
+    }
+
+    auto bits = row[index] >> shift;
+    if (shift != 0 && index + 1 < words) {
+        bits |= row[index + 1] << (BinaryMatrix::WordBits - shift);
+    }
+
+    return bits;
+}
+
+// Replace `count` (1 to 64) bits of a packed row from bit `offset` on with
+// the low bits of `bits`, the row must hold them
+inline void writeBits(
+    BinaryMatrix::Word *row,
+    size_t offset,
+    size_t count,
+    BinaryMatrix::Word bits
+) {
+    const auto index = offset / BinaryMatrix::WordBits;
+    const auto shift = offset % BinaryMatrix::WordBits;
+    const auto mask = lowBits(count);
+    bits &= mask;
+
+    row[index] = (row[index] & ~(mask << shift)) | (bits << shift);
+    if (shift + count > BinaryMatrix::WordBits) {
+        const auto rest = BinaryMatrix::WordBits - shift;
+
+        row[index + 1] = (row[index + 1] & ~(mask >> rest)) | (bits >> rest);
+    }
+}
+
+// Bits packed 64 per word in an inline array. Tiles of up to 8 x 8 cells
+// take the specialization below instead.
+template <
+    size_t Rows,
+    size_t Cols,
+    bool Small
+    = Rows != Dynamic && Cols != Dynamic && Rows <= 8 && Cols <= 8>
+struct PackedBits
+{
+    static_assert(Rows != Dynamic && Cols != Dynamic, "Sizes must be fixed");
+
+    using Word = BinaryMatrix::Word;
+    static constexpr bool Packed = true;
+    static constexpr bool InWord = false;
+    static constexpr size_t Stride
+        = (Cols + BinaryMatrix::WordBits - 1) / BinaryMatrix::WordBits;
+
+    std::array<Word, Rows * Stride> data{};
+
+    constexpr size_t rows() const {
+        return Rows;
+    }
+
+    constexpr size_t cols() const {
+        return Cols;
+    }
+
+    constexpr size_t stride() const {
+        return Stride;
+    }
+
+    Word *row(size_t row) {
+        return this->data.data() + row * Stride;
+    }
+
+    const Word *row(size_t row) const {
+        return this->data.data() + row * Stride;
+    }
+};
+
+// A whole tile of up to 8 x 8 cells in one word, a byte per row: cell
+// (i, j) is bit 8 * i + j. The tile fits in a register, and counting or
+// combining tiles takes a single instruction.
+template <size_t Rows, size_t Cols>
+struct PackedBits<Rows, Cols, true>
+{
+    using Word = BinaryMatrix::Word;
+    static constexpr bool Packed = false;
+    static constexpr bool InWord = true;
+    static constexpr size_t RowBits = 8;
+
+    Word word = 0;
+
+    constexpr size_t rows() const {
+        return Rows;
+    }
+
+    constexpr size_t cols() const {
+        return Cols;
+    }
+};
+
+// One byte per cell in an inline array, for code that addresses single cells
+// far more often than it combines rows
+template <size_t Rows, size_t Cols>
+struct DenseBytes
+{
+    static_assert(Rows != Dynamic && Cols != Dynamic, "Sizes must be fixed");
+
+    static constexpr bool Packed = false;
+    static constexpr bool InWord = false;
+
+    std::array<uint8_t, Rows * Cols> data{};
+
+    constexpr size_t rows() const {
+        return Rows;
+    }
+
+    constexpr size_t cols() const {
+        return Cols;
+    }
+
+    uint8_t &cell(size_t row, size_t col) {
+        return this->data[row * Cols + col];
+    }
+
+    const uint8_t &cell(size_t row, size_t col) const {
+        return this->data[row * Cols + col];
+    }
+};
+
+// Packed bits owned by someone else: a BinaryMatrix, a mapped file, a
+// caller's buffer, or a block of a matrix starting at a word boundary with
+// `stride` words between its rows. The padding bits past `cols` must be
+// zero.
+template <size_t Rows = Dynamic, size_t Cols = Dynamic>
+struct ExternalBits
+{
+    using Word = BinaryMatrix::Word;
+    static constexpr bool Packed = true;
+    static constexpr bool InWord = false;
+
+    Word *words;
+    Extent<Rows> rowCount;
+    Extent<Cols> colCount;
+    // Words from one row to the next, at least stride()
+    size_t wordStride;
+
+    ExternalBits(
+        Word *words = nullptr,
+        size_t rows = Rows,
+        size_t cols = Cols,
+        size_t stride = 0
+    )
+        : words(words),
+          rowCount(rows),
+          colCount(cols),
+          wordStride(stride ? stride : BinaryMatrix::wordsFor(cols)) {
+    }
+
+    size_t rows() const {
+        return this->rowCount.get();
+    }
+
+    size_t cols() const {
+        return this->colCount.get();
+    }
+
+    // Words of a row
+    size_t stride() const {
+        return (this->cols() + BinaryMatrix::WordBits - 1)
+               / BinaryMatrix::WordBits;
+    }
+
+    Word *row(size_t row) const {
+        return this->words + row * this->wordStride;
+    }
+};
+
+template <typename Storage>
+struct BitGrid: Storage
+{
+    using Type = BinaryMatrix::Type;
+    using Word = BinaryMatrix::Word;
+
+    using Storage::Storage;
+
+    Type at(size_t row, size_t col) const {
+        if constexpr (Storage::InWord) {
+            const auto bit = row * Storage::RowBits + col;
+
+            return (Type)((this->word >> bit) & 1);
+        } else if constexpr (Storage::Packed) {
+            const auto word = this->row(row)[col / BinaryMatrix::WordBits];
+
+            return (Type)((word >> (col % BinaryMatrix::WordBits)) & 1);
+        } else {
+            return (Type)this->cell(row, col);
+        }
+    }
+
+    void set(size_t row, size_t col, Type value) {
+        if constexpr (Storage::InWord) {
+            const auto bit = Word(1) << (row * Storage::RowBits + col);
+
+            this->word = value ? this->word | bit : this->word & ~bit;
+        } else if constexpr (Storage::Packed) {
+            auto &word = this->row(row)[col / BinaryMatrix::WordBits];
+            const auto bit = Word(1) << (col % BinaryMatrix::WordBits);
+
+            word = value ? word | bit : word & ~bit;
+        } else {
+            this->cell(row, col) = value ? 1 : 0;
+        }
+    }
+
+    bool isTrue(size_t row, size_t col) const {
+        return this->at(row, col) == BinaryMatrix::True;
+    }
+
+    bool isFalse(size_t row, size_t col) const {
+        return this->at(row, col) == BinaryMatrix::False;
+    }
+
+    void clear() {
+        if constexpr (Storage::InWord) {
+            this->word = 0;
+        } else {
+            for (size_t i = 0; i < this->rows(); i++) {
+                if constexpr (Storage::Packed) {
+                    std::fill(this->row(i), this->row(i) + this->stride(), 0);
+                } else {
+                    for (size_t j = 0; j < this->cols(); j++) {
+                        this->cell(i, j) = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    // Number of true cells
+    size_t count() const {
+        if constexpr (Storage::InWord) {
+            return popcount(this->word);
+        } else {
+            size_t result = 0;
+
+            for (size_t i = 0; i < this->rows(); i++) {
+                if constexpr (Storage::Packed) {
+                    const auto *words = this->row(i);
+
+                    for (size_t w = 0; w < this->stride(); w++) {
+                        result += popcount(words[w]);
+                    }
+                } else {
+                    for (size_t j = 0; j < this->cols(); j++) {
+                        result += this->cell(i, j);
+                    }
+                }
+            }
+
+            return result;
+        }
+    }
+
+    bool hasTrue() const {
+        if constexpr (Storage::InWord) {
+            return this->word != 0;
+        } else {
+            for (size_t i = 0; i < this->rows(); i++) {
+                for (size_t j = 0; j < this->wordsOrCells(); j++) {
+                    if (this->rawAt(i, j) != 0) {
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+    }
+
+    // Cell-wise operations with a grid of the same size, any storage
+    template <typename Other>
+    BitGrid &operator&=(const BitGrid<Other> &other) {
+        return this->combine(other, [](Word a, Word b) { return a & b; });
+    }
+
+    template <typename Other>
+    BitGrid &operator|=(const BitGrid<Other> &other) {
+        return this->combine(other, [](Word a, Word b) { return a | b; });
+    }
+
+    template <typename Other>
+    BitGrid &operator^=(const BitGrid<Other> &other) {
+        return this->combine(other, [](Word a, Word b) { return a ^ b; });
+    }
+
+    // Copy the cells of `matrix` starting at (top, left), cells past its
+    // edges are false. Packed grids take a word of a row at a time.
+    void load(const BinaryMatrix &matrix, size_t top = 0, size_t left = 0) {
+        this->clear();
+
+        const auto rows = std::min(
+            this->rows(),
+            top < matrix.rows ? matrix.rows - top : 0
+        );
+        const auto cols = std::min(
+            this->cols(),
+            left < matrix.cols ? matrix.cols - left : 0
+        );
+
+        for (size_t i = 0; i < rows; i++) {
+            const auto *source = matrix.row(top + i);
+
+            if constexpr (Storage::InWord) {
+                const auto bits = readBits(source, matrix.stride, left)
+                                  & lowBits(cols);
+
+                this->word |= bits << (i * Storage::RowBits);
+            } else if constexpr (Storage::Packed) {
+                auto *target = this->row(i);
+
+                for (size_t w = 0; w * BinaryMatrix::WordBits < cols; w++) {
+                    const auto first = w * BinaryMatrix::WordBits;
+
+                    target[w] = readBits(source, matrix.stride, left + first)
+                                & lowBits(cols - first);
+                }
+            } else {
+                for (size_t j = 0; j < cols; j++) {
+                    const auto col = left + j;
+                    const auto word = source[col / BinaryMatrix::WordBits];
+
+                    if ((word >> (col % BinaryMatrix::WordBits)) & 1) {
+                        this->set(i, j, BinaryMatrix::True);
+                    }
+                }
+            }
+        }
+    }
+
+    // Write the cells into `matrix` starting at (top, left), clipped to it
+    void store(BinaryMatrix &matrix, size_t top = 0, size_t left = 0) const {
+        const auto rows = std::min(
+            this->rows(),
+            top < matrix.rows ? matrix.rows - top : 0
+        );
+        const auto cols = std::min(
+            this->cols(),
+            left < matrix.cols ? matrix.cols - left : 0
+        );
+
+        for (size_t i = 0; i < rows; i++) {
+            auto *target = matrix.row(top + i);
+
+            if constexpr (Storage::InWord) {
+                if (cols > 0) {
+                    const auto bits = this->word >> (i * Storage::RowBits);
+
+                    writeBits(target, left, cols, bits);
+                }
+            } else if constexpr (Storage::Packed) {
+                const auto *source = this->row(i);
+
+                for (size_t w = 0; w * BinaryMatrix::WordBits < cols; w++) {
+                    const auto first = w * BinaryMatrix::WordBits;
+                    const auto count
+                        = std::min(cols - first, BinaryMatrix::WordBits);
+
+                    writeBits(target, left + first, count, source[w]);
+                }
+            } else {
+                for (size_t j = 0; j < cols; j++) {
+                    matrix.set(top + i, left + j, this->at(i, j));
+                }
+            }
+        }
+    }
+
+    BinaryMatrix toMatrix() const {
+        BinaryMatrix matrix(this->rows(), this->cols());
+
+        if constexpr (Storage::Packed) {
+            for (size_t i = 0; i < this->rows(); i++) {
+                std::copy(
+                    this->row(i),
+                    this->row(i) + this->stride(),
+                    matrix.row(i)
+                );
+            }
+        } else {
+            this->store(matrix);
+        }
+
+        return matrix;
+    }
+
+  private:
+    size_t wordsOrCells() const {
+        if constexpr (Storage::Packed) {
+            return this->stride();
+        } else {
+            return this->cols();
+        }
+    }
+
+    Word rawAt(size_t row, size_t index) const {
+        if constexpr (Storage::Packed) {
+            return this->row(row)[index];
+        } else {
+            return this->cell(row, index);
+        }
+    }
+
+    template <typename Other, typename Op>
+    BitGrid &combine(const BitGrid<Other> &other, Op op) {
+        if (this->rows() != other.rows() || this->cols() != other.cols()) {
+            throw Exception("Binary matrix sizes do not match!");
+        }
+
+        if constexpr (Storage::InWord && Other::InWord) {
+            this->word = op(this->word, other.word);
+        } else if constexpr (Storage::Packed && Other::Packed) {
+            const auto words = std::min(this->stride(), other.stride());
+
+            for (size_t i = 0; i < this->rows(); i++) {
+                auto *target = this->row(i);
+                const auto *source = other.row(i);
+
+                for (size_t w = 0; w < words; w++) {
+                    target[w] = op(target[w], source[w]);
+                }
+            }
+        } else {
+            for (size_t i = 0; i < this->rows(); i++) {
+                for (size_t j = 0; j < this->cols(); j++) {
+                    this->set(i, j, op(this->at(i, j), other.at(i, j)) & 1);
+                }
+            }
+        }
+
+        return *this;
+    }
+};
+
+// Fixed size tiles
+template <size_t Rows, size_t Cols>
+using FixedBinaryMatrix = BitGrid<PackedBits<Rows, Cols>>;
+template <size_t Rows, size_t Cols>
+using ByteBinaryMatrix = BitGrid<DenseBytes<Rows, Cols>>;
+
+using Tile8 = FixedBinaryMatrix<8, 8>;
+using Tile16 = FixedBinaryMatrix<16, 16>;
+using Tile64 = FixedBinaryMatrix<64, 64>;
+
+// View over packed words that are stored somewhere else
+template <size_t Rows = Dynamic, size_t Cols = Dynamic>
+using BinaryMatrixView = BitGrid<ExternalBits<Rows, Cols>>;
+
+// View over the whole matrix, valid until it is resized
+inline BinaryMatrixView<> viewOf(BinaryMatrix &matrix) {
+    return BinaryMatrixView<>(
+        matrix.data.data(),
+        matrix.rows,
+        matrix.cols,
+        matrix.stride
+    );
+}
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef __IBM_KERNELS_HPP__
+#define __IBM_KERNELS_HPP__
+
+#include "std.hpp"
+
+// Instruction set levels, each one includes the previous ones
+enum CpuLevel
+{
+    CpuScalar,
+    // SSE4.2 and POPCNT
+    CpuSSE42,
+    // AVX2
+    CpuAVX2,
+    // AVX-512 F and BW
+    CpuAVX512
+};
+
+// Pixel and bit kernels of one instruction set level. Pointers do not have
+// to be aligned and counts can be anything, every kernel handles its tail.
+// Words are BinaryMatrix words: bit j of word w is cell 64 * w + j.
+struct Kernels
+{
+    CpuLevel level;
+
+    // Number of set bits in words[0, count)
+    size_t (*countBits)(const uint64_t *words, size_t count);
+
+    // Number of set bits in `a OP b`, the result is never stored
+    size_t (*countAnd)(const uint64_t *a, const uint64_t *b, size_t count);
+    size_t (*countOr)(const uint64_t *a, const uint64_t *b, size_t count);
+    size_t (*countXor)(const uint64_t *a, const uint64_t *b, size_t count);
+    size_t (*countAndNot)(const uint64_t *a, const uint64_t *b, size_t count);
+    // counts[0] = set bits in `a & b` and counts[1] in `a | b`, from one
+    // pass over both buffers. `a ^ b` has counts[1] - counts[0] set bits.
+    void (*countAndOr)(
+        const uint64_t *a,
+        const uint64_t *b,
+        size_t count,
+        size_t *counts
+    );
+
+    // target = target OP source
+    void (*andWords)(uint64_t *target, const uint64_t *source, size_t count);
+    void (*orWords)(uint64_t *target, const uint64_t *source, size_t count);
+    void (*xorWords)(uint64_t *target, const uint64_t *source, size_t count);
+    void (*andNotWords)(
+        uint64_t *target,
+        const uint64_t *source,
+        size_t count
+    );
+    void (*invertWords)(uint64_t *words, size_t count);
+
+    // Bit j is set when pixels[j] is not zero. Writes (count + 63) / 64
+    // words, bits past `count` are cleared.
+    void (*packMask)(const uint8_t *pixels, size_t count, uint64_t *words);
+
+    // mask[j] = 255 when every channel of the 3-channel pixel j is within
+    // [low, high], 0 otherwise. With `wrapHue` the first channel passes when
+    // it is >= low or <= high.
+    void (*thresholdRow)(
+        const uint8_t *pixels,
+        size_t count,
+        const uint8_t *low,
+        const uint8_t *high,
+        bool wrapHue,
+        uint8_t *mask
+    );
+
+    // Pack the 3-channel pixels passing each of `ranges` ranges into
+    // words[r], (count + 63) / 64 words with the bits past `count` cleared.
+    // Range r has bounds lows[3 * r + c] and highs[3 * r + c] and wraps the
+    // hue like thresholdRow when wraps[r] is not zero. Every pixel is loaded
+    // once for all the ranges.
+    void (*sweepRow)(
+        const uint8_t *pixels,
+        size_t count,
+        const uint8_t *lows,
+        const uint8_t *highs,
+        const uint8_t *wraps,
+        size_t ranges,
+        uint64_t *const *words
+    );
+
+    // Transpose a 64 x 64 bit block in place, word i is row i
+    void (*transposeBlock)(uint64_t *block);
+};
+
+// Best level supported by both the processor and the operating system
+CpuLevel detectCpuLevel();
+// Detected level, lowered by the IBM_CPU_LEVEL environment variable
+// ("scalar", "sse4.2", "avx2" or "avx512") when it is set. Levels above the
+// detected one are never selected.
+CpuLevel selectCpuLevel();
+const char *cpuLevelName(CpuLevel level);
+
+// Kernels of a level, which must not be above the detected one
+const Kernels &kernelsFor(CpuLevel level);
+// Kernels of the selected level, bound on first use
+const Kernels &kernels();
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef __IBM_MORPHOLOGY_HPP__
+#define __IBM_MORPHOLOGY_HPP__
+
+#include "core.hpp"
+
+struct StructuringElement
+{
+    enum Shape
+    {
+        Rect,
+        Cross
+    };
+
+    Shape shape;
+    size_t width, height;
+
+    StructuringElement(Shape shape, size_t width, size_t height);
+    StructuringElement(Shape shape, size_t size);
+
+    bool isEmpty() const;
+
+    // Anchor is the element center, so offsets span [-anchor, size - 1 -
+    // anchor] along each axis
+    size_t anchorX() const;
+    size_t anchorY() const;
+};
+
+// All the operations work on the packed words directly, 64 cells at a time.
+// Cells outside of the matrix never change the result: they count as false
+// for dilation and as true for erosion.
+
+BinaryMatrix erode(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+);
+BinaryMatrix dilate(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+);
+
+// Erosion followed by dilation, removes specks smaller than the element
+BinaryMatrix opening(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+);
+
+// Dilation followed by erosion, fills holes smaller than the element
+BinaryMatrix closing(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+);
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#ifndef __IBM_OCCUPANCY_HPP__
+#define __IBM_OCCUPANCY_HPP__
+
+#include "core.hpp"
+
+#include <functional>
+
+// OR pyramid over a packed matrix. Level 0 has one bit per tile of TileRows
+// rows by one word of columns, every next level one bit per 2 x 2 block of
+// the level below, up to a single bit for the whole matrix. Emptiness of any
+// region is answered from the coarsest levels that fit, so empty areas are
+// skipped without touching their words.
+//
+// The index refers to the attached matrix, which must outlive it and keep its
+// size. Writes through OccupancyIndex::set keep the pyramid up to date,
+// direct writes to the matrix need refresh() or rebuild() afterwards.
+struct OccupancyIndex
+{
+    static constexpr size_t TileRows = 8;
+    static constexpr size_t TileCols = BinaryMatrix::WordBits;
+
+    // levels[0] is the finest one, levels.back() is 1 x 1
+    std::vector<BinaryMatrix> levels;
+
+    OccupancyIndex();
+    OccupancyIndex(BinaryMatrix &matrix);
+
+    void attach(BinaryMatrix &matrix);
+    void detach();
+    bool isEmpty() const;
+
+    void rebuild();
+    // Recompute the tiles of rows [from, to) after writing to the matrix
+    void refresh(size_t from, size_t to);
+
+    // Write a cell of the attached matrix, updating the levels above it
+    void set(size_t row, size_t col, BinaryMatrix::Type value);
+
+    bool hasTrue() const;
+    // Any true cell in rows [row, row + height) and cols [col, col + width),
+    // the rectangle is clipped to the matrix
+    bool any(size_t row, size_t col, size_t height, size_t width) const;
+    // First true cell of the topmost tile row with one, in its leftmost
+    // occupied tile, false when there is none. Takes one row per level and
+    // the rows of one tile, so it is the row-major first cell only within
+    // that tile.
+    bool findFirst(size_t &row, size_t &col) const;
+    // Whether the level 0 tile holding the cell has any true cell
+    bool isTileOccupied(size_t row, size_t col) const;
+
+    // Call `visit(top, left, bottom, right)` for every level 0 tile with a
+    // true cell, bounds are half-open and clipped to the matrix. Tiles come
+    // in quadtree order.
+    void forEachTile(
+        const std::function<void(size_t, size_t, size_t, size_t)> &visit
+    ) const;
+
+  private:
+    BinaryMatrix *matrix;
+
+    bool tileHasTrue(size_t tileRow, size_t tileCol) const;
+    bool childrenHaveTrue(size_t level, size_t row, size_t col) const;
+    void propagate(size_t tileRow, size_t tileCol);
+    bool anyIn(
+        size_t level,
+        size_t row,
+        size_t col,
+        size_t top,
+        size_t left,
+        size_t bottom,
+        size_t right
+    ) const;
+    void visitTiles(
+        size_t level,
+        size_t row,
+        size_t col,
+        const std::function<void(size_t, size_t, size_t, size_t)> &visit
+    ) const;
+};
+
+#endif
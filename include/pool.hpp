@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef __IBM_POOL_HPP__
+#define __IBM_POOL_HPP__
+
+#include "std.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class ThreadPool
+{
+  protected:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+  public:
+    // Zero means one thread per hardware core
+    ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    // Threads taking part in parallelFor, the calling one included
+    size_t size() const;
+    // Must not be called while the pool is running anything
+    void resize(size_t threads = 0);
+
+    void submit(const std::function<void()> &task);
+
+    // Split [0, count) into chunks of `grain` items and run body(begin, end)
+    // for all of them on the pool and the calling thread. Returns when all
+    // the chunks are done, rethrowing the first exception thrown by body.
+    void parallelFor(
+        size_t count,
+        size_t grain,
+        const std::function<void(size_t, size_t)> &body
+    );
+
+    static ThreadPool &shared();
+
+  protected:
+    void start(size_t threads);
+    void stop();
+};
+
+// Number of image rows of `rowBytes` bytes that fit the per-core cache
+size_t stripeRows(size_t rowBytes);
+
+// Run body(begin, end) over cache-sized row stripes on the shared pool.
+// Small images are processed serially in one call.
+void forEachStripe(
+    size_t rows,
+    size_t rowBytes,
+    const std::function<void(size_t, size_t)> &body
+);
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#ifndef __IBM_POOLING_HPP__
+#define __IBM_POOLING_HPP__
+
+#include "core.hpp"
+
+enum PoolingMode
+{
+    // True when any cell of the block is true
+    PoolAny,
+    // True when all the cells of the block are true
+    PoolAll,
+    // True when more than half of the block cells are true
+    PoolMajority
+};
+
+// Downsample to a rows x cols grid in one pass. Grid cell (r, c) covers
+// source rows [r * R / rows, (r + 1) * R / rows), columns likewise, so the
+// blocks differ by at most one cell when the sizes do not divide.
+BinaryMatrix poolMatrix(
+    const BinaryMatrix &matrix,
+    size_t rows,
+    size_t cols,
+    PoolingMode mode
+);
+
+// Integral image of a matrix: count of true cells in any rectangle in O(1)
+struct SummedAreaTable
+{
+    size_t rows, cols;
+    // (rows + 1) x (cols + 1), sums[i][j] counts the cells above and to the
+    // left of (i, j)
+    std::vector<uint32_t> sums;
+
+    SummedAreaTable();
+    SummedAreaTable(const BinaryMatrix &matrix);
+
+    bool isEmpty() const;
+
+    // True cells in rows [row, row + height) and cols [col, col + width),
+    // the rectangle is clipped to the matrix
+    size_t count(size_t row, size_t col, size_t height, size_t width) const;
+    // Share of true cells in the rectangle, 0 for empty rectangles
+    double density(size_t row, size_t col, size_t height, size_t width) const;
+
+  private:
+    uint32_t at(size_t row, size_t col) const;
+};
+
+#endif
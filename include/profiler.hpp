@@ -0,0 +1,143 @@
+#pragma once
+
+#ifndef __IBM_PROFILER_HPP__
+#define __IBM_PROFILER_HPP__
+
+#include "std.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+// Hardware counters read through perf_event_open on Linux
+enum PerfCounter
+{
+    PerfCycles,
+    PerfInstructions,
+    // Last level cache read misses
+    PerfCacheMisses,
+    PerfBranchMisses,
+    PerfCounterCount
+};
+
+// Totals of all the runs of one stage
+struct StageProfile
+{
+    std::string name;
+    size_t calls;
+    double seconds;
+    // Bytes the stage went through, as told by the scopes
+    uint64_t bytes;
+    // Only meaningful where Profiler::hasCounter() is true
+    uint64_t counters[PerfCounterCount];
+
+    StageProfile(const std::string &name);
+
+    // Instructions per cycle and bytes per cycle, 0 without cycles
+    double ipc() const;
+    double bytesPerCycle() const;
+};
+
+// Raw counts of all the counted threads at one moment
+struct PerfSample
+{
+    // Samples of different generations come from different counters and
+    // cannot be compared
+    size_t generation;
+    // Count, time enabled and time running of every counter of every thread
+    std::vector<uint64_t> values;
+
+    PerfSample();
+};
+
+// Opt-in profiling of processing stages. While enabled, every ProfileScope
+// adds its wall time and the counter deltas of all the threads of the
+// process (pool workers included) to its stage. Scopes running at the same
+// time count each other's work, and nested stages are included in the
+// enclosing ones. Where the counters cannot be opened (other systems,
+// containers, perf_event_paranoid) only wall time is kept.
+class Profiler
+{
+  public:
+    Profiler();
+    ~Profiler();
+
+    void enable();
+    void disable();
+    bool isEnabled() const;
+
+    bool hasCounter(PerfCounter counter) const;
+    bool hasCounters() const;
+    // Why counters are missing, empty when they all work
+    std::string unavailableReason() const;
+
+    // Stages in the order they first ran
+    std::vector<StageProfile> stages() const;
+    void reset();
+
+    // Count the calling thread too, for threads started after enable().
+    // Threads are otherwise listed on enable() and when the shared pool
+    // changes size.
+    void addThread();
+
+    // Current counts of all the counted threads
+    void sample(PerfSample &values);
+    // Deltas are scaled per counter by the share of the time it ran, for
+    // counters multiplexed with others
+    void record(
+        const char *stage,
+        double seconds,
+        uint64_t bytes,
+        const PerfSample &before,
+        const PerfSample &after
+    );
+
+    // Table of the stages with IPC and bytes per cycle
+    void print(std::ostream &output) const;
+
+    static const char *counterName(PerfCounter counter);
+    static Profiler &shared();
+
+  protected:
+    struct ThreadCounters
+    {
+        long thread;
+        int descriptors[PerfCounterCount];
+    };
+
+    std::atomic<bool> enabled;
+    mutable std::mutex mutex;
+    std::vector<StageProfile> stageList;
+    std::vector<ThreadCounters> threads;
+    size_t generation;
+    // Shared pool size the threads were listed at
+    size_t poolSize;
+    bool probed;
+    bool available[PerfCounterCount];
+    std::string problem;
+
+    void openThreads();
+    void openThread(long thread);
+    void closeThreads();
+};
+
+// Measures the enclosing block as a stage of the shared profiler, nothing
+// but a flag check when profiling is off
+class ProfileScope
+{
+  protected:
+    const char *stage;
+    uint64_t bytes;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    PerfSample before;
+
+  public:
+    ProfileScope(const char *stage, uint64_t bytes = 0);
+    ~ProfileScope();
+
+    // For stages that learn their size on the way, e.g. decoding
+    void addBytes(uint64_t bytes);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef __IBM_PROGRESSIVE_HPP__
+#define __IBM_PROGRESSIVE_HPP__
+
+#include "core.hpp"
+
+// Coarse-to-fine thresholding for interactive tuning. restart() thresholds a
+// downsampled copy of the image right away, refine() then works through the
+// full resolution image in bands of rows, each call for about the given
+// time. A new restart() drops the refinement in progress, so a range change
+// costs one coarse pass whatever the image size.
+class ProgressiveThreshold
+{
+  public:
+    // The coarse level has at most this many pixels
+    static constexpr size_t PreviewPixels = 1024 * 1024;
+    static constexpr size_t BandRows = 64;
+
+  protected:
+    // Header over the attached image, BGR or BGRA
+    cv::Mat image;
+    // Downsampled by 2^level in both directions
+    cv::Mat coarse;
+    int level;
+    ColorRange range;
+    bool started;
+    size_t nextRow;
+    cv::Mat coarseHSV, coarseMask, fullMask;
+
+  public:
+    ProgressiveThreshold();
+
+    // The image must stay unchanged while attached
+    void attach(const cv::Mat &image);
+    void detach();
+    bool isAttached() const;
+
+    // Threshold the coarse level with `range`, the full resolution mask
+    // starts over
+    void restart(const ColorRange &range);
+    // Threshold bands of the full resolution mask for about `seconds`, at
+    // least one. Returns true once the whole mask is done.
+    bool refine(double seconds);
+
+    bool isStarted() const;
+    bool isComplete() const;
+    // Share of the full resolution rows done, in [0, 1]
+    double progress() const;
+    int coarseLevel() const;
+
+    // 0/255 masks of the coarse level and of the full image, the latter is
+    // only complete when isComplete()
+    const cv::Mat &preview() const;
+    cv::Mat &mask();
+};
+
+#endif
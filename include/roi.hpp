@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef __IBM_ROI_HPP__
+#define __IBM_ROI_HPP__
+
+#include "core.hpp"
+#include "classifier.hpp"
+
+// Rectangles of a frame to process. Pixels outside all of them are neither
+// converted nor thresholded, so the cost follows the area of the rectangles
+// rather than the frame. Results cover the bounding box of the rectangles:
+// cell (i, j) is pixel (origin.y + i, origin.x + j) of the frame, and cells
+// outside every rectangle are false. No rectangles means the whole frame.
+struct RegionOfInterest
+{
+    std::vector<cv::Rect> rects;
+
+    RegionOfInterest();
+    RegionOfInterest(const cv::Rect &rect);
+
+    bool isEmpty() const;
+    void add(const cv::Rect &rect);
+    void clear();
+
+    // Rectangles clipped to the frame, empty ones dropped. The whole frame
+    // when there are no rectangles.
+    std::vector<cv::Rect> clip(const cv::Size &frame) const;
+    // Bounding box of the clipped rectangles, its top left corner is the
+    // origin of the results
+    cv::Rect bounds(const cv::Size &frame) const;
+    // Whether the results are the full frame
+    bool coversFrame(const cv::Size &frame) const;
+};
+
+// 0/255 mask of the bounding box from a BGR or BGRA image
+void thresholdRegion(
+    const cv::Mat &image,
+    const ColorRange &range,
+    const RegionOfInterest &roi,
+    cv::Mat &mask
+);
+void classifyRegion(
+    const cv::Mat &image,
+    const ColorClassifier &classifier,
+    const RegionOfInterest &roi,
+    cv::Mat &mask
+);
+
+// Clear the pixels of a mask of the bounding box that lie outside every
+// rectangle
+void clearOutsideRegion(
+    cv::Mat &mask,
+    const RegionOfInterest &roi,
+    const cv::Size &frame
+);
+
+#endif
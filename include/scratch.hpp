@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef __IBM_SCRATCH_HPP__
+#define __IBM_SCRATCH_HPP__
+
+#include "std.hpp"
+
+#include <atomic>
+
+#include <opencv2/opencv.hpp>
+
+enum ScratchSlot
+{
+    // Converted color image
+    ScratchHSV,
+    // Single channel 0/255 mask
+    ScratchMask,
+    // Mask expanded for display where the GPU cannot swizzle it
+    ScratchDisplay,
+    // Intermediate color conversion
+    ScratchColor,
+    ScratchSlotCount
+};
+
+// Buffers reused between calls: a slot is only (re)allocated when the
+// requested size or type differs from the previous request, so repeated
+// processing of the same image allocates nothing after the first call.
+// An arena is meant for one owner (image, thread), it is not synchronized.
+class ScratchArena
+{
+  protected:
+    std::vector<cv::Mat> slots;
+    size_t allocationCount, allocatedBytes;
+
+    static std::atomic<size_t> totalAllocationCount, totalAllocatedBytes;
+
+  public:
+    ScratchArena();
+
+    // Buffer of the slot with the given size and type, its content is
+    // whatever the previous user left there
+    cv::Mat &mat(ScratchSlot slot, int rows, int cols, int type);
+    // First `rows` rows of the slot, which only grows in height so that
+    // requests of varying height (image stripes) stop allocating quickly
+    cv::Mat band(ScratchSlot slot, int rows, int cols, int type);
+
+    // Free all the buffers, the counters are kept
+    void release();
+
+    // Allocations done by this arena and their total size
+    size_t allocations() const;
+    size_t bytes() const;
+
+    // Same over all the arenas of the process
+    static size_t totalAllocations();
+    static size_t totalBytes();
+
+    // Arena of the calling thread
+    static ScratchArena &local();
+};
+
+#endif
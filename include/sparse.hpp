@@ -0,0 +1,54 @@
+#pragma once
+
+#ifndef __IBM_SPARSE_HPP__
+#define __IBM_SPARSE_HPP__
+
+#include "core.hpp"
+
+// Compressed sparse rows: only the columns of true cells are stored, so
+// memory and iteration cost follow the number of true cells rather than
+// rows x cols. Meant for masks with a handful of matches.
+struct SparseBinaryMatrix
+{
+    size_t rows, cols;
+    // rows + 1 entries, row i owns columns[rowOffsets[i], rowOffsets[i + 1])
+    std::vector<size_t> rowOffsets;
+    // Sorted within every row
+    std::vector<uint32_t> columns;
+
+    SparseBinaryMatrix();
+    SparseBinaryMatrix(size_t rows, size_t cols);
+    SparseBinaryMatrix(const BinaryMatrix &matrix);
+
+    bool isEmpty() const;
+    bool isValid() const;
+    bool hasTrue() const;
+    void reset(size_t rows = 0, size_t cols = 0);
+
+    // Binary search within the row
+    BinaryMatrix::Type at(size_t row, size_t col) const;
+    bool isTrue(size_t row, size_t col) const;
+    bool isFalse(size_t row, size_t col) const;
+
+    // Number of true cells
+    size_t count() const;
+    // First and past the last column index of a row
+    const uint32_t *rowBegin(size_t row) const;
+    const uint32_t *rowEnd(size_t row) const;
+
+    // Same as the BinaryMatrix ones
+    std::vector<unsigned int> sumRows() const;
+    std::vector<unsigned int> sumCols() const;
+    SparseBinaryMatrix transpose() const;
+
+    BinaryMatrix toDense() const;
+
+    // Fill from an 8-bit mask like BinaryMatrix::assignMask
+    void assignMask(const cv::Mat &mask);
+
+    // Whether `count` true cells out of rows x cols take less room (and
+    // time to walk) in the sparse form
+    static bool isPreferred(size_t count, size_t rows, size_t cols);
+};
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef __IBM_STATISTICS_HPP__
+#define __IBM_STATISTICS_HPP__
+
+#include "core.hpp"
+
+// Everything about the true cells of a matrix, gathered in one pass
+struct RegionStatistics
+{
+    // Number of true cells
+    size_t count;
+
+    // Tight bounding box, inclusive. Only meaningful when count > 0
+    size_t top, left, bottom, right;
+
+    // Mean position of the true cells
+    double centroidRow, centroidCol;
+
+    // Second-order central moments (variances and covariance of the cell
+    // positions, not normalized by count)
+    double mu20, mu02, mu11;
+
+    // Same as BinaryMatrix::sumRows() and BinaryMatrix::sumCols()
+    std::vector<unsigned int> rowSums, colSums;
+
+    RegionStatistics();
+    RegionStatistics(const BinaryMatrix &matrix);
+
+    bool isEmpty() const;
+    size_t boxWidth() const;
+    size_t boxHeight() const;
+
+    // Orientation of the region major axis in radians
+    double orientation() const;
+};
+
+#endif
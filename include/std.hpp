@@ -4,6 +4,7 @@
 #define __IBM_STD_HPP__
 
 #include <stdio.h>
+#include <stdint.h>
 
 #include <iostream>
 #include <fstream>
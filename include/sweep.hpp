@@ -0,0 +1,35 @@
+#pragma once
+
+#ifndef __IBM_SWEEP_HPP__
+#define __IBM_SWEEP_HPP__
+
+#include "core.hpp"
+
+// Matches of many color ranges on one image
+struct RangeSweep
+{
+    // Matched pixels of every range, in the order of the ranges
+    std::vector<size_t> counts;
+    // Packed mask of every range, only filled when asked for
+    std::vector<BinaryMatrix> masks;
+    // Pixels of the image
+    size_t pixels;
+
+    RangeSweep();
+
+    bool hasMasks() const;
+    // Share of the image matched by range `index`
+    double coverage(size_t index) const;
+};
+
+// Evaluate all the ranges on a BGR or BGRA image in a single pass: every
+// stripe of rows is converted to HSV once and each pixel is compared with
+// all the ranges while it is in registers, instead of one conversion and
+// threshold per range. Ranges no pixel can match count zero.
+RangeSweep sweepColorRanges(
+    const cv::Mat &image,
+    const std::vector<ColorRange> &ranges,
+    bool withMasks = false
+);
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#ifndef __IBM_THUMBNAIL_HPP__
+#define __IBM_THUMBNAIL_HPP__
+
+#include "core.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Longest side of a thumbnail in pixels
+#define THUMBNAIL_SIZE 64
+#define THUMBNAIL_WORKERS 2
+// Thumbnails not requested for this many frames leave memory
+#define THUMBNAIL_KEEP_FRAMES 120
+
+// Small previews of image files made by background workers. Files are
+// decoded at reduced resolution and the thumbnails kept on disk as JPEG
+// under the hash of the path, size and modification time of the file, so
+// they are made once. The least recently used thumbnails leave the disk
+// past the capacity. Only the thumbnails requested lately stay in memory,
+// files scrolled past before a worker got to them are skipped.
+class ThumbnailCache
+{
+  protected:
+    struct Entry
+    {
+        // Empty until made
+        cv::Mat image;
+        // Frame of the last request
+        size_t requested;
+        // Cannot be decoded, not tried again
+        bool failed;
+
+        Entry();
+    };
+
+    std::filesystem::path directory;
+    uint64_t capacity;
+    // Size of the thumbnails on disk, exact after a scan and estimated in
+    // between
+    std::atomic<uint64_t> bytes;
+    // Held while evicting
+    std::mutex evicting;
+    std::unordered_map<std::string, Entry> entries;
+    std::deque<std::string> queue;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    size_t frame;
+    bool stopping;
+
+  public:
+    ThumbnailCache();
+    ~ThumbnailCache();
+
+    ThumbnailCache(const ThumbnailCache &) = delete;
+    ThumbnailCache &operator=(const ThumbnailCache &) = delete;
+
+    // Create the directory when needed and start the workers, the first
+    // one measures the directory and evicts down to `capacity` bytes
+    bool open(
+        const std::filesystem::path &directory,
+        uint64_t capacity,
+        size_t workers = THUMBNAIL_WORKERS
+    );
+    void close();
+    bool isOpen() const;
+
+    // Called once per frame before the requests, drops the thumbnails that
+    // were not requested for `keep` frames
+    void nextFrame(size_t keep = THUMBNAIL_KEEP_FRAMES);
+    // Thumbnail of the file, empty until a worker made it. The file is
+    // queued on the first request.
+    cv::Mat request(const std::filesystem::path &path);
+    // Files waiting for a worker
+    size_t pending();
+
+    // Decode `path` to at most `size` pixels on its longest side. JPEG is
+    // decoded straight at 1/8 of its size, small images whole. Empty when
+    // the file cannot be read.
+    static cv::Mat generate(
+        const std::filesystem::path &path,
+        int size = THUMBNAIL_SIZE
+    );
+
+  protected:
+    std::filesystem::path entryPath(const std::filesystem::path &file) const;
+    // Disk copy or a new thumbnail, stored on disk
+    cv::Mat make(const std::filesystem::path &file);
+    void evict(uint64_t target);
+    void work();
+};
+
+#endif
@@ -4,16 +4,15 @@
 #define __IBM_UTILS_HPP___
 
 #include "std.hpp"
+#include "core.hpp"
+#include "cache.hpp"
+#include "progressive.hpp"
+#include "roi.hpp"
+#include "scratch.hpp"
 
-#include <opencv2/opencv.hpp>
 #include <GL/glew.h>
 
-struct ColorRange
-{
-    cv::Scalar from, to;
-
-    ColorRange(const cv::Scalar &from, const cv::Scalar &to);
-};
+struct ColorClassifier;
 
 struct Texture2D
 {
@@ -22,6 +21,8 @@ struct Texture2D
     Texture2D();
 
     void reset();
+    // Uploads on first use. Single channel 8-bit images are kept one byte
+    // per pixel on the GPU and shown gray.
     void render(const cv::Mat &mat);
     void bind();
 };
@@ -30,15 +31,46 @@ struct Image
 {
     std::filesystem::path filename, ext, path;
     cv::Mat cv, mask;
+    // Frame position of the top left mask pixel, the mask covers the
+    // bounds of the region it was processed in
+    cv::Point maskOrigin;
+    // Hash of the file bytes, set on load
+    ContentHash contentHash;
     Texture2D texture, maskTexture;
+    // Live preview: coarse mask shown while the full one is being refined
+    ProgressiveThreshold progressive;
+    cv::Mat previewMask;
+    Texture2D previewTexture;
+    // Conversion buffers kept between mask regenerations, `mask` shares one
+    // of them
+    ScratchArena scratch;
 
     Image(const std::filesystem::path &path, bool load = false);
 
     void load();
     void validate() const;
 
-    void processMaskByColorRange(const ColorRange &colorRange);
-    bool saveMask(const std::filesystem::path &path);
+    void processMaskByColorRange(
+        const ColorRange &colorRange,
+        const RegionOfInterest &roi = RegionOfInterest()
+    );
+    void processMaskByClassifier(
+        const ColorClassifier &classifier,
+        const RegionOfInterest &roi = RegionOfInterest()
+    );
+    // Mask of a matrix generated before, e.g. a cached one of the same size
+    void processMaskByMatrix(const BinaryMatrix &matrix);
+    // Threshold the coarse level for `previewMask` and start refining, over
+    // the bounds of the region
+    void previewMaskByColorRange(
+        const ColorRange &colorRange,
+        const RegionOfInterest &roi = RegionOfInterest()
+    );
+    // Refine the previewed mask for about `seconds`, once it is complete it
+    // becomes `mask` and true is returned
+    bool refinePreviewMask(double seconds);
+    // Coarse preview shown, full resolution mask not done yet
+    bool isPreviewing() const;
 
     int width() const;
     int height() const;
@@ -48,55 +80,11 @@ struct Image
 
   private:
     bool loaded, maskProcessed;
-};
+    // Region the live preview was attached to
+    RegionOfInterest previewRegion;
 
-struct Exception
-{
-    std::string message;
-
-    Exception(const std::string &message);
-};
-
-struct BinaryMatrix
-{
-    using Type = bool;
-    static const Type True = (Type)(1);
-    static const Type False = (Type)(0);
-
-    size_t rows, cols;
-    std::vector<std::vector<Type>> data;
-
-    BinaryMatrix();
-    BinaryMatrix(size_t rows, size_t cols);
-    BinaryMatrix(
-        size_t rows,
-        size_t cols,
-        const std::vector<std::vector<Type>> &data
-    );
-
-    bool isEmpty() const;
-    bool isValid() const;
-    bool hasTrue() const;
-    void clear();
-    Type at(size_t row, size_t col) const;
-    void set(size_t row, size_t col, Type value);
-    void reset(size_t rows = 0, size_t cols = 0);
-    bool isTrue(size_t row, size_t col) const;
-    bool isFalse(size_t row, size_t col) const;
-
-    // Return vector of rows,
-    // each element is a sum of all the row elements
-    std::vector<unsigned int> sumRows() const;
-
-    // Return vector of columns,
-    // each element is a sum of all the column
-    std::vector<unsigned int> sumCols() const;
-
-    // Flip a matrix over its diagonal
-    BinaryMatrix transpose() const;
-
-  private:
-    using self = BinaryMatrix;
+    // Takes a single channel 0/255 mask, which is stored as it is
+    void applyMask(const cv::Mat &mask);
 };
 
 #endif
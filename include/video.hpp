@@ -0,0 +1,193 @@
+#pragma once
+
+#ifndef __IBM_VIDEO_HPP__
+#define __IBM_VIDEO_HPP__
+
+#include "core.hpp"
+#include "cache.hpp"
+#include "contour.hpp"
+#include "sparse.hpp"
+
+#include <functional>
+
+class IFrameSource
+{
+  public:
+    virtual ~IFrameSource() = default;
+
+    virtual bool open() = 0;
+    // Decode the next frame into `frame`, reusing its buffer when the size
+    // matches. Returns false at the end of the stream.
+    virtual bool read(cv::Mat &frame) = 0;
+    // Like read(), but the content hash of the encoded frame is set to `hash`
+    // and passed to `skip` first, a frame it returns true for is not decoded
+    // and `frame` is left as it is. Sources that cannot hash a frame before
+    // decoding it leave `hash` empty and always decode.
+    virtual bool read(
+        cv::Mat &frame,
+        ContentHash &hash,
+        const std::function<bool(const ContentHash &)> &skip
+    );
+    virtual void close() = 0;
+};
+
+// Video file or stream URL, anything cv::VideoCapture can open
+class VideoFrameSource: public IFrameSource
+{
+  protected:
+    std::string path;
+    cv::VideoCapture capture;
+
+  public:
+    VideoFrameSource(const std::string &path);
+
+    using IFrameSource::read;
+
+    virtual bool open();
+    virtual bool read(cv::Mat &frame);
+    virtual void close();
+};
+
+// Numbered image files matching a glob pattern ("frames/*.png"), read in
+// name order
+class SequenceFrameSource: public IFrameSource
+{
+  protected:
+    std::string pattern;
+    std::vector<std::string> files;
+    size_t next;
+    std::vector<uchar> buffer;
+
+  public:
+    SequenceFrameSource(const std::string &pattern);
+
+    virtual bool open();
+    virtual bool read(cv::Mat &frame);
+    virtual bool read(
+        cv::Mat &frame,
+        ContentHash &hash,
+        const std::function<bool(const ContentHash &)> &skip
+    );
+    virtual void close();
+
+  protected:
+    // Encoded bytes of the next readable file into `buffer`
+    bool readNextFile();
+};
+
+class IFrameSink
+{
+  public:
+    virtual ~IFrameSink() = default;
+
+    virtual bool open() = 0;
+    virtual void write(size_t index, const BinaryMatrix &matrix) = 0;
+    // Mostly false frames come in the sparse form, sinks without a native
+    // sparse write get the dense copy
+    virtual void write(size_t index, const SparseBinaryMatrix &matrix);
+    virtual bool close() = 0;
+};
+
+// One "0/1" text file per frame: <directory>/<stem>.<index>.txt
+class MatrixFileSink: public IFrameSink
+{
+  protected:
+    std::filesystem::path directory;
+    std::string stem;
+    bool good;
+
+  public:
+    MatrixFileSink(
+        const std::filesystem::path &directory,
+        const std::string &stem
+    );
+
+    virtual bool open();
+    virtual void write(size_t index, const BinaryMatrix &matrix);
+    virtual void write(size_t index, const SparseBinaryMatrix &matrix);
+    virtual bool close();
+};
+
+// Outlines of every frame, one file per frame:
+// <directory>/<stem>.<index>.json or .ibmp, see ContourFormat
+class ContourFileSink: public IFrameSink
+{
+  protected:
+    std::filesystem::path directory;
+    std::string stem;
+    ContourFormat format;
+    // Douglas-Peucker tolerance in cells, no simplification when zero
+    double epsilon;
+    bool good;
+
+  public:
+    ContourFileSink(
+        const std::filesystem::path &directory,
+        const std::string &stem,
+        ContourFormat format,
+        double epsilon = 0
+    );
+
+    virtual bool open();
+    virtual void write(size_t index, const BinaryMatrix &matrix);
+    virtual bool close();
+};
+
+// All the frames in one binary file: "IBMS" magic, then for every frame
+// uint32 rows, uint32 cols, uint32 encoding and the cells. Encoding 0 is
+// rows * BinaryMatrix::wordsFor(cols) 64-bit words in the in-memory
+// (little-endian) bit layout of BinaryMatrix, encoding 1 is rows + 1 uint64
+// row offsets followed by the uint32 column of every true cell.
+class PackedStreamSink: public IFrameSink
+{
+  protected:
+    std::filesystem::path path;
+    std::ofstream stream;
+
+  public:
+    PackedStreamSink(const std::filesystem::path &path);
+
+    virtual bool open();
+    virtual void write(size_t index, const BinaryMatrix &matrix);
+    virtual void write(size_t index, const SparseBinaryMatrix &matrix);
+    virtual bool close();
+};
+
+struct PipelineReport
+{
+    size_t frames;
+    // Frames taken from the result cache without decoding
+    size_t cached;
+    double seconds;
+
+    PipelineReport();
+
+    double fps() const;
+};
+
+// Decode -> threshold -> matrix -> sink. Decoding runs on its own thread
+// into two frame buffers used in turn, while the calling thread thresholds
+// the other one. All the buffers are reused between frames. Frames with few
+// true cells are handed to the sink as SparseBinaryMatrix. With a cache,
+// frames whose content and range were seen before are loaded from it instead
+// of being decoded and thresholded, new results are stored into it.
+class FramePipeline
+{
+  protected:
+    IFrameSource &source;
+    IFrameSink &sink;
+    ColorRange colorRange;
+    ResultCache *cache;
+
+  public:
+    FramePipeline(
+        IFrameSource &source,
+        IFrameSink &sink,
+        const ColorRange &colorRange,
+        ResultCache *cache = nullptr
+    );
+
+    PipelineReport run();
+};
+
+#endif
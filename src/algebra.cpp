@@ -0,0 +1,159 @@
+#include "algebra.hpp"
+#include "kernels.hpp"
+
+using Word = BinaryMatrix::Word;
+
+static void validateSizes(const BinaryMatrix &a, const BinaryMatrix &b) {
+    if (a.rows != b.rows || a.cols != b.cols) {
+        throw Exception("Binary matrix sizes do not match!");
+    }
+}
+
+// Word kernels of the selected CPU level over the whole buffers. Padding
+// bits stay clear for all the operations.
+static void applyInPlace(
+    BinaryMatrix &a,
+    const BinaryMatrix &b,
+    void (*kernel)(Word *, const Word *, size_t)
+) {
+    validateSizes(a, b);
+
+    kernel(a.data.data(), b.data.data(), a.data.size());
+}
+
+static size_t applyCount(
+    const BinaryMatrix &a,
+    const BinaryMatrix &b,
+    size_t (*kernel)(const Word *, const Word *, size_t)
+) {
+    validateSizes(a, b);
+
+    return kernel(a.data.data(), b.data.data(), a.data.size());
+}
+
+BinaryMatrix operator&(const BinaryMatrix &a, const BinaryMatrix &b) {
+    BinaryMatrix result = a;
+
+    return result &= b;
+}
+
+BinaryMatrix operator|(const BinaryMatrix &a, const BinaryMatrix &b) {
+    BinaryMatrix result = a;
+
+    return result |= b;
+}
+
+BinaryMatrix operator^(const BinaryMatrix &a, const BinaryMatrix &b) {
+    BinaryMatrix result = a;
+
+    return result ^= b;
+}
+
+BinaryMatrix operator~(const BinaryMatrix &a) {
+    BinaryMatrix result = a;
+
+    return invertInPlace(result);
+}
+
+BinaryMatrix andNot(const BinaryMatrix &a, const BinaryMatrix &b) {
+    BinaryMatrix result = a;
+
+    return andNotInPlace(result, b);
+}
+
+BinaryMatrix &operator&=(BinaryMatrix &a, const BinaryMatrix &b) {
+    applyInPlace(a, b, kernels().andWords);
+
+    return a;
+}
+
+BinaryMatrix &operator|=(BinaryMatrix &a, const BinaryMatrix &b) {
+    applyInPlace(a, b, kernels().orWords);
+
+    return a;
+}
+
+BinaryMatrix &operator^=(BinaryMatrix &a, const BinaryMatrix &b) {
+    applyInPlace(a, b, kernels().xorWords);
+
+    return a;
+}
+
+BinaryMatrix &andNotInPlace(BinaryMatrix &a, const BinaryMatrix &b) {
+    applyInPlace(a, b, kernels().andNotWords);
+
+    return a;
+}
+
+BinaryMatrix &invertInPlace(BinaryMatrix &a) {
+    if (a.isEmpty()) {
+        return a;
+    }
+
+    kernels().invertWords(a.data.data(), a.data.size());
+
+    // Keep the padding bits clear
+    const auto tailMask = a.lastWordMask();
+    for (size_t i = 0; i < a.rows; i++) {
+        a.row(i)[a.stride - 1] &= tailMask;
+    }
+
+    return a;
+}
+
+size_t countTrue(const BinaryMatrix &a) {
+    return kernels().countBits(a.data.data(), a.data.size());
+}
+
+size_t countAnd(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return applyCount(a, b, kernels().countAnd);
+}
+
+size_t countOr(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return applyCount(a, b, kernels().countOr);
+}
+
+size_t countXor(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return applyCount(a, b, kernels().countXor);
+}
+
+size_t countAndNot(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return applyCount(a, b, kernels().countAndNot);
+}
+
+OverlapCounts::OverlapCounts(): both(0), either(0), differing(0) {
+}
+
+OverlapCounts countOverlap(const BinaryMatrix &a, const BinaryMatrix &b) {
+    validateSizes(a, b);
+
+    size_t counts[2];
+    kernels().countAndOr(a.data.data(), b.data.data(), a.data.size(), counts);
+
+    OverlapCounts result;
+    result.both = counts[0];
+    result.either = counts[1];
+    result.differing = counts[1] - counts[0];
+
+    return result;
+}
+
+size_t hammingDistance(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return countXor(a, b);
+}
+
+double intersectionOverUnion(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return intersectionOverUnion(countOverlap(a, b));
+}
+
+double intersectionOverUnion(const OverlapCounts &counts) {
+    if (counts.either == 0) {
+        return 1.0;
+    }
+
+    return double(counts.both) / double(counts.either);
+}
+
+double jaccardDistance(const BinaryMatrix &a, const BinaryMatrix &b) {
+    return 1.0 - intersectionOverUnion(a, b);
+}
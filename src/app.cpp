@@ -3,20 +3,40 @@
 using namespace std;
 namespace fs = std::filesystem;
 
-#define DEFAULT_NONE "<none>"
 #define IMAGE_EXTENSIONS \
     { ".png", ".jpg", ".jpeg" }
 
 #define GREEN_TEXT_COLOR (ImVec4(0.455f, 0.922f, 0.543f, 1.000f))
 #define RED_TEXT_COLOR (ImVec4(0.922f, 0.455f, 0.455f, 1.000f))
+#define REGION_COLOR (IM_COL32(255, 200, 0, 255))
+#define RESULT_CACHE_BYTES (256 * 1024 * 1024)
+#define THUMBNAIL_CACHE_BYTES (64 * 1024 * 1024)
+// Height of the input file list, rows out of view are not laid out
+#define IMAGE_LIST_HEIGHT 240
+// The range counts as settled after this long without a change
+#define PREVIEW_SETTLE_SECONDS 0.15
+// Full resolution refinement done per frame
+#define PREVIEW_REFINE_SECONDS 0.008
 
 GuiInputData::GuiInputData()
     : selectedImageFile(-1),
+      imageFilter {},
+      showThumbnails(true),
+      hsvFrom {0.145f, 0.165f, 0.000f, 1.0f},
+      hsvTo {0.329f, 1.000f, 1.000f, 1.0f},
       imagePreviewOpened(false),
       maskPreviewOpened(false),
       binaryMatrixPreview(false),
-      hsvFrom {0.145f, 0.165f, 0.000f, 1.0f},
-      hsvTo {0.329f, 1.000f, 1.000f, 1.0f} {
+      threads((int)ThreadPool::shared().size()),
+      profiling(false),
+      livePreview(false),
+      maskFormat(BitmapPNG),
+      matrixFormat(MatrixText),
+      contourFormat(ContourJSON),
+      contourSimplify(0),
+      cleanupOperation(CleanupNone),
+      cleanupShape(StructuringElement::Rect),
+      cleanupSize(3) {
 }
 
 cv::Scalar GuiInputData::hsvCV(float *hsv) const {
@@ -34,6 +54,30 @@ ColorRange GuiInputData::hsvToRange() const {
     return ColorRange(from, to);
 }
 
+ColorRange GuiInputData::hsvToRange(const GuiColorRange &range) const {
+    const auto from = this->hsvCV((float *)range.hsvFrom);
+    const auto to = this->hsvCV((float *)range.hsvTo);
+
+    return ColorRange(from, to);
+}
+
+ColorClassifier GuiInputData::hsvToClassifier() const {
+    ColorClassifier classifier;
+    classifier.include(this->hsvToRange());
+
+    for (auto &&range : this->extraRanges) {
+        if (range.exclude) {
+            classifier.exclude(this->hsvToRange(range));
+        } else {
+            classifier.include(this->hsvToRange(range));
+        }
+    }
+
+    classifier.compile();
+
+    return classifier;
+}
+
 bool GuiInputData::isImageSelected() const {
     return this->selectedImageFile >= 0;
 }
@@ -41,16 +85,23 @@ bool GuiInputData::isImageSelected() const {
 IBMApplication::IBMApplication(const std::string &currentExecutablePath)
     : Application("Image Binary Matrix"),
       image(nullptr),
+      isComparable(false),
+      previousIoU(0),
+      changedCells(0),
       isImageLoaded(false),
       isMaskProcessed(false),
       toRefresh(true),
       toReset(true),
-      toRegenerate(false) {
+      toRegenerate(false),
+      toPreview(false),
+      toRedrawMatrix(false) {
     this->path.executable = fs::absolute(fs::path(currentExecutablePath));
     this->path.directory = this->path.executable.parent_path();
 
     this->path.input = this->path.directory / std::string("input/");
     this->path.output = this->path.directory / std::string("output/");
+    this->path.cache = this->path.directory / std::string("cache/");
+    this->path.thumbnails = this->path.directory / std::string("thumbnails/");
 }
 
 bool IBMApplication::init() {
@@ -60,6 +111,8 @@ bool IBMApplication::init() {
 
     this->createDirectory(this->path.input);
     this->createDirectory(this->path.output);
+    this->cache.open(this->path.cache, RESULT_CACHE_BYTES);
+    this->thumbnails.open(this->path.thumbnails, THUMBNAIL_CACHE_BYTES);
     this->loadImageFileList();
 
     auto &config = ImGui::GetIO();
@@ -106,11 +159,14 @@ void IBMApplication::draw() {
         this->toReset = false;
     }
     if (this->toRegenerate) {
-        this->image->processMaskByColorRange(this->data.hsvToRange());
+        this->processMask();
         this->generateBinaryMatrix();
 
         this->toRegenerate = false;
     }
+    if (this->data.livePreview && this->isImageLoaded) {
+        this->updatePreview();
+    }
 }
 
 void IBMApplication::drawMenuBar() {
@@ -126,9 +182,82 @@ void IBMApplication::drawMenuBar() {
         ImGui::EndMenu();
     }
 
+    if (ImGui::BeginMenu("Settings")) {
+        const int maxThreads
+            = (int)std::max(1u, std::thread::hardware_concurrency());
+
+        ImGui::SliderInt("Threads", &this->data.threads, 1, maxThreads);
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+            ThreadPool::shared().resize(this->data.threads);
+        }
+        ImGui::Text("Instruction set: %s", cpuLevelName(kernels().level));
+        ImGui::Text(
+            "Scratch buffers: %zu allocations, %.1f MB",
+            ScratchArena::totalAllocations(),
+            ScratchArena::totalBytes() / (1024.0 * 1024.0)
+        );
+        ImGui::Text(
+            "Result cache: %zu hits, %zu misses, %.1f MB",
+            this->cache.hits(),
+            this->cache.misses(),
+            this->cache.size() / (1024.0 * 1024.0)
+        );
+
+        ImGui::Separator();
+        if (ImGui::Checkbox("Profile Stages", &this->data.profiling)) {
+            if (this->data.profiling) {
+                Profiler::shared().enable();
+            } else {
+                Profiler::shared().disable();
+            }
+        }
+        if (this->data.profiling) {
+            this->drawProfile();
+        }
+
+        ImGui::EndMenu();
+    }
+
     ImGui::EndMainMenuBar();
 }
 
+void IBMApplication::drawProfile() {
+    auto &profiler = Profiler::shared();
+    const bool counted = profiler.hasCounter(PerfCycles)
+                         && profiler.hasCounter(PerfInstructions);
+
+    for (auto &&stage : profiler.stages()) {
+        if (counted) {
+            ImGui::Text(
+                "%s: %zu calls, %.2f ms, IPC %.2f, %.2f B/cycle, "
+                "%llu LLC misses, %llu branch misses",
+                stage.name.c_str(),
+                stage.calls,
+                stage.seconds * 1000,
+                stage.ipc(),
+                stage.bytesPerCycle(),
+                (unsigned long long)stage.counters[PerfCacheMisses],
+                (unsigned long long)stage.counters[PerfBranchMisses]
+            );
+        } else {
+            ImGui::Text(
+                "%s: %zu calls, %.2f ms",
+                stage.name.c_str(),
+                stage.calls,
+                stage.seconds * 1000
+            );
+        }
+    }
+
+    const auto reason = profiler.unavailableReason();
+    if (!reason.empty()) {
+        ImGui::Text("Hardware counters unavailable: %s", reason.c_str());
+    }
+    if (ImGui::Button("Reset Profile")) {
+        profiler.reset();
+    }
+}
+
 void IBMApplication::drawMainWindow() {
     int width = std::min(this->windowWidth, 600),
         height = std::min(this->windowHeight, 800);
@@ -151,41 +280,10 @@ void IBMApplication::drawMainWindow() {
             ImGuiWindowFlags_HorizontalScrollbar
         );
 
-        auto inputImageCount = this->path.images.size();
-        if (inputImageCount > 0) {
-            static string maxPath = DEFAULT_NONE;
-
-            if (this->toRefresh) {
-                maxPath = (*std::max_element(
-                               this->path.images.cbegin(),
-                               this->path.images.cend(),
-                               [](const fs::path &a, const fs::path &b) {
-                                   return a.string().size() < b.string().size();
-                               }
-                           )).string();
-            }
-
+        if (!this->path.images.empty()) {
             ImGui::Text("Image Filename");
 
-            auto nextWidth = ImGui::CalcTextSize(maxPath.c_str()).x
-                             + ImGui::GetFontSize() * 2;
-            ImGui::SetNextItemWidth(nextWidth);
-
-            ImGui::ListBox(
-                "##ImageFile",
-                &this->data.selectedImageFile,
-                [](void *data, int idx) -> const char * {
-                    const auto &images = *(decltype(this->path.images) *)data;
-
-                    if (idx >= 0 && idx < images.size()) {
-                        return images[idx].c_str();
-                    }
-
-                    return DEFAULT_NONE;
-                },
-                (void *)&this->path.images,
-                inputImageCount
-            );
+            this->drawImageFileList();
         } else {
             ImGui::TextColored(
                 RED_TEXT_COLOR,
@@ -207,6 +305,7 @@ void IBMApplication::drawMainWindow() {
                 if (this->isMaskProcessed) {
                     this->toRegenerate = true;
                 }
+                this->toPreview = this->data.livePreview;
 
                 try {
                     auto imageFilename = this->getSelectedImage();
@@ -256,13 +355,13 @@ void IBMApplication::drawMainWindow() {
 
 void IBMApplication::drawImageTools() {
     static bool generatePressed;
-    static bool saved, savedMatrix;
-    static string savedFilename, savedFilenameMatrix;
+    static bool saved, savedMatrix, savedContours;
+    static string savedFilename, savedFilenameMatrix, savedFilenameContours;
 
     if (this->toReset || this->toRegenerate) {
         generatePressed = this->toRegenerate;
-        saved = savedMatrix = false;
-        savedFilename = savedFilenameMatrix = "";
+        saved = savedMatrix = savedContours = false;
+        savedFilename = savedFilenameMatrix = savedFilenameContours = "";
 
         return;
     }
@@ -279,18 +378,113 @@ void IBMApplication::drawImageTools() {
         );
 
         ImGui::Text("Color Range");
-        ImGui::ColorEdit3(
+        bool rangeEdited = ImGui::ColorEdit3(
             "From",
             this->data.hsvFrom,
             ImGuiColorEditFlags_DisplayHSV | ImGuiColorEditFlags_InputHSV
                 | ImGuiColorEditFlags_Uint8
         );
-        ImGui::ColorEdit3(
+        rangeEdited |= ImGui::ColorEdit3(
             "To",
             this->data.hsvTo,
             ImGuiColorEditFlags_DisplayHSV | ImGuiColorEditFlags_InputHSV
                 | ImGuiColorEditFlags_Uint8
         );
+
+        // Only the main range is previewed, extra ranges need Generate
+        if (this->data.extraRanges.empty()) {
+            if (ImGui::Checkbox("Live Preview", &this->data.livePreview)
+                && this->data.livePreview) {
+                this->data.maskPreviewOpened = true;
+                rangeEdited = true;
+            }
+            if (this->image->isPreviewing()) {
+                ImGui::SameLine();
+                ImGui::Text(
+                    "Refining %.0f%%",
+                    this->image->progressive.progress() * 100
+                );
+            }
+        } else {
+            this->data.livePreview = false;
+        }
+        this->toPreview |= rangeEdited && this->data.livePreview;
+
+        auto &extraRanges = this->data.extraRanges;
+        for (size_t k = 0; k < extraRanges.size(); k++) {
+            auto &range = extraRanges[k];
+
+            ImGui::PushID((int)k);
+            ImGui::Text("Extra Color Range #%zu", k + 1);
+            ImGui::ColorEdit3(
+                "From",
+                range.hsvFrom,
+                ImGuiColorEditFlags_DisplayHSV | ImGuiColorEditFlags_InputHSV
+                    | ImGuiColorEditFlags_Uint8
+            );
+            ImGui::ColorEdit3(
+                "To",
+                range.hsvTo,
+                ImGuiColorEditFlags_DisplayHSV | ImGuiColorEditFlags_InputHSV
+                    | ImGuiColorEditFlags_Uint8
+            );
+            ImGui::Checkbox("Exclude", &range.exclude);
+            ImGui::SameLine();
+            bool toRemove = ImGui::Button("Remove");
+            ImGui::PopID();
+
+            if (toRemove) {
+                extraRanges.erase(extraRanges.begin() + k);
+
+                break;
+            }
+        }
+
+        if (ImGui::Button("Add Color Range")) {
+            GuiColorRange range;
+            std::copy_n(this->data.hsvFrom, 4, range.hsvFrom);
+            std::copy_n(this->data.hsvTo, 4, range.hsvTo);
+            range.exclude = false;
+
+            extraRanges.push_back(range);
+        }
+        ImGui::NewLine();
+
+        ImGui::Text("Region");
+        auto &roi = this->data.roi;
+        if (roi.isEmpty()) {
+            ImGui::Text("Whole image, drag on the preview to select");
+        } else {
+            const auto bounds = roi.bounds(this->image->cv.size());
+
+            ImGui::Text(
+                "%zu rectangle(s), bounds %dx%d at (%d, %d)",
+                roi.rects.size(),
+                bounds.width,
+                bounds.height,
+                bounds.x,
+                bounds.y
+            );
+            ImGui::SameLine();
+            if (ImGui::Button("Clear Region")) {
+                roi.clear();
+
+                this->toRegenerate = this->isMaskProcessed;
+                this->toPreview = this->data.livePreview;
+            }
+        }
+        ImGui::NewLine();
+
+        ImGui::Text("Noise Cleanup");
+        ImGui::Combo(
+            "Operation",
+            &this->data.cleanupOperation,
+            "None\0Opening\0Closing\0Erosion\0Dilation\0"
+        );
+        if (this->data.cleanupOperation != CleanupNone) {
+            ImGui::Combo("Shape", &this->data.cleanupShape, "Rect\0Cross\0");
+            ImGui::SliderInt("Size", &this->data.cleanupSize, 1, 63);
+        }
         ImGui::NewLine();
 
         if (generatePressed) {
@@ -351,6 +545,33 @@ void IBMApplication::drawImageTools() {
         ImGuiWindowFlags_HorizontalScrollbar
     );
 
+    const auto &stats = this->statistics;
+    if (!stats.isEmpty()) {
+        // Matrix cells are relative to the region, shown in image pixels
+        const auto &origin = this->image->maskOrigin;
+
+        ImGui::Text(
+            "Matched cells: %zu, bounds: [%zu, %zu] - [%zu, %zu], "
+            "centroid: (%.1f, %.1f)",
+            stats.count,
+            stats.left + origin.x,
+            stats.top + origin.y,
+            stats.right + origin.x,
+            stats.bottom + origin.y,
+            stats.centroidCol + origin.x,
+            stats.centroidRow + origin.y
+        );
+
+        if (this->isComparable) {
+            ImGui::Text(
+                "Compared to previous matrix: IoU %.4f, %zu cells changed",
+                this->previousIoU,
+                this->changedCells
+            );
+        }
+        ImGui::NewLine();
+    }
+
     if (!savedFilenameMatrix.empty()) {
         if (savedMatrix) {
             ImGui::TextColored(
@@ -368,22 +589,70 @@ void IBMApplication::drawImageTools() {
         }
     }
 
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 10);
+    ImGui::Combo(
+        "Matrix Format",
+        &this->data.matrixFormat,
+        "Text\0CSV\0JSON\0"
+    );
+
     if (ImGui::Button("Save Binary Matrix to File")) {
-        savedFilenameMatrix = this->buildOutputImageFilename() + ".txt";
-        std::ofstream fileOutput(
-            (this->path.output / savedFilenameMatrix).string()
+        const auto format = (MatrixFormat)this->data.matrixFormat;
+        savedFilenameMatrix
+            = this->buildOutputImageFilename() + matrixExtension(format);
+        savedMatrix = exportMatrix(
+            this->matrix,
+            this->path.output / savedFilenameMatrix,
+            format
         );
+    }
 
-        for (size_t i = 0; i < this->matrix.rows; i++) {
-            for (size_t j = 0; j < this->matrix.cols; j++) {
-                fileOutput << int(this->matrix.isTrue(i, j));
-            }
+    ImGui::NewLine();
 
-            fileOutput << endl;
+    if (!savedFilenameContours.empty()) {
+        if (savedContours) {
+            ImGui::TextColored(
+                GREEN_TEXT_COLOR,
+                "Contours have been saved as \"%s\" in the \"output\" "
+                "folder!",
+                savedFilenameContours.c_str()
+            );
+        } else {
+            ImGui::TextColored(
+                RED_TEXT_COLOR,
+                "Contours save error (filename: \"%s\")!",
+                savedFilenameContours.c_str()
+            );
         }
-        fileOutput.close();
+    }
+
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 10);
+    ImGui::Combo("Contour Format", &this->data.contourFormat, "Binary\0JSON\0");
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 10);
+    ImGui::SliderFloat(
+        "Simplify",
+        &this->data.contourSimplify,
+        0.0f,
+        16.0f,
+        "%.2f cells"
+    );
 
-        savedMatrix = fileOutput.good();
+    if (ImGui::Button("Save Contours to File")) {
+        const auto format = (ContourFormat)this->data.contourFormat;
+        const auto contours = findContours(
+            this->matrix,
+            this->data.contourSimplify
+        );
+
+        savedFilenameContours
+            = this->buildOutputImageFilename() + contourExtension(format);
+        savedContours = exportContours(
+            contours,
+            this->matrix.rows,
+            this->matrix.cols,
+            this->path.output / savedFilenameContours,
+            format
+        );
     }
 
     ImGui::NewLine();
@@ -404,9 +673,19 @@ void IBMApplication::drawImageTools() {
         }
     }
 
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 10);
+    ImGui::Combo(
+        "Mask Format",
+        &this->data.maskFormat,
+        "PNG (1-bit)\0PBM\0TIFF (CCITT G4)\0"
+    );
+
     if (ImGui::Button("Save Mask to File")) {
-        savedFilename = this->buildOutputImageFilename();
-        saved = this->image->saveMask(path.output / savedFilename);
+        const auto format = (BitmapFormat)this->data.maskFormat;
+        savedFilename = fs::path(this->buildOutputImageFilename())
+                            .replace_extension(bitmapExtension(format))
+                            .string();
+        saved = writeBitmap(this->matrix, path.output / savedFilename, format);
     }
 
     ImGui::EndChild();
@@ -431,10 +710,67 @@ void IBMApplication::drawImagePreview() {
     );
 
     this->renderImage(texture, this->image->cv);
+    this->editRegion();
 
     ImGui::End();
 }
 
+// Dragging over the image preview sets the region to the dragged rectangle,
+// with Shift held the rectangle is added to it
+void IBMApplication::editRegion() {
+    static ImVec2 start;
+
+    const auto min = ImGui::GetItemRectMin();
+    const auto size = ImGui::GetItemRectSize();
+    const auto mouse = ImGui::GetMousePos();
+    auto *drawList = ImGui::GetWindowDrawList();
+
+    // Over the image, so that dragging does not move the window
+    ImGui::SetCursorScreenPos(min);
+    ImGui::InvisibleButton("##region", size);
+
+    for (auto &&rect : this->data.roi.rects) {
+        drawList->AddRect(
+            ImVec2(min.x + rect.x, min.y + rect.y),
+            ImVec2(min.x + rect.x + rect.width, min.y + rect.y + rect.height),
+            REGION_COLOR,
+            0,
+            0,
+            2
+        );
+    }
+
+    if (ImGui::IsItemActivated()) {
+        start = mouse;
+    }
+    if (ImGui::IsItemActive()) {
+        drawList->AddRect(start, mouse, REGION_COLOR);
+    }
+    if (!ImGui::IsItemDeactivated()) {
+        return;
+    }
+
+    const int left = (int)(std::min(start.x, mouse.x) - min.x),
+              top = (int)(std::min(start.y, mouse.y) - min.y),
+              right = (int)(std::max(start.x, mouse.x) - min.x),
+              bottom = (int)(std::max(start.y, mouse.y) - min.y);
+    const cv::Rect frame(0, 0, this->image->width(), this->image->height());
+    const auto rect = cv::Rect(left, top, right - left, bottom - top) & frame;
+
+    // A click without a drag selects nothing
+    if (rect.width < 2 || rect.height < 2) {
+        return;
+    }
+
+    if (!ImGui::GetIO().KeyShift) {
+        this->data.roi.clear();
+    }
+    this->data.roi.add(rect);
+
+    this->toRegenerate = this->isMaskProcessed;
+    this->toPreview = this->data.livePreview;
+}
+
 void IBMApplication::drawMaskPreview() {
     auto &texture = this->image->maskTexture;
     if (this->toReset || this->toRegenerate) {
@@ -443,7 +779,9 @@ void IBMApplication::drawMaskPreview() {
         return;
     }
 
-    if (!this->isMaskProcessed) {
+    const bool previewing
+        = this->data.livePreview && this->image->isPreviewing();
+    if (!this->isMaskProcessed && !previewing) {
         return;
     }
 
@@ -457,19 +795,36 @@ void IBMApplication::drawMaskPreview() {
         ImGuiWindowFlags_HorizontalScrollbar
     );
 
-    this->renderImage(texture, this->image->mask);
+    if (previewing) {
+        this->renderImage(
+            this->image->previewTexture,
+            this->image->previewMask,
+            ImVec2(this->image->width(), this->image->height())
+        );
+    } else {
+        this->renderImage(texture, this->image->mask);
+    }
 
     ImGui::End();
 }
 
 void IBMApplication::drawMatrixPreview() {
     static vector<string> matrixRows(0);
+    // Rows are kept between regenerations and rewritten in place
+    static bool rowsChanged = true;
 
     if (this->toReset || this->toRegenerate) {
-        matrixRows.clear();
+        if (this->toReset) {
+            matrixRows.clear();
+        }
+        rowsChanged = true;
 
         return;
     }
+    if (this->toRedrawMatrix) {
+        rowsChanged = true;
+        this->toRedrawMatrix = false;
+    }
 
     if (!this->isMaskProcessed) {
         return;
@@ -485,16 +840,30 @@ void IBMApplication::drawMatrixPreview() {
         ImGuiWindowFlags_HorizontalScrollbar
     );
 
-    if (matrixRows.empty()) {
-        for (size_t i = 0; i < this->matrix.rows; i++) {
-            string row = "";
+    if (rowsChanged) {
+        const auto &matrix = this->matrix;
+        const auto wordBits = BinaryMatrix::WordBits;
+
+        matrixRows.resize(matrix.rows);
+        for (auto &&row : matrixRows) {
+            row.assign(matrix.cols, '0');
+        }
+
+        // Only the occupied tiles have ones to write
+        this->occupancy.forEachTile(
+            [&](size_t top, size_t left, size_t bottom, size_t) {
+                for (size_t i = top; i < bottom; i++) {
+                    auto word = matrix.row(i)[left / wordBits];
 
-            for (size_t j = 0; j < this->matrix.cols; j++) {
-                row += this->matrix.isTrue(i, j) ? "1" : "0";
+                    while (word != 0) {
+                        matrixRows[i][left + lowestBit(word)] = '1';
+                        word &= word - 1;
+                    }
+                }
             }
+        );
 
-            matrixRows.push_back(row);
-        }
+        rowsChanged = false;
     }
 
     for (auto &&row : matrixRows) {
@@ -504,6 +873,87 @@ void IBMApplication::drawMatrixPreview() {
     ImGui::End();
 }
 
+void IBMApplication::drawImageFileList() {
+    if (ImGui::InputText(
+            "Search",
+            this->data.imageFilter,
+            IMAGE_FILTER_LENGTH
+        )) {
+        this->filterImageFileList();
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Thumbnails", &this->data.showThumbnails);
+
+    const bool thumbnails
+        = this->data.showThumbnails && this->thumbnails.isOpen();
+    const float rowHeight = thumbnails ? THUMBNAIL_SIZE : 0;
+    const ImVec2 thumbnailSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+
+    ImGui::BeginChild(
+        "##image_files",
+        ImVec2(0, IMAGE_LIST_HEIGHT),
+        ImGuiChildFlags_Border
+    );
+
+    if (thumbnails) {
+        this->thumbnails.nextFrame();
+    }
+    std::unordered_set<std::string> shown;
+
+    // Only the rows in view are laid out and asked for thumbnails
+    ImGuiListClipper clipper;
+    clipper.Begin((int)this->filteredImages.size());
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            const int index = this->filteredImages[row];
+            const auto name = this->path.images[index].string();
+
+            ImGui::PushID(index);
+
+            // Every row takes the full thumbnail size, so that they all have
+            // the height the clipper measured on the first one
+            if (thumbnails) {
+                const auto path = (this->path.input / name).string();
+                const auto thumbnail = this->thumbnails.request(path);
+                const auto corner = ImGui::GetCursorPos();
+
+                if (!thumbnail.empty()) {
+                    this->renderImage(this->thumbnailTextures[path], thumbnail);
+                    shown.insert(path);
+                }
+
+                ImGui::SetCursorPos(corner);
+                ImGui::Dummy(thumbnailSize);
+                ImGui::SameLine();
+            }
+
+            if (ImGui::Selectable(
+                    name.c_str(),
+                    index == this->data.selectedImageFile,
+                    ImGuiSelectableFlags_None,
+                    ImVec2(0, rowHeight)
+                )) {
+                this->data.selectedImageFile = index;
+            }
+
+            ImGui::PopID();
+        }
+    }
+
+    ImGui::EndChild();
+
+    // Textures of the rows out of view are released
+    for (auto it = this->thumbnailTextures.begin();
+         it != this->thumbnailTextures.end();) {
+        if (shown.count(it->first) == 0) {
+            it->second.reset();
+            it = this->thumbnailTextures.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 std::string IBMApplication::getSelectedImage() const {
     return this->path.images[this->data.selectedImageFile].string();
 }
@@ -522,12 +972,17 @@ std::string IBMApplication::buildImageTitle(const std::string &addition) const {
 }
 
 void IBMApplication::renderImage(Texture2D &texture, const cv::Mat &mat) {
+    this->renderImage(texture, mat, ImVec2(mat.cols, mat.rows));
+}
+
+void IBMApplication::renderImage(
+    Texture2D &texture,
+    const cv::Mat &mat,
+    const ImVec2 &size
+) {
     texture.render(mat);
 
-    ImGui::Image(
-        (void *)(*(intptr_t *)texture.glTexture),
-        ImVec2(mat.cols, mat.rows)
-    );
+    ImGui::Image((void *)(*(intptr_t *)texture.glTexture), size);
 }
 
 void IBMApplication::loadImageFileList() {
@@ -545,6 +1000,28 @@ void IBMApplication::loadImageFileList() {
             }
         }
     }
+
+    this->filterImageFileList();
+}
+
+void IBMApplication::filterImageFileList() {
+    const auto lower = [](std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](char c) {
+            return (char)std::tolower((unsigned char)c);
+        });
+
+        return text;
+    };
+    const auto filter = lower(this->data.imageFilter);
+
+    this->filteredImages.clear();
+    for (size_t i = 0; i < this->path.images.size(); i++) {
+        if (filter.empty()
+            || lower(this->path.images[i].string()).find(filter)
+                   != std::string::npos) {
+            this->filteredImages.push_back((int)i);
+        }
+    }
 }
 
 void IBMApplication::createDirectory(const std::filesystem::path &path) const {
@@ -555,9 +1032,17 @@ void IBMApplication::createDirectory(const std::filesystem::path &path) const {
 
 std::string IBMApplication::buildOutputImageFilename() const {
     const auto &img = this->image->cv;
+    const auto &mask = this->image->mask;
+    const auto &origin = this->image->maskOrigin;
 
-    return this->image->filename.stem().string()
-           + (string(".") + to_string(img.cols) + "x" + to_string(img.rows))
+    // Outputs of a region are named by its geometry, WxH+X+Y
+    auto geometry = to_string(img.cols) + "x" + to_string(img.rows);
+    if (!mask.empty() && (mask.cols != img.cols || mask.rows != img.rows)) {
+        geometry = to_string(mask.cols) + "x" + to_string(mask.rows) + "+"
+                   + to_string(origin.x) + "+" + to_string(origin.y);
+    }
+
+    return this->image->filename.stem().string() + "." + geometry
            + this->image->filename.extension().string();
 }
 
@@ -585,18 +1070,132 @@ Image *IBMApplication::getImageFromPool(const string &filename) const {
     return nullptr;
 }
 
-void IBMApplication::generateBinaryMatrix() {
-    const auto &mask = this->image->mask;
-    this->matrix.reset(mask.rows, mask.cols);
+void IBMApplication::processMask() {
+    const auto &roi = this->data.roi;
+    this->matrixKey = ContentHash();
+
+    if (this->data.extraRanges.empty()) {
+        const auto range = this->data.hsvToRange();
+
+        // Same file content and range as an earlier run, maybe of another
+        // file with the same bytes. Only whole images are cached.
+        if (this->image->contentHash.isValid() && roi.isEmpty()) {
+            const auto key = resultKey(this->image->contentHash, range);
+
+            if (this->cache.load(key, this->cachedMatrix)
+                && this->cachedMatrix.rows == (size_t)this->image->height()
+                && this->cachedMatrix.cols == (size_t)this->image->width()) {
+                this->image->processMaskByMatrix(this->cachedMatrix);
 
-    for (size_t i = 0; i < mask.rows; i++) {
-        for (size_t j = 0; j < mask.cols; j++) {
-            const auto &pixel = mask.at<cv::Vec4b>(i, j);
-            const auto value
-                = (bool(pixel[0]) && bool(pixel[1]) && bool(pixel[2]))
-                      ? BinaryMatrix::True
-                      : BinaryMatrix::False;
-            this->matrix.set(i, j, value);
+                return;
+            }
+
+            this->matrixKey = key;
         }
+
+        this->image->processMaskByColorRange(range, roi);
+
+        return;
+    }
+
+    this->image->processMaskByClassifier(this->data.hsvToClassifier(), roi);
+}
+
+// A range change shows the coarse mask in the same frame, the full mask is
+// refined a slice per frame once the range settles and then replaces it
+void IBMApplication::updatePreview() {
+    const auto now = std::chrono::steady_clock::now();
+
+    if (this->toPreview) {
+        this->image->previewMaskByColorRange(
+            this->data.hsvToRange(),
+            this->data.roi
+        );
+        this->previewChanged = now;
+        this->toPreview = false;
+
+        return;
+    }
+
+    const std::chrono::duration<double> idle = now - this->previewChanged;
+    if (!this->image->isPreviewing() || idle.count() < PREVIEW_SETTLE_SECONDS) {
+        return;
+    }
+
+    if (this->image->refinePreviewMask(PREVIEW_REFINE_SECONDS)) {
+        const bool cacheable = this->image->contentHash.isValid()
+                               && this->data.roi.isEmpty();
+        this->matrixKey = cacheable
+                              ? resultKey(
+                                  this->image->contentHash,
+                                  this->data.hsvToRange()
+                              )
+                              : ContentHash();
+
+        this->generateBinaryMatrix();
+        this->toRedrawMatrix = true;
+    }
+}
+
+void IBMApplication::generateBinaryMatrix() {
+    // Keep the last result to compare the new one against
+    std::swap(this->previousMatrix, this->matrix);
+
+    {
+        ProfileScope scope("pack", this->image->mask.total());
+        this->matrix.assignMask(this->image->mask);
+    }
+    if (this->matrixKey.isValid()) {
+        this->cache.store(this->matrixKey, this->matrix);
+    }
+
+    {
+        ProfileScope scope(
+            "cleanup",
+            this->matrix.data.size() * sizeof(BinaryMatrix::Word)
+        );
+        this->cleanupBinaryMatrix();
+    }
+
+    ProfileScope scope(
+        "statistics",
+        this->matrix.data.size() * sizeof(BinaryMatrix::Word)
+    );
+    this->statistics = RegionStatistics(this->matrix);
+    this->occupancy.attach(this->matrix);
+
+    const auto &previous = this->previousMatrix;
+    this->isComparable = previous.rows == this->matrix.rows
+                         && previous.cols == this->matrix.cols;
+    if (this->isComparable) {
+        const auto counts = countOverlap(previous, this->matrix);
+
+        this->previousIoU = intersectionOverUnion(counts);
+        this->changedCells = counts.differing;
+    }
+}
+
+void IBMApplication::cleanupBinaryMatrix() {
+    const auto size = (size_t)std::max(this->data.cleanupSize, 1);
+    const StructuringElement element(
+        (StructuringElement::Shape)this->data.cleanupShape,
+        size
+    );
+
+    switch (this->data.cleanupOperation) {
+    case CleanupOpening:
+        this->matrix = opening(this->matrix, element);
+        break;
+    case CleanupClosing:
+        this->matrix = closing(this->matrix, element);
+        break;
+    case CleanupErosion:
+        this->matrix = erode(this->matrix, element);
+        break;
+    case CleanupDilation:
+        this->matrix = dilate(this->matrix, element);
+        break;
+    default:
+        break;
     }
 }
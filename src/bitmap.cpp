@@ -0,0 +1,174 @@
+#include "bitmap.hpp"
+
+#include <png.h>
+#include <tiffio.h>
+
+using Word = BinaryMatrix::Word;
+
+// Bit order of a byte reversed, the formats store the leftmost pixel in
+// the most significant bit while the matrix keeps it in the least one
+static const std::vector<uint8_t> &reversedBytes() {
+    static const std::vector<uint8_t> table = []() {
+        std::vector<uint8_t> result(256);
+
+        for (int value = 0; value < 256; value++) {
+            uint8_t reversed = 0;
+            for (int bit = 0; bit < 8; bit++) {
+                reversed |= ((value >> bit) & 1) << (7 - bit);
+            }
+
+            result[value] = reversed;
+        }
+
+        return result;
+    }();
+
+    return table;
+}
+
+// One row as MSB-first bytes, the padding bits of the last byte are zero
+static void packRow(
+    const Word *words,
+    size_t cols,
+    uint8_t *bytes,
+    bool invert
+) {
+    const auto &reversed = reversedBytes();
+    const size_t count = (cols + 7) / 8;
+    const uint8_t flip = invert ? 0xFF : 0x00;
+
+    for (size_t k = 0; k < count; k++) {
+        const auto byte = uint8_t(words[k / 8] >> (8 * (k % 8)));
+        bytes[k] = reversed[byte] ^ flip;
+    }
+
+    if (cols % 8 != 0) {
+        bytes[count - 1] &= uint8_t(0xFF << (8 - cols % 8));
+    }
+}
+
+bool writePBM(const BinaryMatrix &matrix, const std::filesystem::path &path) {
+    std::ofstream output(path.string(), std::ios::binary);
+    output << "P4\n" << matrix.cols << " " << matrix.rows << "\n";
+
+    // PBM uses 1 for black
+    std::vector<uint8_t> bytes((matrix.cols + 7) / 8);
+    for (size_t i = 0; i < matrix.rows; i++) {
+        packRow(matrix.row(i), matrix.cols, bytes.data(), true);
+        output.write((const char *)bytes.data(), bytes.size());
+    }
+
+    output.close();
+
+    return output.good();
+}
+
+bool writePNG(const BinaryMatrix &matrix, const std::filesystem::path &path) {
+    if (matrix.isEmpty()) {
+        return false;
+    }
+
+    FILE *file = fopen(path.string().c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    auto png = png_create_write_struct(
+        PNG_LIBPNG_VER_STRING,
+        nullptr,
+        nullptr,
+        nullptr
+    );
+    auto info = png == nullptr ? nullptr : png_create_info_struct(png);
+    std::vector<uint8_t> bytes((matrix.cols + 7) / 8);
+    bool result = false;
+
+    if (info != nullptr && !setjmp(png_jmpbuf(png))) {
+        png_init_io(png, file);
+        png_set_IHDR(
+            png,
+            info,
+            (png_uint_32)matrix.cols,
+            (png_uint_32)matrix.rows,
+            1,
+            PNG_COLOR_TYPE_GRAY,
+            PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT,
+            PNG_FILTER_TYPE_DEFAULT
+        );
+        // Filters do not pay off on 1-bit data
+        png_set_filter(png, 0, PNG_FILTER_NONE);
+        png_write_info(png, info);
+
+        for (size_t i = 0; i < matrix.rows; i++) {
+            packRow(matrix.row(i), matrix.cols, bytes.data(), false);
+            png_write_row(png, bytes.data());
+        }
+
+        png_write_end(png, nullptr);
+        result = true;
+    }
+
+    png_destroy_write_struct(&png, &info);
+
+    return fclose(file) == 0 && result;
+}
+
+bool writeTIFF(const BinaryMatrix &matrix, const std::filesystem::path &path) {
+    if (matrix.isEmpty()) {
+        return false;
+    }
+
+    TIFF *tiff = TIFFOpen(path.string().c_str(), "w");
+    if (tiff == nullptr) {
+        return false;
+    }
+
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, (uint32_t)matrix.cols);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, (uint32_t)matrix.rows);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 1);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_CCITTFAX4);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tiff, TIFFTAG_FILLORDER, FILLORDER_MSB2LSB);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, (uint32_t)matrix.rows);
+
+    std::vector<uint8_t> bytes((matrix.cols + 7) / 8);
+    bool result = true;
+
+    for (size_t i = 0; i < matrix.rows && result; i++) {
+        packRow(matrix.row(i), matrix.cols, bytes.data(), false);
+        result = TIFFWriteScanline(tiff, bytes.data(), (uint32_t)i) == 1;
+    }
+
+    TIFFClose(tiff);
+
+    return result;
+}
+
+bool writeBitmap(
+    const BinaryMatrix &matrix,
+    const std::filesystem::path &path,
+    BitmapFormat format
+) {
+    switch (format) {
+    case BitmapPBM:
+        return writePBM(matrix, path);
+    case BitmapTIFF:
+        return writeTIFF(matrix, path);
+    default:
+        return writePNG(matrix, path);
+    }
+}
+
+std::string bitmapExtension(BitmapFormat format) {
+    switch (format) {
+    case BitmapPBM:
+        return ".pbm";
+    case BitmapTIFF:
+        return ".tiff";
+    default:
+        return ".png";
+    }
+}
@@ -0,0 +1,217 @@
+#include "buffer.hpp"
+#include "kernels.hpp"
+#include "pool.hpp"
+#include "scratch.hpp"
+
+PixelBuffer::PixelBuffer(
+    const uint8_t *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    PixelFormat format
+)
+    : data(data), width(width), height(height), stride(stride), format(format) {
+}
+
+size_t PixelBuffer::channels() const {
+    switch (this->format) {
+    case PixelGray:
+        return 1;
+    case PixelBGRA:
+    case PixelRGBA:
+        return 4;
+    default:
+        return 3;
+    }
+}
+
+bool PixelBuffer::isValid() const {
+    return this->data != nullptr && this->width > 0 && this->height > 0
+           && this->stride >= this->width * this->channels();
+}
+
+cv::Mat PixelBuffer::view(size_t begin, size_t end) const {
+    return cv::Mat(
+        (int)(end - begin),
+        (int)this->width,
+        CV_8UC((int)this->channels()),
+        (void *)(this->data + begin * this->stride),
+        this->stride
+    );
+}
+
+BitBuffer::BitBuffer(
+    BinaryMatrix::Word *words,
+    size_t rows,
+    size_t cols,
+    size_t stride
+)
+    : words(words),
+      rows(rows),
+      cols(cols),
+      stride(stride ? stride : BinaryMatrix::wordsFor(cols)) {
+}
+
+BitBuffer::BitBuffer(BinaryMatrix &matrix)
+    : BitBuffer(matrix.data.data(), matrix.rows, matrix.cols, matrix.stride) {
+}
+
+bool BitBuffer::isValid() const {
+    return this->words != nullptr
+           && this->stride >= BinaryMatrix::wordsFor(this->cols);
+}
+
+BinaryMatrix::Word *BitBuffer::row(size_t row) const {
+    return this->words + row * this->stride;
+}
+
+static void validateBuffers(const PixelBuffer &pixels, const BitBuffer &bits) {
+    if (!pixels.isValid() || !bits.isValid()) {
+        throw Exception("Invalid pixel or bit buffer!");
+    }
+    if (pixels.width != bits.cols || pixels.height != bits.rows) {
+        throw Exception("Pixel and bit buffer sizes do not match!");
+    }
+}
+
+// Rows [begin, end) converted to 3-channel HSV or BGR in the thread scratch,
+// or the caller rows themselves when they already are in that form
+static cv::Mat convertStripe(
+    const PixelBuffer &pixels,
+    size_t begin,
+    size_t end,
+    bool toHSV
+) {
+    auto &arena = ScratchArena::local();
+    const auto source = pixels.view(begin, end);
+    const int rows = source.rows, cols = source.cols;
+
+    if (pixels.format == PixelHSV) {
+        return source;
+    }
+    if (!toHSV && pixels.format == PixelBGR) {
+        return source;
+    }
+
+    auto target = arena.band(ScratchHSV, rows, cols, CV_8UC3);
+
+    switch (pixels.format) {
+    case PixelGray:
+        if (toHSV) {
+            auto color = arena.band(ScratchColor, rows, cols, CV_8UC3);
+            cv::cvtColor(source, color, cv::COLOR_GRAY2BGR);
+            cv::cvtColor(color, target, cv::COLOR_BGR2HSV);
+        } else {
+            cv::cvtColor(source, target, cv::COLOR_GRAY2BGR);
+        }
+        break;
+    case PixelBGR:
+    case PixelBGRA:
+        if (toHSV) {
+            cv::cvtColor(source, target, cv::COLOR_BGR2HSV);
+        } else {
+            cv::cvtColor(source, target, cv::COLOR_BGRA2BGR);
+        }
+        break;
+    default:
+        if (toHSV) {
+            cv::cvtColor(source, target, cv::COLOR_RGB2HSV);
+        } else {
+            cv::cvtColor(
+                source,
+                target,
+                pixels.format == PixelRGBA ? cv::COLOR_RGBA2BGR
+                                           : cv::COLOR_RGB2BGR
+            );
+        }
+        break;
+    }
+
+    return target;
+}
+
+void thresholdPixels(
+    const PixelBuffer &pixels,
+    const ColorRange &range,
+    BitBuffer &bits
+) {
+    validateBuffers(pixels, bits);
+
+    const auto packMask = kernels().packMask;
+    forEachStripe(
+        pixels.height,
+        pixels.stride,
+        [&](size_t begin, size_t end) {
+            const auto hsv = convertStripe(pixels, begin, end, true);
+            auto mask = ScratchArena::local().band(
+                ScratchMask,
+                hsv.rows,
+                hsv.cols,
+                CV_8UC1
+            );
+
+            range.threshold(hsv, mask);
+
+            for (size_t i = begin; i < end; i++) {
+                const auto *row = mask.ptr<uchar>((int)(i - begin));
+                packMask(row, bits.cols, bits.row(i));
+            }
+        }
+    );
+}
+
+void classifyPixels(
+    const PixelBuffer &pixels,
+    const ColorClassifier &classifier,
+    BitBuffer &bits
+) {
+    validateBuffers(pixels, bits);
+
+    if (pixels.format == PixelHSV) {
+        throw Exception("Color classifier does not take HSV pixels!");
+    }
+    if (!classifier.isCompiled()) {
+        throw Exception("Color classifier has not been compiled yet!");
+    }
+
+    forEachStripe(
+        pixels.height,
+        pixels.stride,
+        [&](size_t begin, size_t end) {
+            // BGRA is read in place, the alpha byte is skipped
+            const auto bgr = pixels.format == PixelBGRA
+                                 ? pixels.view(begin, end)
+                                 : convertStripe(pixels, begin, end, false);
+
+            for (size_t i = begin; i < end; i++) {
+                classifier.classifyRow(
+                    bgr.ptr<uchar>((int)(i - begin)),
+                    bits.cols,
+                    bgr.channels(),
+                    bits.row(i)
+                );
+            }
+        }
+    );
+}
+
+void packPixels(const PixelBuffer &pixels, BitBuffer &bits) {
+    validateBuffers(pixels, bits);
+
+    const auto channels = pixels.channels();
+
+    forEachStripe(
+        pixels.height,
+        pixels.stride,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                BinaryMatrix::packRow(
+                    pixels.data + i * pixels.stride,
+                    bits.cols,
+                    channels,
+                    bits.row(i)
+                );
+            }
+        }
+    );
+}
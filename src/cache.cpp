@@ -0,0 +1,447 @@
+#include "cache.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#define CACHE_MAGIC "IBMC"
+#define CACHE_EXTENSION ".ibmc"
+// Files are hashed in chunks of this size
+#define HASH_CHUNK_BYTES (1024 * 1024)
+// Eviction goes below the capacity, so that it does not run on every store
+#define EVICT_LOW_WATER(capacity) ((capacity) / 10 * 9)
+
+namespace fs = std::filesystem;
+
+static inline uint64_t rotateLeft(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t finalMix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+// MurmurHash3_x64_128 over data given in pieces
+struct MurmurHasher
+{
+    static constexpr uint64_t C1 = 0x87c37b91114253d5ULL;
+    static constexpr uint64_t C2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h1, h2, length;
+    uint8_t pending[16];
+    size_t pendingSize;
+
+    MurmurHasher(): h1(0), h2(0), length(0), pendingSize(0) {
+    }
+
+    void block(const uint8_t *data) {
+        uint64_t k1, k2;
+        memcpy(&k1, data, 8);
+        memcpy(&k2, data + 8, 8);
+
+        k1 *= C1;
+        k1 = rotateLeft(k1, 31);
+        k1 *= C2;
+        this->h1 ^= k1;
+        this->h1 = rotateLeft(this->h1, 27) + this->h2;
+        this->h1 = this->h1 * 5 + 0x52dce729;
+
+        k2 *= C2;
+        k2 = rotateLeft(k2, 33);
+        k2 *= C1;
+        this->h2 ^= k2;
+        this->h2 = rotateLeft(this->h2, 31) + this->h1;
+        this->h2 = this->h2 * 5 + 0x38495ab5;
+    }
+
+    void update(const void *data, size_t size) {
+        const auto *bytes = (const uint8_t *)data;
+        this->length += size;
+
+        if (this->pendingSize > 0) {
+            const auto count = std::min(size, 16 - this->pendingSize);
+            memcpy(this->pending + this->pendingSize, bytes, count);
+            this->pendingSize += count;
+            bytes += count;
+            size -= count;
+
+            if (this->pendingSize < 16) {
+                return;
+            }
+
+            this->block(this->pending);
+            this->pendingSize = 0;
+        }
+
+        for (; size >= 16; bytes += 16, size -= 16) {
+            this->block(bytes);
+        }
+
+        memcpy(this->pending, bytes, size);
+        this->pendingSize = size;
+    }
+
+    ContentHash finish() {
+        uint8_t tail[16] = {};
+        memcpy(tail, this->pending, this->pendingSize);
+
+        uint64_t k1, k2;
+        memcpy(&k1, tail, 8);
+        memcpy(&k2, tail + 8, 8);
+
+        if (this->pendingSize > 8) {
+            k2 *= C2;
+            k2 = rotateLeft(k2, 33);
+            k2 *= C1;
+            this->h2 ^= k2;
+        }
+        if (this->pendingSize > 0) {
+            k1 *= C1;
+            k1 = rotateLeft(k1, 31);
+            k1 *= C2;
+            this->h1 ^= k1;
+        }
+
+        auto a = this->h1 ^ this->length, b = this->h2 ^ this->length;
+        a += b;
+        b += a;
+        a = finalMix(a);
+        b = finalMix(b);
+        a += b;
+        b += a;
+
+        return ContentHash(a, b);
+    }
+};
+
+ContentHash::ContentHash(): high(0), low(0) {
+}
+
+ContentHash::ContentHash(uint64_t high, uint64_t low): high(high), low(low) {
+}
+
+bool ContentHash::isValid() const {
+    return this->high != 0 || this->low != 0;
+}
+
+bool ContentHash::operator==(const ContentHash &other) const {
+    return this->high == other.high && this->low == other.low;
+}
+
+bool ContentHash::operator!=(const ContentHash &other) const {
+    return !(*this == other);
+}
+
+std::string ContentHash::hex() const {
+    char text[33];
+    snprintf(
+        text,
+        sizeof(text),
+        "%016llx%016llx",
+        (unsigned long long)this->high,
+        (unsigned long long)this->low
+    );
+
+    return text;
+}
+
+ContentHash ContentHash::of(const void *data, size_t size) {
+    MurmurHasher hasher;
+    hasher.update(data, size);
+
+    return hasher.finish();
+}
+
+ContentHash ContentHash::ofFile(const fs::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return ContentHash();
+    }
+
+    MurmurHasher hasher;
+    std::vector<char> chunk(HASH_CHUNK_BYTES);
+
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        hasher.update(chunk.data(), (size_t)file.gcount());
+    }
+
+    if (file.bad()) {
+        return ContentHash();
+    }
+
+    return hasher.finish();
+}
+
+ContentHash resultKey(const ContentHash &content, const ColorRange &range) {
+    const uint32_t version = RESULT_CACHE_VERSION;
+    MurmurHasher hasher;
+
+    hasher.update(&version, sizeof(version));
+    hasher.update(&content.high, sizeof(content.high));
+    hasher.update(&content.low, sizeof(content.low));
+
+    for (int i = 0; i < 3; i++) {
+        const double from = range.from[i], to = range.to[i];
+
+        hasher.update(&from, sizeof(from));
+        hasher.update(&to, sizeof(to));
+    }
+
+    return hasher.finish();
+}
+
+bool writeFileAtomically(
+    const fs::path &path,
+    const std::function<void(std::ostream &)> &write
+) {
+    std::error_code error;
+    fs::create_directories(path.parent_path(), error);
+
+    // Unique among the threads and processes sharing the directory
+    static std::atomic<uint64_t> counter(0);
+    const auto unique = std::hash<std::thread::id>()(std::this_thread::get_id())
+                        ^ (uint64_t)std::chrono::steady_clock::now()
+                              .time_since_epoch()
+                              .count()
+                        ^ (counter++ << 48);
+    auto temporary = path;
+    temporary += "." + ContentHash::of(&unique, sizeof(unique)).hex() + ".tmp";
+
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        write(file);
+
+        if (!file) {
+            file.close();
+            fs::remove(temporary, error);
+
+            return false;
+        }
+    }
+
+    fs::rename(temporary, path, error);
+    if (error) {
+        fs::remove(temporary, error);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool writeFileAtomically(const fs::path &path, const void *data, size_t size) {
+    return writeFileAtomically(path, [&](std::ostream &file) {
+        file.write((const char *)data, size);
+    });
+}
+
+uint64_t evictOldest(
+    const fs::path &directory,
+    const std::string &extension,
+    uint64_t target
+) {
+    struct Entry
+    {
+        fs::file_time_type time;
+        uint64_t size;
+        fs::path path;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code error;
+
+    for (fs::recursive_directory_iterator it(directory, error), end;
+         !error && it != end;
+         it.increment(error)) {
+        if (!it->is_regular_file(error)
+            || it->path().extension() != extension) {
+            continue;
+        }
+
+        Entry entry{
+            it->last_write_time(error),
+            (uint64_t)it->file_size(error),
+            it->path()
+        };
+        if (!error) {
+            total += entry.size;
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    if (total > target) {
+        std::sort(
+            entries.begin(),
+            entries.end(),
+            [](const Entry &a, const Entry &b) { return a.time < b.time; }
+        );
+
+        for (auto &&entry : entries) {
+            if (total <= target) {
+                break;
+            }
+
+            // Another process may have removed it already
+            if (fs::remove(entry.path, error) || !error) {
+                total -= entry.size;
+            }
+        }
+    }
+
+    return total;
+}
+
+ResultCache::ResultCache()
+    : capacity(0), bytes(0), hitCount(0), missCount(0) {
+}
+
+ResultCache::ResultCache(const fs::path &directory, uint64_t capacity)
+    : ResultCache() {
+    this->open(directory, capacity);
+}
+
+bool ResultCache::open(const fs::path &directory, uint64_t capacity) {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (!fs::is_directory(directory, error)) {
+        this->directory.clear();
+
+        return false;
+    }
+
+    this->directory = directory;
+    this->capacity = capacity;
+    this->evict(capacity);
+
+    return true;
+}
+
+bool ResultCache::isOpen() const {
+    return !this->directory.empty();
+}
+
+bool ResultCache::load(const ContentHash &key, BinaryMatrix &matrix) {
+    if (!this->isOpen()) {
+        return false;
+    }
+
+    const auto path = this->entryPath(key);
+    std::ifstream file(path, std::ios::binary);
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t size[2] = {0, 0};
+
+    file.read(magic, sizeof(magic));
+    file.read((char *)&version, sizeof(version));
+    file.read((char *)size, sizeof(size));
+
+    // Also a miss when the entry is damaged or of another version
+    if (!file || memcmp(magic, CACHE_MAGIC, 4) != 0
+        || version != RESULT_CACHE_VERSION || size[0] == 0 || size[1] == 0
+        || size[0] > INT32_MAX || size[1] > INT32_MAX) {
+        this->missCount++;
+
+        return false;
+    }
+
+    // The sizes are only trusted when the length of the file agrees, so a
+    // damaged entry cannot ask for a huge matrix
+    std::error_code error;
+    const uint64_t expected
+        = sizeof(magic) + sizeof(version) + sizeof(size)
+          + size[0] * BinaryMatrix::wordsFor((size_t)size[1])
+                * sizeof(BinaryMatrix::Word);
+    if (fs::file_size(path, error) != expected || error) {
+        this->missCount++;
+
+        return false;
+    }
+
+    matrix.reset((size_t)size[0], (size_t)size[1]);
+    file.read(
+        (char *)matrix.data.data(),
+        matrix.data.size() * sizeof(BinaryMatrix::Word)
+    );
+
+    if (!file || file.peek() != std::ifstream::traits_type::eof()) {
+        matrix.reset();
+        this->missCount++;
+
+        return false;
+    }
+
+    // Padding bits must stay zero whatever the file holds
+    const auto lastMask = matrix.lastWordMask();
+    for (size_t i = 0; i < matrix.rows; i++) {
+        matrix.row(i)[matrix.stride - 1] &= lastMask;
+    }
+
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    this->hitCount++;
+
+    return true;
+}
+
+bool ResultCache::store(const ContentHash &key, const BinaryMatrix &matrix) {
+    if (!this->isOpen() || matrix.isEmpty()) {
+        return false;
+    }
+
+    const uint32_t version = RESULT_CACHE_VERSION;
+    const uint64_t size[2] = {matrix.rows, matrix.cols};
+    const auto dataBytes = matrix.data.size() * sizeof(BinaryMatrix::Word);
+
+    const bool written = writeFileAtomically(
+        this->entryPath(key),
+        [&](std::ostream &file) {
+            file.write(CACHE_MAGIC, 4);
+            file.write((const char *)&version, sizeof(version));
+            file.write((const char *)size, sizeof(size));
+            file.write((const char *)matrix.data.data(), dataBytes);
+        }
+    );
+    if (!written) {
+        return false;
+    }
+
+    const auto total = this->bytes += 4 + sizeof(version) + sizeof(size)
+                                       + dataBytes;
+    if (total > this->capacity) {
+        this->evict(EVICT_LOW_WATER(this->capacity));
+    }
+
+    return true;
+}
+
+void ResultCache::evict(uint64_t target) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->bytes = evictOldest(this->directory, CACHE_EXTENSION, target);
+}
+
+uint64_t ResultCache::size() const {
+    return this->bytes;
+}
+
+size_t ResultCache::hits() const {
+    return this->hitCount;
+}
+
+size_t ResultCache::misses() const {
+    return this->missCount;
+}
+
+// Spread over 256 subdirectories by the first two hex digits
+fs::path ResultCache::entryPath(const ContentHash &key) const {
+    const auto name = key.hex();
+
+    return this->directory / name.substr(0, 2) / (name + CACHE_EXTENSION);
+}
@@ -0,0 +1,182 @@
+#include "classifier.hpp"
+#include "pool.hpp"
+
+ColorClassifier::ColorClassifier(int bits)
+    : channelBits(std::min(std::max(bits, MinBits), MaxBits)),
+      compiled(false) {
+}
+
+void ColorClassifier::include(const ColorRange &range) {
+    this->rules.push_back({range, false});
+    this->compiled = false;
+}
+
+void ColorClassifier::exclude(const ColorRange &range) {
+    this->rules.push_back({range, true});
+    this->compiled = false;
+}
+
+void ColorClassifier::clear() {
+    this->rules.clear();
+    this->table.clear();
+    this->compiled = false;
+}
+
+void ColorClassifier::compile() {
+    const int bits = this->channelBits;
+    const int shift = MaxBits - bits;
+    const size_t levels = size_t(1) << bits;
+    const size_t plane = levels * levels;
+
+    this->table.assign(
+        (this->tableSize() + BinaryMatrix::WordBits - 1)
+            / BinaryMatrix::WordBits,
+        Word(0)
+    );
+
+    // Every cell is classified by its center color
+    const auto center = [shift](size_t level) -> uchar {
+        return (uchar)((level << shift) | ((1 << shift) >> 1));
+    };
+
+    // One blue plane at a time keeps the conversion buffers small
+    cv::Mat bgr(1, (int)plane, CV_8UC3), hsv;
+    for (size_t b = 0; b < levels; b++) {
+        auto *pixels = bgr.ptr<cv::Vec3b>();
+
+        for (size_t g = 0; g < levels; g++) {
+            for (size_t r = 0; r < levels; r++) {
+                auto &pixel = pixels[g * levels + r];
+                pixel[0] = center(b);
+                pixel[1] = center(g);
+                pixel[2] = center(r);
+            }
+        }
+
+        cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+
+        const auto *colors = hsv.ptr<cv::Vec3b>();
+        for (size_t i = 0; i < plane; i++) {
+            bool included = false, excluded = false;
+
+            for (auto &&rule : this->rules) {
+                if (rule.range.contains(colors[i])) {
+                    (rule.exclude ? excluded : included) = true;
+                }
+            }
+
+            if (included && !excluded) {
+                const size_t cell = b * plane + i;
+                this->table[cell / BinaryMatrix::WordBits]
+                    |= Word(1) << (cell % BinaryMatrix::WordBits);
+            }
+        }
+    }
+
+    this->compiled = true;
+}
+
+bool ColorClassifier::isCompiled() const {
+    return this->compiled;
+}
+
+int ColorClassifier::bits() const {
+    return this->channelBits;
+}
+
+size_t ColorClassifier::tableSize() const {
+    return size_t(1) << (3 * this->channelBits);
+}
+
+bool ColorClassifier::classify(uchar blue, uchar green, uchar red) const {
+    return this->lookup(this->index(blue, green, red));
+}
+
+void ColorClassifier::classify(const cv::Mat &image, cv::Mat &mask) const {
+    if (!this->compiled) {
+        throw Exception("Color classifier has not been compiled yet!");
+    }
+
+    const int channels = image.channels();
+    mask.create(image.rows, image.cols, CV_8UC1);
+
+    forEachStripe(
+        image.rows,
+        image.cols * image.elemSize(),
+        [&](size_t begin, size_t end) {
+            for (int i = (int)begin; i < (int)end; i++) {
+                const auto *pixel = image.ptr<uchar>(i);
+                auto *output = mask.ptr<uchar>(i);
+
+                for (int j = 0; j < image.cols; j++, pixel += channels) {
+                    const auto cell
+                        = this->index(pixel[0], pixel[1], pixel[2]);
+                    output[j] = this->lookup(cell) ? 255 : 0;
+                }
+            }
+        }
+    );
+}
+
+void ColorClassifier::classify(
+    const cv::Mat &image,
+    BinaryMatrix &matrix
+) const {
+    if (!this->compiled) {
+        throw Exception("Color classifier has not been compiled yet!");
+    }
+
+    const int channels = image.channels();
+    matrix.reset(image.rows, image.cols);
+
+    forEachStripe(
+        image.rows,
+        image.cols * image.elemSize(),
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                this->classifyRow(
+                    image.ptr<uchar>((int)i),
+                    matrix.cols,
+                    channels,
+                    matrix.row(i)
+                );
+            }
+        }
+    );
+}
+
+void ColorClassifier::classifyRow(
+    const uchar *pixels,
+    size_t count,
+    int channels,
+    BinaryMatrix::Word *words
+) const {
+    if (!this->compiled) {
+        throw Exception("Color classifier has not been compiled yet!");
+    }
+
+    for (size_t offset = 0; offset < count; offset += BinaryMatrix::WordBits) {
+        const auto bits = std::min(BinaryMatrix::WordBits, count - offset);
+        Word word = 0;
+
+        for (size_t bit = 0; bit < bits; bit++, pixels += channels) {
+            const auto cell = this->index(pixels[0], pixels[1], pixels[2]);
+            word |= Word(this->lookup(cell)) << bit;
+        }
+
+        *words++ = word;
+    }
+}
+
+size_t ColorClassifier::index(uchar blue, uchar green, uchar red) const {
+    const int bits = this->channelBits, shift = MaxBits - bits;
+
+    return (size_t(blue >> shift) << (2 * bits))
+           | (size_t(green >> shift) << bits) | size_t(red >> shift);
+}
+
+bool ColorClassifier::lookup(size_t index) const {
+    const auto word = this->table[index / BinaryMatrix::WordBits];
+
+    return (word >> (index % BinaryMatrix::WordBits)) & 1;
+}
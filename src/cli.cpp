@@ -0,0 +1,413 @@
+#include "cli.hpp"
+#include "daemon.hpp"
+#include "sweep.hpp"
+#include "video.hpp"
+#include "pool.hpp"
+#include "profiler.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Parse "h,s,v" in OpenCV units (hue 0-180, saturation and value 0-255)
+static cv::Scalar parseHSV(const string &value) {
+    cv::Scalar result;
+    stringstream stream(value);
+    string item;
+
+    for (int i = 0; i < 3; i++) {
+        if (!getline(stream, item, ',')) {
+            throw Exception("Invalid HSV value \"" + value + "\"!");
+        }
+
+        try {
+            result[i] = stod(item);
+        } catch (const std::exception &) {
+            throw Exception("Invalid HSV value \"" + value + "\"!");
+        }
+    }
+
+    return result;
+}
+
+CliOptions::CliOptions()
+    : from(37, 42, 0),
+      to(84, 255, 255),
+      packed(false),
+      simplify(0),
+      cacheSize(1024),
+      threads(0),
+      stats(false),
+      stop(false),
+      profile(false),
+      help(false) {
+}
+
+ColorRange CliOptions::colorRange() const {
+    return ColorRange(this->from, this->to);
+}
+
+CliOptions CliOptions::parse(int argc, char const *argv[]) {
+    CliOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        const string arg = argv[i];
+        const auto next = [&]() -> string {
+            if (i + 1 >= argc) {
+                throw Exception("Missing value for \"" + arg + "\"!");
+            }
+
+            return argv[++i];
+        };
+
+        if (arg == "--help" || arg == "-h") {
+            options.help = true;
+        } else if (arg == "--video") {
+            options.video = next();
+        } else if (arg == "--sequence") {
+            options.sequence = next();
+        } else if (arg == "--output") {
+            options.output = next();
+        } else if (arg == "--from") {
+            options.from = parseHSV(next());
+        } else if (arg == "--to") {
+            options.to = parseHSV(next());
+        } else if (arg == "--packed") {
+            options.packed = true;
+        } else if (arg == "--contours") {
+            options.contours = next();
+            if (options.contours != "json" && options.contours != "binary") {
+                throw Exception(
+                    "Invalid contour format \"" + options.contours + "\"!"
+                );
+            }
+        } else if (arg == "--simplify") {
+            const auto value = next();
+
+            try {
+                options.simplify = stod(value);
+            } catch (const std::exception &) {
+                throw Exception("Invalid tolerance \"" + value + "\"!");
+            }
+        } else if (arg == "--cache") {
+            options.cache = next();
+        } else if (arg == "--cache-size") {
+            const auto value = next();
+
+            try {
+                options.cacheSize = stoul(value);
+            } catch (const std::exception &) {
+                throw Exception("Invalid cache size \"" + value + "\"!");
+            }
+        } else if (arg == "--sweep") {
+            options.sweep = next();
+        } else if (arg == "--image") {
+            options.image = next();
+        } else if (arg == "--serve") {
+            options.serve = next();
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--stop") {
+            options.stop = true;
+        } else if (arg == "--profile") {
+            options.profile = true;
+        } else if (arg == "--threads") {
+            const auto value = next();
+
+            try {
+                options.threads = stoul(value);
+            } catch (const std::exception &) {
+                throw Exception("Invalid thread count \"" + value + "\"!");
+            }
+        } else {
+            throw Exception("Unknown option \"" + arg + "\"!");
+        }
+    }
+
+    if (options.help) {
+        return options;
+    }
+
+    if ((options.stats || options.stop) && options.serve.empty()) {
+        throw Exception("--stats and --stop need the --serve socket!");
+    }
+    if (!options.serve.empty()) {
+        if (!options.video.empty() || !options.sequence.empty()) {
+            throw Exception("--serve does not take an input!");
+        }
+
+        return options;
+    }
+
+    if (!options.sweep.empty()) {
+        if (options.image.empty()) {
+            throw Exception("--sweep needs an --image!");
+        }
+
+        return options;
+    }
+
+    if (options.video.empty() == options.sequence.empty()) {
+        throw Exception("Exactly one of --video and --sequence is required!");
+    }
+    if (options.output.empty()) {
+        throw Exception("Output path is required!");
+    }
+    if (options.packed && !options.contours.empty()) {
+        throw Exception("Only one of --packed and --contours can be given!");
+    }
+
+    return options;
+}
+
+void CliOptions::printUsage(const char *executable) {
+    cout << "Usage: " << executable
+         << " (--video <file> | --sequence <glob pattern>)"
+            " --output <path> [options]\n"
+            "       "
+         << executable
+         << " --serve <socket> [--stats | --stop] [--threads n]\n"
+            "       "
+         << executable
+         << " --sweep <ranges file> --image <file> [--output <path>]\n"
+            "\n"
+            "Options:\n"
+            "  --from h,s,v    lower HSV bound (hue 0-180, others 0-255)\n"
+            "  --to h,s,v      upper HSV bound, hue below --from wraps\n"
+            "  --packed        write one packed stream file to --output\n"
+            "                  instead of a text matrix per frame into it\n"
+            "  --contours fmt  write component outlines per frame instead of\n"
+            "                  cells, fmt is json or binary\n"
+            "  --simplify px   Douglas-Peucker tolerance of the outlines\n"
+            "  --cache dir     reuse the matrices of inputs seen before, by\n"
+            "                  file content and range (--sequence only)\n"
+            "  --cache-size mb size limit of the cache, 1024 by default\n"
+            "  --threads n     processing threads, one per core by default\n"
+            "  --profile       print time, IPC, bytes per cycle, last level\n"
+            "                  cache and branch misses of every stage, from\n"
+            "                  perf events where the system allows them\n"
+            "  --serve socket  run as a daemon taking jobs on a Unix socket,\n"
+            "                  pixels and bits are passed in shared memory\n"
+            "  --stats         print the statistics of the daemon at --serve\n"
+            "  --stop          shut down the daemon at --serve\n"
+            "  --sweep file    count the matches of every range of the file,\n"
+            "                  one \"h,s,v h,s,v\" pair per line, in one\n"
+            "                  pass over --image; with --output the masks\n"
+            "                  are written as a packed stream, one per range\n"
+            "  --help          show this message\n"
+            "\n"
+            "Environment:\n"
+            "  IBM_CPU_LEVEL   scalar, sse4.2, avx2 or avx512 to limit the\n"
+            "                  instruction set used by the pixel kernels\n"
+            "\n"
+            "Without options the GUI is started."
+         << endl;
+}
+
+bool isCliMode(int argc, char const *[]) {
+    return argc > 1;
+}
+
+static int runFramePipeline(const CliOptions &options) {
+    unique_ptr<IFrameSource> source;
+    if (!options.video.empty()) {
+        source.reset(new VideoFrameSource(options.video));
+    } else {
+        source.reset(new SequenceFrameSource(options.sequence));
+    }
+
+    const auto stem = fs::path(
+        options.video.empty() ? "frame" : options.video
+    ).stem().string();
+
+    unique_ptr<IFrameSink> sink;
+    if (options.packed) {
+        sink.reset(new PackedStreamSink(options.output));
+    } else if (!options.contours.empty()) {
+        const auto format
+            = options.contours == "json" ? ContourJSON : ContourBinary;
+        sink.reset(
+            new ContourFileSink(options.output, stem, format, options.simplify)
+        );
+    } else {
+        sink.reset(new MatrixFileSink(options.output, stem));
+    }
+
+    ResultCache cache;
+    if (!options.cache.empty()
+        && !cache.open(options.cache, options.cacheSize * 1024 * 1024)) {
+        throw Exception("Cache directory cannot be created!");
+    }
+
+    FramePipeline pipeline(
+        *source,
+        *sink,
+        options.colorRange(),
+        cache.isOpen() ? &cache : nullptr
+    );
+    const auto report = pipeline.run();
+
+    cout << "Processed " << report.frames << " frames in " << report.seconds
+         << " s (" << report.fps() << " FPS)";
+    if (cache.isOpen()) {
+        cout << ", " << report.cached << " from cache";
+    }
+    cout << endl;
+
+    if (options.profile) {
+        Profiler::shared().print(cout);
+    }
+
+    return 0;
+}
+
+// One "h,s,v h,s,v" pair per line, blank lines and lines starting with #
+// are skipped
+static vector<ColorRange> readRanges(const fs::path &path) {
+    ifstream file(path);
+    if (!file) {
+        throw Exception("Range file \"" + path.string() + "\" not found!");
+    }
+
+    vector<ColorRange> ranges;
+    string line;
+    while (getline(file, line)) {
+        stringstream stream(line);
+        string from, to;
+
+        if (!(stream >> from) || from[0] == '#') {
+            continue;
+        }
+        if (!(stream >> to)) {
+            throw Exception("Invalid range line \"" + line + "\"!");
+        }
+
+        ranges.push_back(ColorRange(parseHSV(from), parseHSV(to)));
+    }
+
+    return ranges;
+}
+
+static int runSweep(const CliOptions &options) {
+    const auto ranges = readRanges(options.sweep);
+    const auto image = cv::imread(options.image, cv::IMREAD_COLOR);
+    if (image.empty()) {
+        throw Exception("Image \"" + options.image + "\" cannot be read!");
+    }
+
+    const auto start = chrono::steady_clock::now();
+    const auto sweep = sweepColorRanges(image, ranges, !options.output.empty());
+    const chrono::duration<double> seconds = chrono::steady_clock::now()
+                                             - start;
+
+    for (size_t r = 0; r < ranges.size(); r++) {
+        const auto &from = ranges[r].from, &to = ranges[r].to;
+
+        cout << r << "\t" << from[0] << "," << from[1] << "," << from[2]
+             << "\t" << to[0] << "," << to[1] << "," << to[2] << "\t"
+             << sweep.counts[r] << "\t" << sweep.coverage(r) * 100 << "%\n";
+    }
+    cout << ranges.size() << " ranges in " << seconds.count() << " s" << endl;
+
+    if (options.profile) {
+        Profiler::shared().print(cout);
+    }
+
+    if (sweep.hasMasks()) {
+        PackedStreamSink sink(options.output);
+        if (!sink.open()) {
+            throw Exception("Output file cannot be created!");
+        }
+
+        for (size_t r = 0; r < sweep.masks.size(); r++) {
+            sink.write(r, sweep.masks[r]);
+        }
+        if (!sink.close()) {
+            throw Exception("Output file cannot be written!");
+        }
+    }
+
+    return 0;
+}
+
+static DaemonServer *runningDaemon = nullptr;
+
+static void stopDaemon(int) {
+    if (runningDaemon) {
+        runningDaemon->stop();
+    }
+}
+
+static int runDaemon(const CliOptions &options) {
+    if (options.stats) {
+        const auto stats = DaemonClient(options.serve).statistics();
+
+        cout << "Batches: " << stats.batches << "\n"
+             << "Jobs: " << stats.jobs << " (" << stats.failures
+             << " failed)\n"
+             << "Queue depth: " << stats.queueDepth << " (max "
+             << stats.maxQueueDepth << ")\n"
+             << "Latency, us: p50 " << stats.p50 << ", p90 " << stats.p90
+             << ", p99 " << stats.p99 << ", max " << stats.maxLatency
+             << endl;
+
+        return 0;
+    }
+
+    if (options.stop) {
+        DaemonClient(options.serve).shutdown();
+
+        return 0;
+    }
+
+    DaemonServer server(options.serve);
+
+    runningDaemon = &server;
+    signal(SIGINT, stopDaemon);
+    signal(SIGTERM, stopDaemon);
+
+    cout << "Serving on " << options.serve << endl;
+    server.run();
+
+    runningDaemon = nullptr;
+
+    return 0;
+}
+
+int cliStart(int argc, char const *argv[]) {
+    try {
+        const auto options = CliOptions::parse(argc, argv);
+        if (options.help) {
+            CliOptions::printUsage(argv[0]);
+
+            return 0;
+        }
+
+        if (options.threads > 0) {
+            ThreadPool::shared().resize(options.threads);
+        }
+        if (options.profile) {
+            Profiler::shared().enable();
+        }
+
+        if (!options.serve.empty()) {
+            return runDaemon(options);
+        }
+        if (!options.sweep.empty()) {
+            return runSweep(options);
+        }
+
+        return runFramePipeline(options);
+    } catch (const Exception &e) {
+        cerr << e.message << endl;
+        CliOptions::printUsage(argv[0]);
+    } catch (const cv::Exception &e) {
+        cerr << e.what() << endl;
+    }
+
+    return 1;
+}
@@ -0,0 +1,555 @@
+#include "contour.hpp"
+#include "pool.hpp"
+
+#include <cmath>
+
+using Word = BinaryMatrix::Word;
+
+#define CONTOUR_MAGIC "IBMP"
+#define CONTOUR_VERSION 1
+
+// Directions of the walk, clockwise: east, south, west, north
+static const int stepX[4] = {1, 0, -1, 0};
+static const int stepY[4] = {0, 1, 0, -1};
+
+// Horizontal run of true cells, columns [begin, end)
+struct Run
+{
+    size_t begin, end;
+};
+
+size_t Contour::points() const {
+    auto count = this->outer.size();
+    for (auto &&hole : this->holes) {
+        count += hole.size();
+    }
+
+    return count;
+}
+
+static inline bool cellAt(const BinaryMatrix &matrix, long row, long col) {
+    if (row < 0 || col < 0 || row >= (long)matrix.rows
+        || col >= (long)matrix.cols) {
+        return false;
+    }
+
+    return (matrix.row(row)[col / BinaryMatrix::WordBits]
+            >> (col % BinaryMatrix::WordBits))
+           & 1;
+}
+
+// Whether the cell edge leaving corner (x, y) in `direction` is a boundary
+// with the true cell on its right
+static bool isBoundary(
+    const BinaryMatrix &matrix,
+    long x,
+    long y,
+    int direction
+) {
+    switch (direction) {
+    case 0:
+        return cellAt(matrix, y, x) && !cellAt(matrix, y - 1, x);
+    case 1:
+        return cellAt(matrix, y, x - 1) && !cellAt(matrix, y, x);
+    case 2:
+        return cellAt(matrix, y - 1, x - 1) && !cellAt(matrix, y, x - 1);
+    default:
+        return cellAt(matrix, y - 1, x) && !cellAt(matrix, y - 1, x - 1);
+    }
+}
+
+// Boundary to follow after reaching a corner. Turning left first keeps
+// diagonal neighbours in one outline, which makes components 8-connected.
+static int nextDirection(
+    const BinaryMatrix &matrix,
+    long x,
+    long y,
+    int direction
+) {
+    const int candidates[3]
+        = {(direction + 3) % 4, direction, (direction + 1) % 4};
+
+    for (auto candidate : candidates) {
+        if (isBoundary(matrix, x, y, candidate)) {
+            return candidate;
+        }
+    }
+
+    return (direction + 2) % 4;
+}
+
+// Horizontal cell edges: bit x of row y is set where cell (y, x) differs
+// from cell (y - 1, x), rows + 1 rows with false cells outside the matrix
+static BinaryMatrix horizontalEdges(const BinaryMatrix &matrix) {
+    BinaryMatrix edges(matrix.rows + 1, matrix.cols);
+    const auto stride = matrix.stride;
+
+    forEachStripe(
+        edges.rows,
+        stride * sizeof(Word) * 2,
+        [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                auto *target = edges.row(y);
+
+                for (size_t w = 0; w < stride; w++) {
+                    const auto below = y < matrix.rows ? matrix.row(y)[w] : 0;
+                    const auto above = y > 0 ? matrix.row(y - 1)[w] : 0;
+
+                    target[w] = below ^ above;
+                }
+            }
+        }
+    );
+
+    return edges;
+}
+
+// Runs of true cells of every row, runs of row i are
+// runs[offsets[i], offsets[i + 1])
+static void findRuns(
+    const BinaryMatrix &matrix,
+    std::vector<Run> &runs,
+    std::vector<size_t> &offsets
+) {
+    const auto wordBits = BinaryMatrix::WordBits;
+    offsets.assign(1, 0);
+
+    for (size_t i = 0; i < matrix.rows; i++) {
+        const auto *row = matrix.row(i);
+
+        // A run starts where a cell is true and its left neighbour is not,
+        // and ends where it is the other way around
+        Word carry = 0;
+        for (size_t w = 0; w < matrix.stride; w++) {
+            const auto word = row[w];
+            const auto shifted = (word << 1) | carry;
+            auto changes = word ^ shifted;
+            carry = word >> (wordBits - 1);
+
+            while (changes) {
+                const auto bit = lowestBit(changes);
+                const auto col = w * wordBits + bit;
+                changes &= changes - 1;
+
+                if ((word >> bit) & 1) {
+                    runs.push_back(Run{col, matrix.cols});
+                } else {
+                    runs.back().end = col;
+                }
+            }
+        }
+
+        offsets.push_back(runs.size());
+    }
+}
+
+static size_t findRoot(std::vector<size_t> &parents, size_t index) {
+    while (parents[index] != index) {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+
+    return index;
+}
+
+// Component of every run, 8-connected, numbered in row-major order of the
+// first cell. Returns the number of components.
+static size_t labelRuns(
+    const std::vector<Run> &runs,
+    const std::vector<size_t> &offsets,
+    std::vector<size_t> &labels
+) {
+    std::vector<size_t> parents(runs.size());
+    for (size_t r = 0; r < runs.size(); r++) {
+        parents[r] = r;
+    }
+
+    for (size_t i = 1; i + 1 < offsets.size(); i++) {
+        auto above = offsets[i - 1];
+        const auto aboveEnd = offsets[i];
+
+        for (auto r = offsets[i]; r < offsets[i + 1]; r++) {
+            // Runs above touching this one, diagonals included
+            while (above < aboveEnd && runs[above].end < runs[r].begin) {
+                above++;
+            }
+
+            for (auto a = above;
+                 a < aboveEnd && runs[a].begin <= runs[r].end;
+                 a++) {
+                const auto rootA = findRoot(parents, a);
+                const auto rootR = findRoot(parents, r);
+
+                parents[std::max(rootA, rootR)] = std::min(rootA, rootR);
+            }
+        }
+    }
+
+    // Roots are the first run of their component, so numbering them in run
+    // order gives the order of the first cells
+    const auto none = runs.size();
+    std::vector<size_t> numbers(runs.size(), none);
+    labels.resize(runs.size());
+
+    size_t count = 0;
+    for (size_t r = 0; r < runs.size(); r++) {
+        const auto root = findRoot(parents, r);
+        if (numbers[root] == none) {
+            numbers[root] = count++;
+        }
+
+        labels[r] = numbers[root];
+    }
+
+    return count;
+}
+
+// Component of a true cell
+static size_t labelAt(
+    const std::vector<Run> &runs,
+    const std::vector<size_t> &offsets,
+    const std::vector<size_t> &labels,
+    size_t row,
+    size_t col
+) {
+    const auto first = runs.begin() + offsets[row];
+    const auto last = runs.begin() + offsets[row + 1];
+    const auto run = std::upper_bound(
+        first,
+        last,
+        col,
+        [](size_t value, const Run &run) { return value < run.begin; }
+    );
+
+    return labels[run - 1 - runs.begin()];
+}
+
+// Twice the signed area, positive for clockwise polygons on screen
+static int64_t doubleArea(const Polygon &polygon) {
+    int64_t area = 0;
+    for (size_t i = 0; i < polygon.size(); i++) {
+        const auto &a = polygon[i];
+        const auto &b = polygon[(i + 1) % polygon.size()];
+
+        area += (int64_t)a.x * b.y - (int64_t)b.x * a.y;
+    }
+
+    return area;
+}
+
+std::vector<Contour> findContours(
+    const BinaryMatrix &matrix,
+    double epsilon
+) {
+    std::vector<Contour> contours;
+    if (matrix.isEmpty() || !matrix.hasTrue()) {
+        return contours;
+    }
+
+    std::vector<Run> runs;
+    std::vector<size_t> offsets, labels;
+    findRuns(matrix, runs, offsets);
+    contours.resize(labelRuns(runs, offsets, labels));
+
+    // Every outline has horizontal edges, those not walked yet are left in
+    // `edges` and the next outline starts from the first of them
+    auto edges = horizontalEdges(matrix);
+    const auto wordBits = BinaryMatrix::WordBits;
+
+    for (size_t y = 0; y < edges.rows; y++) {
+        auto *row = edges.row(y);
+
+        for (size_t w = 0; w < edges.stride; w++) {
+            while (row[w]) {
+                const long startX = (long)(w * wordBits + lowestBit(row[w]));
+                const long startY = (long)y;
+
+                // Going east along the top of a true cell, otherwise west
+                // along the bottom of one from the right end of the edge
+                const bool east = cellAt(matrix, startY, startX);
+                const int startDirection = east ? 0 : 2;
+                const auto label = labelAt(
+                    runs,
+                    offsets,
+                    labels,
+                    east ? startY : startY - 1,
+                    startX
+                );
+
+                Polygon polygon;
+                const long firstX = east ? startX : startX + 1;
+                long x = firstX, corner = startY;
+                int direction = startDirection;
+
+                do {
+                    if (direction == 0 || direction == 2) {
+                        const auto col = direction == 0 ? x : x - 1;
+                        edges.row(corner)[col / wordBits]
+                            &= ~(Word(1) << (col % wordBits));
+                    }
+
+                    x += stepX[direction];
+                    corner += stepY[direction];
+
+                    const auto next
+                        = nextDirection(matrix, x, corner, direction);
+                    if (next != direction) {
+                        polygon.push_back(cv::Point((int)x, (int)corner));
+                    }
+                    direction = next;
+                } while (x != firstX || corner != startY
+                         || direction != startDirection);
+
+                // Orientation of the traced outline, simplification could
+                // flip it for thin ones
+                const bool outer = doubleArea(polygon) > 0;
+                if (epsilon > 0) {
+                    polygon = simplifyPolygon(polygon, epsilon);
+                }
+
+                auto &contour = contours[label];
+                if (outer) {
+                    contour.outer = std::move(polygon);
+                } else {
+                    contour.holes.push_back(std::move(polygon));
+                }
+            }
+        }
+    }
+
+    return contours;
+}
+
+static double squaredDistanceToSegment(
+    const cv::Point &p,
+    const cv::Point &a,
+    const cv::Point &b
+) {
+    const double dx = b.x - a.x, dy = b.y - a.y;
+    const double px = p.x - a.x, py = p.y - a.y;
+    const double length = dx * dx + dy * dy;
+
+    double t = length > 0 ? (px * dx + py * dy) / length : 0;
+    t = std::max(0.0, std::min(1.0, t));
+
+    const double ex = px - t * dx, ey = py - t * dy;
+
+    return ex * ex + ey * ey;
+}
+
+// Farthest point strictly between `from` and `to` (indices modulo the size)
+// from the segment joining them, `from` when there is none
+static size_t farthestFromSegment(
+    const Polygon &polygon,
+    size_t from,
+    size_t to,
+    double &distance
+) {
+    const auto size = polygon.size();
+    const auto &a = polygon[from % size], &b = polygon[to % size];
+    size_t result = from;
+    distance = 0;
+
+    for (auto i = from + 1; i < to; i++) {
+        const auto d = squaredDistanceToSegment(polygon[i % size], a, b);
+        if (d > distance) {
+            distance = d;
+            result = i;
+        }
+    }
+
+    return result;
+}
+
+Polygon simplifyPolygon(const Polygon &polygon, double epsilon) {
+    const auto size = polygon.size();
+    if (epsilon <= 0 || size <= 3) {
+        return polygon;
+    }
+
+    // Closed outline: split at the point farthest from the first one, then
+    // simplify both chains
+    size_t split = 0;
+    int64_t splitDistance = -1;
+    for (size_t i = 1; i < size; i++) {
+        const int64_t dx = polygon[i].x - polygon[0].x;
+        const int64_t dy = polygon[i].y - polygon[0].y;
+
+        if (dx * dx + dy * dy > splitDistance) {
+            splitDistance = dx * dx + dy * dy;
+            split = i;
+        }
+    }
+
+    std::vector<bool> keep(size, false);
+    keep[0] = keep[split] = true;
+
+    const auto limit = epsilon * epsilon;
+    std::vector<std::pair<size_t, size_t>> chains{{0, split}, {split, size}};
+
+    while (!chains.empty()) {
+        const auto chain = chains.back();
+        chains.pop_back();
+
+        double distance;
+        const auto index = farthestFromSegment(
+            polygon,
+            chain.first,
+            chain.second,
+            distance
+        );
+        if (distance > limit) {
+            keep[index] = true;
+            chains.push_back({chain.first, index});
+            chains.push_back({index, chain.second});
+        }
+    }
+
+    Polygon result;
+    for (size_t i = 0; i < size; i++) {
+        if (keep[i]) {
+            result.push_back(polygon[i]);
+        }
+    }
+
+    // Two points are no outline, keep the farthest of the rest
+    if (result.size() < 3) {
+        double first, second;
+        const auto a = farthestFromSegment(polygon, 0, split, first);
+        const auto b = farthestFromSegment(polygon, split, size, second);
+        const auto extra = (first >= second ? a : b) % size;
+
+        result.clear();
+        for (size_t i = 0; i < size; i++) {
+            if (keep[i] || i == extra) {
+                result.push_back(polygon[i]);
+            }
+        }
+    }
+
+    return result;
+}
+
+static void writeVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static void writeSigned(std::string &out, int64_t value) {
+    writeVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void writeUint32(std::string &out, uint32_t value) {
+    out.append((const char *)&value, sizeof(value));
+}
+
+static void writeBinaryPolygon(std::string &out, const Polygon &polygon) {
+    writeUint32(out, (uint32_t)polygon.size());
+
+    cv::Point previous(0, 0);
+    for (auto &&point : polygon) {
+        writeSigned(out, point.x - previous.x);
+        writeSigned(out, point.y - previous.y);
+        previous = point;
+    }
+}
+
+static void writeJSONPolygon(std::string &out, const Polygon &polygon) {
+    out += '[';
+    for (size_t i = 0; i < polygon.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+
+        out += '[';
+        out += std::to_string(polygon[i].x);
+        out += ',';
+        out += std::to_string(polygon[i].y);
+        out += ']';
+    }
+    out += ']';
+}
+
+bool exportContours(
+    const std::vector<Contour> &contours,
+    size_t rows,
+    size_t cols,
+    std::ostream &output,
+    ContourFormat format
+) {
+    std::string out;
+
+    if (format == ContourBinary) {
+        out.append(CONTOUR_MAGIC, 4);
+        writeUint32(out, CONTOUR_VERSION);
+        writeUint32(out, (uint32_t)rows);
+        writeUint32(out, (uint32_t)cols);
+        writeUint32(out, (uint32_t)contours.size());
+
+        for (auto &&contour : contours) {
+            writeUint32(out, (uint32_t)(1 + contour.holes.size()));
+            writeBinaryPolygon(out, contour.outer);
+
+            for (auto &&hole : contour.holes) {
+                writeBinaryPolygon(out, hole);
+            }
+        }
+    } else {
+        out += "{\"rows\":" + std::to_string(rows)
+               + ",\"cols\":" + std::to_string(cols) + ",\"contours\":[";
+
+        for (size_t i = 0; i < contours.size(); i++) {
+            if (i > 0) {
+                out += ',';
+            }
+
+            out += "{\"outer\":";
+            writeJSONPolygon(out, contours[i].outer);
+            out += ",\"holes\":[";
+
+            const auto &holes = contours[i].holes;
+            for (size_t h = 0; h < holes.size(); h++) {
+                if (h > 0) {
+                    out += ',';
+                }
+                writeJSONPolygon(out, holes[h]);
+            }
+            out += "]}";
+        }
+        out += "]}\n";
+    }
+
+    output.write(out.data(), out.size());
+
+    return output.good();
+}
+
+bool exportContours(
+    const std::vector<Contour> &contours,
+    size_t rows,
+    size_t cols,
+    const std::filesystem::path &path,
+    ContourFormat format
+) {
+    std::ofstream output(path.string(), std::ios::binary);
+    if (!output) {
+        return false;
+    }
+
+    const bool result = exportContours(contours, rows, cols, output, format);
+    output.close();
+
+    return result && output.good();
+}
+
+std::string contourExtension(ContourFormat format) {
+    switch (format) {
+    case ContourJSON:
+        return ".json";
+    default:
+        return ".ibmp";
+    }
+}
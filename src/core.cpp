@@ -0,0 +1,344 @@
+#include "core.hpp"
+#include "pool.hpp"
+#include "kernels.hpp"
+#include "profiler.hpp"
+
+#define CHANNEL_MAX 255.0
+
+ColorRange::ColorRange(const cv::Scalar &from, const cv::Scalar &to)
+    : from(from), to(to) {
+}
+
+bool ColorRange::wrapsHue() const {
+    return this->from[0] > this->to[0];
+}
+
+// Same bounds as the threshold kernels, so that the classifier table built
+// from it never disagrees with them
+bool ColorRange::contains(const cv::Vec3b &hsv) const {
+    uint8_t low[3], high[3];
+    bool wrap;
+
+    if (!this->bounds(low, high, wrap)) {
+        return false;
+    }
+
+    const bool hue = wrap ? (hsv[0] >= low[0] || hsv[0] <= high[0])
+                          : (hsv[0] >= low[0] && hsv[0] <= high[0]);
+
+    return hue && hsv[1] >= low[1] && hsv[1] <= high[1] && hsv[2] >= low[2]
+           && hsv[2] <= high[2];
+}
+
+// Inclusive 8-bit bounds of [from, to], false when no value fits. Bounds
+// are rounded like cv::inRange rounds Scalar bounds for 8-bit images.
+static bool channelBounds(double from, double to, uint8_t &low, uint8_t &high) {
+    const int first = std::max(cvRound(from), 0);
+    const int last = std::min(cvRound(to), (int)CHANNEL_MAX);
+    if (first > last) {
+        return false;
+    }
+
+    low = (uint8_t)first;
+    high = (uint8_t)last;
+
+    return true;
+}
+
+bool ColorRange::bounds(uint8_t *low, uint8_t *high, bool &wrap) const {
+    bool matches = true;
+    wrap = false;
+
+    for (int c = 1; c < 3; c++) {
+        matches = channelBounds(this->from[c], this->to[c], low[c], high[c])
+                  && matches;
+    }
+
+    if (!this->wrapsHue()) {
+        return channelBounds(this->from[0], this->to[0], low[0], high[0])
+               && matches;
+    }
+
+    // [from, 255] and [0, to], either one can be empty
+    uint8_t upper, lower, unused;
+    const bool hasUpper
+        = channelBounds(this->from[0], CHANNEL_MAX, upper, unused);
+    const bool hasLower = channelBounds(0, this->to[0], unused, lower);
+
+    wrap = hasUpper && hasLower;
+    low[0] = hasUpper ? upper : 0;
+    high[0] = hasLower ? lower : (uint8_t)CHANNEL_MAX;
+
+    return (hasUpper || hasLower) && matches;
+}
+
+void ColorRange::threshold(const cv::Mat &hsv, cv::Mat &mask) const {
+    mask.create(hsv.rows, hsv.cols, CV_8UC1);
+
+    uint8_t low[3], high[3];
+    bool wrap;
+
+    if (!this->bounds(low, high, wrap)) {
+        mask.setTo(cv::Scalar(0));
+
+        return;
+    }
+
+    const auto thresholdRow = kernels().thresholdRow;
+    for (int i = 0; i < hsv.rows; i++) {
+        thresholdRow(
+            hsv.ptr<uchar>(i),
+            hsv.cols,
+            low,
+            high,
+            wrap,
+            mask.ptr<uchar>(i)
+        );
+    }
+}
+
+Exception::Exception(const std::string &message): message(message) {
+}
+
+BinaryMatrix::BinaryMatrix(): BinaryMatrix(0, 0) {
+}
+
+BinaryMatrix::BinaryMatrix(size_t rows, size_t cols) {
+    this->reset(rows, cols);
+}
+
+BinaryMatrix::BinaryMatrix(
+    size_t rows,
+    size_t cols,
+    const std::vector<std::vector<BinaryMatrix::Type>> &data
+) {
+    this->reset(rows, cols);
+
+    if (data.size() != rows) {
+        return;
+    }
+
+    for (size_t i = 0; i < rows; i++) {
+        const auto count = std::min(cols, data[i].size());
+
+        for (size_t j = 0; j < count; j++) {
+            this->set(i, j, data[i][j]);
+        }
+    }
+}
+
+bool BinaryMatrix::isEmpty() const {
+    return !this->rows || !this->cols || this->data.empty();
+}
+
+bool BinaryMatrix::isValid() const {
+    if (this->stride != self::wordsFor(this->cols)
+        || this->data.size() != this->rows * this->stride) {
+        return false;
+    }
+
+    if (this->stride == 0) {
+        return true;
+    }
+
+    // Padding bits must stay clear, otherwise counters are off
+    const auto padding = ~this->lastWordMask();
+    for (size_t i = 0; i < this->rows; i++) {
+        if (this->row(i)[this->stride - 1] & padding) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool BinaryMatrix::hasTrue() const {
+    if (this->isEmpty()) {
+        return false;
+    }
+
+    for (auto &&word : this->data) {
+        if (word != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void BinaryMatrix::clear() {
+    this->data.clear();
+    this->cols = 0;
+    this->rows = 0;
+    this->stride = 0;
+}
+
+BinaryMatrix::Type BinaryMatrix::at(size_t row, size_t col) const {
+    const auto word = this->row(row)[col / self::WordBits];
+
+    return (Type)((word >> (col % self::WordBits)) & 1);
+}
+
+void BinaryMatrix::set(size_t row, size_t col, BinaryMatrix::Type value) {
+    auto &word = this->row(row)[col / self::WordBits];
+    const auto bit = Word(1) << (col % self::WordBits);
+
+    if (value == self::True) {
+        word |= bit;
+    } else {
+        word &= ~bit;
+    }
+}
+
+void BinaryMatrix::reset(size_t rows, size_t cols) {
+    this->clear();
+
+    this->rows = rows;
+    this->cols = cols;
+    this->stride = self::wordsFor(cols);
+
+    if (rows > 0 && cols > 0) {
+        this->data.assign(rows * this->stride, Word(0));
+    }
+}
+
+bool BinaryMatrix::isTrue(size_t row, size_t col) const {
+    return this->at(row, col) == BinaryMatrix::True;
+}
+
+bool BinaryMatrix::isFalse(size_t row, size_t col) const {
+    return this->at(row, col) == BinaryMatrix::False;
+}
+
+void BinaryMatrix::assignMask(const cv::Mat &mask) {
+    this->reset(mask.rows, mask.cols);
+
+    const auto channels = (size_t)mask.channels();
+    forEachStripe(
+        this->rows,
+        this->cols * mask.elemSize(),
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                self::packRow(
+                    mask.ptr<uchar>((int)i),
+                    this->cols,
+                    channels,
+                    this->row(i)
+                );
+            }
+        }
+    );
+}
+
+void BinaryMatrix::packRow(
+    const uint8_t *pixels,
+    size_t cols,
+    size_t channels,
+    Word *words
+) {
+    if (channels == 1) {
+        kernels().packMask(pixels, cols, words);
+
+        return;
+    }
+
+    for (size_t offset = 0; offset < cols; offset += self::WordBits) {
+        const auto count = std::min(self::WordBits, cols - offset);
+        Word word = 0;
+
+        for (size_t bit = 0; bit < count; bit++, pixels += channels) {
+            word |= Word(*pixels != 0) << bit;
+        }
+
+        *words++ = word;
+    }
+}
+
+BinaryMatrix::Word *BinaryMatrix::row(size_t row) {
+    return this->data.data() + row * this->stride;
+}
+
+const BinaryMatrix::Word *BinaryMatrix::row(size_t row) const {
+    return this->data.data() + row * this->stride;
+}
+
+BinaryMatrix::Word BinaryMatrix::lastWordMask() const {
+    const auto tail = this->cols % self::WordBits;
+
+    return tail == 0 ? ~Word(0) : (Word(1) << tail) - 1;
+}
+
+std::vector<unsigned int> BinaryMatrix::sumRows() const {
+    if (this->isEmpty()) {
+        return {};
+    }
+
+    ProfileScope scope("sumRows", this->data.size() * sizeof(Word));
+    std::vector<unsigned int> result(this->rows);
+    const auto countBits = kernels().countBits;
+
+    for (size_t i = 0; i < this->rows; i++) {
+        result[i] = (unsigned int)countBits(this->row(i), this->stride);
+    }
+
+    return result;
+}
+
+std::vector<unsigned int> BinaryMatrix::sumCols() const {
+    if (this->isEmpty()) {
+        return {};
+    }
+
+    ProfileScope scope("sumCols", this->data.size() * sizeof(Word));
+    std::vector<unsigned int> result(this->cols, 0);
+
+    for (size_t i = 0; i < this->rows; i++) {
+        const auto *words = this->row(i);
+
+        for (size_t w = 0; w < this->stride; w++) {
+            auto word = words[w];
+
+            while (word != 0) {
+                result[w * self::WordBits + lowestBit(word)]++;
+                word &= word - 1;
+            }
+        }
+    }
+
+    return result;
+}
+
+BinaryMatrix BinaryMatrix::transpose() const {
+    BinaryMatrix matrix(this->cols, this->rows);
+    const auto transposeBlock = kernels().transposeBlock;
+    Word block[self::WordBits];
+
+    // 64 x 64 blocks: word w of rows [64 * b, 64 * b + 64) becomes word b of
+    // rows [64 * w, 64 * w + 64). Missing rows are zeros, which also keeps
+    // the padding bits of the result clear.
+    for (size_t b = 0; b < matrix.stride; b++) {
+        const auto top = b * self::WordBits;
+        const auto height = std::min(self::WordBits, this->rows - top);
+
+        for (size_t w = 0; w < this->stride; w++) {
+            const auto left = w * self::WordBits;
+            const auto width = std::min(self::WordBits, this->cols - left);
+
+            for (size_t k = 0; k < self::WordBits; k++) {
+                block[k] = k < height ? this->row(top + k)[w] : 0;
+            }
+
+            transposeBlock(block);
+
+            for (size_t k = 0; k < width; k++) {
+                matrix.row(left + k)[b] = block[k];
+            }
+        }
+    }
+
+    return matrix;
+}
+
+size_t BinaryMatrix::wordsFor(size_t cols) {
+    return (cols + self::WordBits - 1) / self::WordBits;
+}
@@ -0,0 +1,838 @@
+#include "daemon.hpp"
+#include "buffer.hpp"
+#include "kernels.hpp"
+#include "pool.hpp"
+
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Largest batch a request may hold
+#define DAEMON_MAX_BATCH 4096
+// How often the accepting loop looks at the stop flag, in milliseconds
+#define DAEMON_POLL_INTERVAL 100
+// Bytes read from a connection per poll wake-up
+#define DAEMON_READ_CHUNK 65536
+// Replies to a client that stops reading give up after this, in seconds
+#define DAEMON_SEND_TIMEOUT 5
+
+using namespace std;
+
+// Copy `value` into a fixed-size field, cutting it to fit
+static void copyName(char *target, size_t size, const string &value) {
+    const auto length = std::min(value.size(), size - 1);
+
+    memcpy(target, value.data(), length);
+    memset(target + length, 0, size - length);
+}
+
+DaemonHeader::DaemonHeader(uint32_t command, uint32_t count)
+    : magic(DAEMON_MAGIC), command(command), count(count), reserved(0) {
+}
+
+DaemonJob::DaemonJob()
+    : operation(DaemonThreshold),
+      format(PixelBGR),
+      width(0),
+      height(0),
+      pixelStride(0),
+      pixelOffset(0),
+      bitStride(0),
+      bitOffset(0),
+      from{0, 0, 0},
+      to{0, 0, 0},
+      pixelSegment{},
+      bitSegment{} {
+}
+
+void DaemonJob::setSegments(const string &pixels, const string &bits) {
+    copyName(this->pixelSegment, sizeof(this->pixelSegment), pixels);
+    copyName(this->bitSegment, sizeof(this->bitSegment), bits);
+}
+
+void DaemonJob::setRange(const ColorRange &range) {
+    for (int i = 0; i < 3; i++) {
+        this->from[i] = (float)range.from[i];
+        this->to[i] = (float)range.to[i];
+    }
+}
+
+ColorRange DaemonJob::colorRange() const {
+    return ColorRange(
+        cv::Scalar(this->from[0], this->from[1], this->from[2]),
+        cv::Scalar(this->to[0], this->to[1], this->to[2])
+    );
+}
+
+DaemonResult::DaemonResult()
+    : status(0), reserved(0), trueCells(0), latency(0), error{} {
+}
+
+bool DaemonResult::isOk() const {
+    return this->status == 0;
+}
+
+DaemonStatistics::DaemonStatistics()
+    : batches(0),
+      jobs(0),
+      failures(0),
+      queueDepth(0),
+      maxQueueDepth(0),
+      p50(0),
+      p90(0),
+      p99(0),
+      maxLatency(0) {
+}
+
+#if !defined(_WIN32)
+
+static bool readAll(int descriptor, void *target, size_t size) {
+    auto *bytes = (uint8_t *)target;
+
+    while (size > 0) {
+        const auto count = read(descriptor, bytes, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+
+        bytes += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+static bool writeAll(int descriptor, const void *source, size_t size) {
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const auto *bytes = (const uint8_t *)source;
+
+    while (size > 0) {
+        const auto count = ::send(descriptor, bytes, size, flags);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+
+        bytes += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+static sockaddr_un socketAddress(const string &path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw Exception("Socket path \"" + path + "\" is too long!");
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    return address;
+}
+
+SharedSegment::SharedSegment(const string &name, size_t size)
+    : segmentName(name), bytes(nullptr), length(size), owner(true) {
+    if (name.size() >= DAEMON_SEGMENT_NAME || name.empty() || name[0] != '/') {
+        throw Exception("Invalid shared memory name \"" + name + "\"!");
+    }
+
+    shm_unlink(name.c_str());
+
+    const int descriptor = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (descriptor < 0) {
+        throw Exception("Unable to create shared memory \"" + name + "\"!");
+    }
+
+    void *data = MAP_FAILED;
+    if (ftruncate(descriptor, (off_t)size) == 0) {
+        data = mmap(
+            nullptr,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            descriptor,
+            0
+        );
+    }
+    close(descriptor);
+
+    if (data == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw Exception("Unable to map shared memory \"" + name + "\"!");
+    }
+
+    this->bytes = (uint8_t *)data;
+}
+
+SharedSegment::~SharedSegment() {
+    munmap(this->bytes, this->length);
+
+    if (this->owner) {
+        shm_unlink(this->segmentName.c_str());
+    }
+}
+
+const string &SharedSegment::name() const {
+    return this->segmentName;
+}
+
+uint8_t *SharedSegment::data() const {
+    return this->bytes;
+}
+
+size_t SharedSegment::size() const {
+    return this->length;
+}
+
+struct DaemonServer::Connection
+{
+    int descriptor;
+    // Bytes received but not making a whole request yet, only touched by
+    // the accepting loop
+    std::vector<uint8_t> input;
+    // Replies come from the worker, statistics from the accepting loop
+    std::mutex writing;
+
+    Connection(int descriptor): descriptor(descriptor) {
+        timeval timeout = {DAEMON_SEND_TIMEOUT, 0};
+        setsockopt(
+            descriptor,
+            SOL_SOCKET,
+            SO_SNDTIMEO,
+            &timeout,
+            sizeof(timeout)
+        );
+    }
+
+    ~Connection() {
+        close(this->descriptor);
+    }
+
+    bool reply(const DaemonHeader &header, const void *body, size_t size) {
+        std::lock_guard<std::mutex> lock(this->writing);
+
+        return writeAll(this->descriptor, &header, sizeof(header))
+               && writeAll(this->descriptor, body, size);
+    }
+};
+
+DaemonServer::DaemonServer(const string &socketPath)
+    : socketPath(socketPath),
+      listener(-1),
+      stopping(false),
+      latencies(LatencyWindow, 0),
+      latencyCount(0) {
+    const auto address = socketAddress(socketPath);
+
+    this->listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->listener < 0) {
+        throw Exception("Unable to create socket!");
+    }
+
+    // A daemon still answering on the path keeps it, a socket file left
+    // by one that did not exit cleanly is replaced
+    const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool running
+        = probe >= 0
+          && connect(probe, (const sockaddr *)&address, sizeof(address)) == 0;
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (running) {
+        close(this->listener);
+        throw Exception("A daemon is already serving \"" + socketPath + "\"!");
+    }
+    unlink(socketPath.c_str());
+
+    if (bind(this->listener, (const sockaddr *)&address, sizeof(address)) != 0
+        || listen(this->listener, SOMAXCONN) != 0) {
+        close(this->listener);
+        throw Exception("Unable to listen on \"" + socketPath + "\"!");
+    }
+}
+
+DaemonServer::~DaemonServer() {
+    close(this->listener);
+    unlink(this->socketPath.c_str());
+    this->unmapAll();
+}
+
+void DaemonServer::run() {
+    // Replies to clients that went away must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    // Warm up before the first request: worker threads and kernel dispatch
+    ThreadPool::shared();
+    kernels();
+
+    thread worker([this]() { this->work(); });
+    vector<shared_ptr<Connection>> connections;
+
+    while (!this->stopping) {
+        vector<pollfd> descriptors(1 + connections.size());
+        descriptors[0] = {this->listener, POLLIN, 0};
+        for (size_t i = 0; i < connections.size(); i++) {
+            descriptors[i + 1] = {connections[i]->descriptor, POLLIN, 0};
+        }
+
+        const auto ready = poll(
+            descriptors.data(),
+            descriptors.size(),
+            DAEMON_POLL_INTERVAL
+        );
+        if (ready <= 0) {
+            continue;
+        }
+
+        // Backwards, so that closed connections can be erased in place
+        for (size_t i = connections.size(); i-- > 0;) {
+            if (descriptors[i + 1].revents == 0) {
+                continue;
+            }
+
+            if (!this->receive(connections[i])) {
+                connections.erase(connections.begin() + i);
+            }
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            const int descriptor = accept(this->listener, nullptr, nullptr);
+            if (descriptor >= 0) {
+                connections.push_back(make_shared<Connection>(descriptor));
+            }
+        }
+    }
+
+    this->wake.notify_all();
+    worker.join();
+}
+
+void DaemonServer::stop() {
+    this->stopping = true;
+}
+
+DaemonStatistics DaemonServer::statistics() {
+    vector<uint64_t> window;
+    DaemonStatistics result;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        result = this->counters;
+        window.assign(
+            this->latencies.begin(),
+            this->latencies.begin()
+                + std::min(this->latencyCount, this->latencies.size())
+        );
+    }
+
+    if (window.empty()) {
+        return result;
+    }
+
+    const auto percentile = [&](size_t percent) {
+        const auto index = (window.size() - 1) * percent / 100;
+        nth_element(window.begin(), window.begin() + index, window.end());
+
+        return window[index];
+    };
+
+    result.p50 = percentile(50);
+    result.p90 = percentile(90);
+    result.p99 = percentile(99);
+    result.maxLatency = *max_element(window.begin(), window.end());
+
+    return result;
+}
+
+// Read what the connection has without waiting and handle the requests it
+// completes, false when the connection is closed or broken. A client that
+// sends part of a request only holds its own buffer, not the other clients.
+bool DaemonServer::receive(const shared_ptr<Connection> &connection) {
+    auto &input = connection->input;
+    const auto kept = input.size();
+
+    input.resize(kept + DAEMON_READ_CHUNK);
+    const auto count = recv(
+        connection->descriptor,
+        input.data() + kept,
+        DAEMON_READ_CHUNK,
+        MSG_DONTWAIT
+    );
+    input.resize(kept + std::max(count, (ssize_t)0));
+
+    if (count == 0) {
+        return false;
+    }
+    if (count < 0) {
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    size_t used = 0;
+    while (input.size() - used >= sizeof(DaemonHeader)) {
+        DaemonHeader header;
+        memcpy(&header, input.data() + used, sizeof(header));
+        if (header.magic != DAEMON_MAGIC) {
+            return false;
+        }
+
+        size_t body = 0;
+        if (header.command == DaemonBatch) {
+            if (header.count > DAEMON_MAX_BATCH) {
+                return false;
+            }
+            body = header.count * sizeof(DaemonJob);
+        }
+        if (input.size() - used - sizeof(header) < body) {
+            break;
+        }
+
+        if (!this->handle(
+                connection,
+                header,
+                input.data() + used + sizeof(header)
+            )) {
+            return false;
+        }
+        used += sizeof(header) + body;
+    }
+
+    input.erase(input.begin(), input.begin() + used);
+
+    return true;
+}
+
+// One whole request, `body` holds the jobs of a batch
+bool DaemonServer::handle(
+    const shared_ptr<Connection> &connection,
+    const DaemonHeader &header,
+    const uint8_t *body
+) {
+    switch (header.command) {
+    case DaemonBatch:
+        break;
+    case DaemonStats: {
+        const auto statistics = this->statistics();
+
+        return connection->reply(header, &statistics, sizeof(statistics));
+    }
+    case DaemonShutdown:
+        this->stop();
+
+        return connection->reply(header, nullptr, 0);
+    default:
+        return false;
+    }
+
+    Request request;
+    request.connection = connection;
+    request.header = header;
+    request.received = chrono::steady_clock::now();
+    request.jobs.resize(header.count);
+    memcpy(request.jobs.data(), body, header.count * sizeof(DaemonJob));
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        this->counters.batches++;
+        this->counters.queueDepth += request.jobs.size();
+        this->counters.maxQueueDepth = std::max(
+            this->counters.maxQueueDepth,
+            this->counters.queueDepth
+        );
+        this->queue.push_back(std::move(request));
+    }
+    this->wake.notify_one();
+
+    return true;
+}
+
+// Batches run one after another, every job uses the whole thread pool. The
+// queue is drained before stopping.
+void DaemonServer::work() {
+    while (true) {
+        Request request;
+
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait_for(
+                lock,
+                chrono::milliseconds(DAEMON_POLL_INTERVAL),
+                [this]() { return this->stopping || !this->queue.empty(); }
+            );
+
+            if (this->queue.empty()) {
+                if (this->stopping) {
+                    return;
+                }
+
+                continue;
+            }
+
+            request = std::move(this->queue.front());
+            this->queue.pop_front();
+        }
+
+        this->process(request);
+    }
+}
+
+void DaemonServer::process(Request &request) {
+    vector<DaemonResult> results(request.jobs.size());
+
+    for (size_t i = 0; i < request.jobs.size(); i++) {
+        auto &result = results[i];
+        this->runJob(request.jobs[i], result);
+
+        result.latency = (uint64_t)chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - request.received
+        ).count();
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->counters.jobs++;
+        this->counters.failures += result.isOk() ? 0 : 1;
+        this->counters.queueDepth--;
+        this->latencies[this->latencyCount++ % this->latencies.size()]
+            = result.latency;
+    }
+
+    request.connection->reply(
+        request.header,
+        results.data(),
+        results.size() * sizeof(DaemonResult)
+    );
+}
+
+void DaemonServer::runJob(const DaemonJob &job, DaemonResult &result) {
+    try {
+        if (job.format > PixelHSV) {
+            throw Exception("Unknown pixel format!");
+        }
+        if (job.operation != DaemonThreshold && job.operation != DaemonPack) {
+            throw Exception("Unknown operation!");
+        }
+        if (job.bitOffset % sizeof(BinaryMatrix::Word) != 0) {
+            throw Exception("Bit offset is not a multiple of 8!");
+        }
+
+        size_t pixelSize = 0, bitSize = 0;
+        auto *pixelData = this->map(job.pixelSegment, pixelSize);
+        auto *bitData = this->map(job.bitSegment, bitSize);
+
+        const PixelBuffer pixels(
+            pixelData + job.pixelOffset,
+            job.width,
+            job.height,
+            job.pixelStride,
+            (PixelFormat)job.format
+        );
+        BitBuffer bits(
+            (BinaryMatrix::Word *)(bitData + job.bitOffset),
+            job.height,
+            job.width,
+            job.bitStride
+        );
+
+        if (!pixels.isValid() || !bits.isValid()) {
+            throw Exception("Invalid pixel or bit buffer!");
+        }
+        if (job.pixelOffset > pixelSize || job.pixelStride > pixelSize
+            || job.bitOffset > bitSize
+            || bits.stride * sizeof(BinaryMatrix::Word) > bitSize) {
+            throw Exception("Buffer does not fit its shared memory segment!");
+        }
+
+        // Last byte touched must lie inside the segment
+        const auto pixelEnd = job.pixelOffset
+                              + (job.height - 1) * job.pixelStride
+                              + job.width * pixels.channels();
+        const auto bitEnd = job.bitOffset
+                            + ((job.height - 1) * bits.stride
+                               + BinaryMatrix::wordsFor(job.width))
+                                  * sizeof(BinaryMatrix::Word);
+        if (pixelEnd > pixelSize || bitEnd > bitSize) {
+            throw Exception("Buffer does not fit its shared memory segment!");
+        }
+
+        if (job.operation == DaemonThreshold) {
+            thresholdPixels(pixels, job.colorRange(), bits);
+        } else {
+            packPixels(pixels, bits);
+        }
+
+        const auto countBits = kernels().countBits;
+        const auto words = BinaryMatrix::wordsFor(job.width);
+        for (size_t i = 0; i < job.height; i++) {
+            result.trueCells += countBits(bits.row(i), words);
+        }
+    } catch (const Exception &e) {
+        result.status = 1;
+        copyName(result.error, sizeof(result.error), e.message);
+    } catch (const cv::Exception &e) {
+        result.status = 1;
+        copyName(result.error, sizeof(result.error), e.what());
+    } catch (const std::exception &e) {
+        // E.g. bad_alloc of the scratch band for a huge client-given size
+        result.status = 1;
+        copyName(result.error, sizeof(result.error), e.what());
+    }
+}
+
+// Mapping of the named segment, reused while the segment behind the name
+// stays the same
+uint8_t *DaemonServer::map(const char *name, size_t &size) {
+    const string key(name, strnlen(name, DAEMON_SEGMENT_NAME));
+
+    const int descriptor = shm_open(key.c_str(), O_RDWR, 0);
+    if (descriptor < 0) {
+        throw Exception("Unable to open shared memory \"" + key + "\"!");
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw Exception("Unable to open shared memory \"" + key + "\"!");
+    }
+
+    const auto found = this->mappings.find(key);
+    if (found != this->mappings.end()) {
+        const auto &mapping = found->second;
+
+        if (mapping.device == (uint64_t)status.st_dev
+            && mapping.inode == (uint64_t)status.st_ino
+            && mapping.size == (size_t)status.st_size) {
+            close(descriptor);
+            size = mapping.size;
+
+            return mapping.data;
+        }
+
+        munmap(mapping.data, mapping.size);
+        this->mappings.erase(found);
+    }
+
+    if (this->mappings.size() >= MappingCacheSize) {
+        this->unmapAll();
+    }
+
+    void *data = MAP_FAILED;
+    if (status.st_size > 0) {
+        data = mmap(
+            nullptr,
+            (size_t)status.st_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            descriptor,
+            0
+        );
+    }
+    close(descriptor);
+
+    if (data == MAP_FAILED) {
+        throw Exception("Unable to map shared memory \"" + key + "\"!");
+    }
+
+    Mapping mapping;
+    mapping.data = (uint8_t *)data;
+    mapping.size = (size_t)status.st_size;
+    mapping.device = (uint64_t)status.st_dev;
+    mapping.inode = (uint64_t)status.st_ino;
+    this->mappings[key] = mapping;
+
+    size = mapping.size;
+
+    return mapping.data;
+}
+
+void DaemonServer::unmapAll() {
+    for (auto &&[name, mapping] : this->mappings) {
+        munmap(mapping.data, mapping.size);
+    }
+
+    this->mappings.clear();
+}
+
+DaemonClient::DaemonClient(const string &socketPath): descriptor(-1) {
+    const auto address = socketAddress(socketPath);
+
+    this->descriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->descriptor < 0) {
+        throw Exception("Unable to create socket!");
+    }
+
+    if (connect(this->descriptor, (const sockaddr *)&address, sizeof(address))
+        != 0) {
+        close(this->descriptor);
+        throw Exception("Unable to connect to \"" + socketPath + "\"!");
+    }
+
+#if defined(SO_NOSIGPIPE)
+    const int enabled = 1;
+    setsockopt(
+        this->descriptor,
+        SOL_SOCKET,
+        SO_NOSIGPIPE,
+        &enabled,
+        sizeof(enabled)
+    );
+#endif
+}
+
+DaemonClient::~DaemonClient() {
+    close(this->descriptor);
+}
+
+vector<DaemonResult> DaemonClient::submit(const vector<DaemonJob> &jobs) {
+    if (jobs.size() > DAEMON_MAX_BATCH) {
+        throw Exception("Too many jobs in one batch!");
+    }
+
+    this->send(
+        DaemonHeader(DaemonBatch, (uint32_t)jobs.size()),
+        jobs.data(),
+        jobs.size() * sizeof(DaemonJob)
+    );
+
+    const auto header = this->receive(DaemonBatch);
+    vector<DaemonResult> results(header.count);
+
+    if (!readAll(
+            this->descriptor,
+            results.data(),
+            results.size() * sizeof(DaemonResult)
+        )) {
+        throw Exception("Daemon connection closed!");
+    }
+
+    return results;
+}
+
+DaemonStatistics DaemonClient::statistics() {
+    this->send(DaemonHeader(DaemonStats), nullptr, 0);
+    this->receive(DaemonStats);
+
+    DaemonStatistics result;
+    if (!readAll(this->descriptor, &result, sizeof(result))) {
+        throw Exception("Daemon connection closed!");
+    }
+
+    return result;
+}
+
+void DaemonClient::shutdown() {
+    this->send(DaemonHeader(DaemonShutdown), nullptr, 0);
+    this->receive(DaemonShutdown);
+}
+
+void DaemonClient::send(
+    const DaemonHeader &header,
+    const void *body,
+    size_t size
+) {
+    if (!writeAll(this->descriptor, &header, sizeof(header))
+        || !writeAll(this->descriptor, body, size)) {
+        throw Exception("Daemon connection closed!");
+    }
+}
+
+DaemonHeader DaemonClient::receive(uint32_t command) {
+    DaemonHeader header;
+
+    if (!readAll(this->descriptor, &header, sizeof(header))) {
+        throw Exception("Daemon connection closed!");
+    }
+    if (header.magic != DAEMON_MAGIC || header.command != command) {
+        throw Exception("Unexpected reply from the daemon!");
+    }
+
+    return header;
+}
+
+#else
+
+#define DAEMON_UNSUPPORTED \
+    "Daemon mode needs Unix domain sockets and POSIX shared memory!"
+
+SharedSegment::SharedSegment(const string &name, size_t size)
+    : segmentName(name), bytes(nullptr), length(size), owner(false) {
+    throw Exception(DAEMON_UNSUPPORTED);
+}
+
+SharedSegment::~SharedSegment() {
+}
+
+const string &SharedSegment::name() const {
+    return this->segmentName;
+}
+
+uint8_t *SharedSegment::data() const {
+    return this->bytes;
+}
+
+size_t SharedSegment::size() const {
+    return this->length;
+}
+
+struct DaemonServer::Connection
+{
+};
+
+DaemonServer::DaemonServer(const string &socketPath)
+    : socketPath(socketPath), listener(-1), stopping(false), latencyCount(0) {
+    throw Exception(DAEMON_UNSUPPORTED);
+}
+
+DaemonServer::~DaemonServer() {
+}
+
+void DaemonServer::run() {
+}
+
+void DaemonServer::stop() {
+    this->stopping = true;
+}
+
+DaemonStatistics DaemonServer::statistics() {
+    return this->counters;
+}
+
+DaemonClient::DaemonClient(const string &socketPath): descriptor(-1) {
+    throw Exception(DAEMON_UNSUPPORTED);
+}
+
+DaemonClient::~DaemonClient() {
+}
+
+vector<DaemonResult> DaemonClient::submit(const vector<DaemonJob> &jobs) {
+    return {};
+}
+
+DaemonStatistics DaemonClient::statistics() {
+    return DaemonStatistics();
+}
+
+void DaemonClient::shutdown() {
+}
+
+#endif
@@ -0,0 +1,213 @@
+#include "distance.hpp"
+#include "pool.hpp"
+
+#include <cmath>
+#include <limits>
+
+// Column distances of at most 64 columns sharing a word, rows 4 bytes each
+#define COLUMN_GRAIN 1
+
+static inline void store(float &target, double distance) {
+    target = (float)distance;
+}
+
+static inline void store(uint16_t &target, double distance) {
+    target = (uint16_t)std::min(std::round(distance), (double)UINT16_MAX);
+}
+
+// First pass: distance from every cell to the nearest true cell of its
+// column, `none` where the column has no true cell. Columns go one word at
+// a time, so that a thread reads and writes adjacent cells of every row.
+static void columnDistances(
+    const BinaryMatrix &matrix,
+    uint32_t none,
+    std::vector<uint32_t> &columns
+) {
+    const auto rows = matrix.rows, cols = matrix.cols;
+    const auto wordBits = BinaryMatrix::WordBits;
+
+    ThreadPool::shared().parallelFor(
+        matrix.stride,
+        COLUMN_GRAIN,
+        [&](size_t begin, size_t end) {
+            for (size_t w = begin; w < end; w++) {
+                const auto first = w * wordBits;
+                const auto count = std::min(wordBits, cols - first);
+
+                // Down, distance to the nearest true cell above
+                for (size_t i = 0; i < rows; i++) {
+                    const auto word = matrix.row(i)[w];
+                    auto *target = &columns[i * cols + first];
+                    const auto *above = i > 0 ? target - cols : nullptr;
+
+                    for (size_t b = 0; b < count; b++) {
+                        if ((word >> b) & 1) {
+                            target[b] = 0;
+                        } else if (!above || above[b] == none) {
+                            target[b] = none;
+                        } else {
+                            target[b] = above[b] + 1;
+                        }
+                    }
+                }
+
+                // Up, the nearest true cell below may be closer
+                for (size_t i = rows - 1; i-- > 0;) {
+                    auto *target = &columns[i * cols + first];
+                    const auto *below = target + cols;
+
+                    for (size_t b = 0; b < count; b++) {
+                        if (below[b] != none && below[b] + 1 < target[b]) {
+                            target[b] = below[b] + 1;
+                        }
+                    }
+                }
+            }
+        }
+    );
+}
+
+// Second pass for the Euclidean distance: squared distance of every cell of
+// a row as the lower envelope of the parabolas (x - u)^2 + g(u)^2 (Meijster,
+// Roerdink and Hesselink), in exact integers
+static void euclideanRow(
+    const uint32_t *columns,
+    size_t cols,
+    std::vector<size_t> &sites,
+    std::vector<size_t> &starts,
+    std::vector<uint64_t> &squared
+) {
+    const auto f = [&](size_t x, size_t u) {
+        const auto dx = (int64_t)x - (int64_t)u;
+        const auto g = (int64_t)columns[u];
+
+        return (uint64_t)(dx * dx + g * g);
+    };
+    // First x from which u is nearer than i < u
+    const auto separation = [&](size_t i, size_t u) {
+        const auto gi = (int64_t)columns[i], gu = (int64_t)columns[u];
+        const auto ii = (int64_t)i, uu = (int64_t)u;
+
+        return (uu * uu - ii * ii + gu * gu - gi * gi) / (2 * (uu - ii));
+    };
+
+    sites.resize(cols);
+    starts.resize(cols);
+    squared.resize(cols);
+
+    size_t q = 0;
+    sites[0] = 0;
+    starts[0] = 0;
+
+    for (size_t u = 1; u < cols; u++) {
+        while (f(starts[q], sites[q]) > f(starts[q], u)) {
+            if (q == 0) {
+                break;
+            }
+            q--;
+        }
+
+        if (f(starts[q], sites[q]) > f(starts[q], u)) {
+            sites[0] = u;
+            continue;
+        }
+
+        const auto from = 1 + separation(sites[q], u);
+        if (from < (int64_t)cols) {
+            q++;
+            sites[q] = u;
+            starts[q] = (size_t)from;
+        }
+    }
+
+    for (size_t x = cols; x-- > 0;) {
+        squared[x] = f(x, sites[q]);
+
+        if (x == starts[q] && q > 0) {
+            q--;
+        }
+    }
+}
+
+template <typename T>
+static void transform(
+    const BinaryMatrix &matrix,
+    DistanceMetric metric,
+    std::vector<T> &distances,
+    T infinite
+) {
+    const auto rows = matrix.rows, cols = matrix.cols;
+    distances.resize(rows * cols);
+
+    if (matrix.isEmpty()) {
+        return;
+    }
+    if (!matrix.hasTrue()) {
+        std::fill(distances.begin(), distances.end(), infinite);
+
+        return;
+    }
+
+    // Farther than any cell, still small enough to square without overflow
+    const auto none = (uint32_t)(rows + cols);
+
+    // As large as the result, so not kept past the call like the row buffers
+    std::vector<uint32_t> columns(rows * cols);
+    columnDistances(matrix, none, columns);
+
+    forEachStripe(rows, cols * sizeof(uint32_t), [&](size_t begin, size_t end) {
+        thread_local std::vector<size_t> sites, starts;
+        thread_local std::vector<uint64_t> squared;
+
+        for (size_t i = begin; i < end; i++) {
+            const auto *source = &columns[i * cols];
+            auto *target = &distances[i * cols];
+
+            if (metric == DistanceEuclidean) {
+                euclideanRow(source, cols, sites, starts, squared);
+
+                for (size_t j = 0; j < cols; j++) {
+                    store(target[j], std::sqrt((double)squared[j]));
+                }
+
+                continue;
+            }
+
+            // Nearest column distance to the left, then to the right
+            uint32_t left = none;
+            for (size_t j = 0; j < cols; j++) {
+                left = std::min(left + 1, source[j]);
+                store(target[j], left);
+            }
+
+            uint32_t right = none;
+            for (size_t j = cols; j-- > 0;) {
+                right = std::min(right + 1, source[j]);
+                if (right < target[j]) {
+                    store(target[j], right);
+                }
+            }
+        }
+    });
+}
+
+void distanceTransform(
+    const BinaryMatrix &matrix,
+    DistanceMetric metric,
+    std::vector<float> &distances
+) {
+    transform(
+        matrix,
+        metric,
+        distances,
+        std::numeric_limits<float>::infinity()
+    );
+}
+
+void distanceTransform(
+    const BinaryMatrix &matrix,
+    DistanceMetric metric,
+    std::vector<uint16_t> &distances
+) {
+    transform(matrix, metric, distances, (uint16_t)UINT16_MAX);
+}
@@ -0,0 +1,287 @@
+#include "exporter.hpp"
+#include "pool.hpp"
+
+#include <cstring>
+#include <functional>
+
+// Output produced per block of rows
+#define EXPORT_BLOCK_BYTES (1024 * 1024)
+
+using Word = BinaryMatrix::Word;
+
+// Characters for every byte of 8 cells, in matrix order (lowest bit first)
+struct CellTable
+{
+    // "01101001"
+    char plain[256][8];
+    // "0,1,1,0,1,0,0,1,"
+    char separated[256][16];
+
+    CellTable() {
+        for (int value = 0; value < 256; value++) {
+            for (int bit = 0; bit < 8; bit++) {
+                const char cell = ((value >> bit) & 1) ? '1' : '0';
+
+                this->plain[value][bit] = cell;
+                this->separated[value][bit * 2] = cell;
+                this->separated[value][bit * 2 + 1] = ',';
+            }
+        }
+    }
+};
+
+static const CellTable &cellTable() {
+    static const CellTable table;
+
+    return table;
+}
+
+// Upper bound of a formatted row length
+static size_t maxRowLength(size_t cols, MatrixFormat format) {
+    return format == MatrixText ? cols + 1 : 2 * cols + 3;
+}
+
+// Opening of a row, before the cells
+static char *startRow(MatrixFormat format, char *out) {
+    if (format == MatrixJSON) {
+        *out++ = '[';
+    }
+
+    return out;
+}
+
+// Ending of a row, `out` points right after the last cell
+static char *finishRow(MatrixFormat format, bool last, char *out) {
+    switch (format) {
+    case MatrixText:
+        *out++ = '\n';
+        break;
+    case MatrixCSV:
+        // Trailing separator becomes the line end
+        out[-1] = '\n';
+        break;
+    case MatrixJSON:
+        out[-1] = ']';
+        if (!last) {
+            *out++ = ',';
+        }
+        *out++ = '\n';
+        break;
+    }
+
+    return out;
+}
+
+// Format one row at `out`, returns the end of the written characters
+static char *formatRow(
+    const Word *words,
+    size_t cols,
+    MatrixFormat format,
+    bool last,
+    char *out
+) {
+    const auto &table = cellTable();
+    const size_t bytes = cols / 8;
+
+    out = startRow(format, out);
+
+    for (size_t k = 0; k < bytes; k++) {
+        const auto byte = uint8_t(words[k / 8] >> (8 * (k % 8)));
+
+        if (format == MatrixText) {
+            memcpy(out, table.plain[byte], 8);
+            out += 8;
+        } else {
+            memcpy(out, table.separated[byte], 16);
+            out += 16;
+        }
+    }
+
+    for (size_t j = bytes * 8; j < cols; j++) {
+        const auto word = words[j / BinaryMatrix::WordBits];
+        *out++ = ((word >> (j % BinaryMatrix::WordBits)) & 1) ? '1' : '0';
+
+        if (format != MatrixText) {
+            *out++ = ',';
+        }
+    }
+
+    return finishRow(format, last, out);
+}
+
+// Same for a sparse row: all zeros first, then the true cells set in place
+static char *formatRow(
+    const uint32_t *begin,
+    const uint32_t *end,
+    size_t cols,
+    MatrixFormat format,
+    bool last,
+    char *out
+) {
+    out = startRow(format, out);
+
+    if (format == MatrixText) {
+        memset(out, '0', cols);
+
+        for (auto *col = begin; col != end; col++) {
+            out[*col] = '1';
+        }
+
+        out += cols;
+    } else {
+        for (size_t j = 0; j < cols; j++) {
+            out[j * 2] = '0';
+            out[j * 2 + 1] = ',';
+        }
+
+        for (auto *col = begin; col != end; col++) {
+            out[*col * 2] = '1';
+        }
+
+        out += cols * 2;
+    }
+
+    return finishRow(format, last, out);
+}
+
+// Writes `rows` rows produced by formatter(row, last, out) in blocks
+static bool exportRows(
+    size_t rows,
+    size_t cols,
+    std::ostream &output,
+    MatrixFormat format,
+    const std::function<char *(size_t, bool, char *)> &formatter
+) {
+    if (format == MatrixJSON) {
+        output << "[\n";
+    }
+
+    if (rows > 0 && cols > 0) {
+        auto &pool = ThreadPool::shared();
+        const auto rowLength = maxRowLength(cols, format);
+        const auto blockRows = std::max(
+            size_t(1),
+            size_t(EXPORT_BLOCK_BYTES) / rowLength
+        );
+        const auto blocks = (rows + blockRows - 1) / blockRows;
+        const auto batch = std::min(blocks, pool.size());
+
+        std::vector<std::vector<char>> buffers(batch);
+        std::vector<size_t> lengths(batch);
+
+        // Format a batch of blocks in parallel, then write them in order
+        for (size_t first = 0; first < blocks; first += batch) {
+            const auto count = std::min(batch, blocks - first);
+
+            pool.parallelFor(count, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                    const auto from = (first + b) * blockRows;
+                    const auto to = std::min(rows, from + blockRows);
+                    auto &buffer = buffers[b];
+
+                    buffer.resize((to - from) * rowLength);
+                    char *out = buffer.data();
+
+                    for (size_t i = from; i < to; i++) {
+                        out = formatter(i, i + 1 == rows, out);
+                    }
+
+                    lengths[b] = out - buffer.data();
+                }
+            });
+
+            for (size_t b = 0; b < count; b++) {
+                output.write(buffers[b].data(), lengths[b]);
+            }
+        }
+    }
+
+    if (format == MatrixJSON) {
+        output << "]\n";
+    }
+
+    return output.good();
+}
+
+bool exportMatrix(
+    const BinaryMatrix &matrix,
+    std::ostream &output,
+    MatrixFormat format
+) {
+    return exportRows(
+        matrix.rows,
+        matrix.cols,
+        output,
+        format,
+        [&](size_t row, bool last, char *out) {
+            return formatRow(matrix.row(row), matrix.cols, format, last, out);
+        }
+    );
+}
+
+bool exportMatrix(
+    const SparseBinaryMatrix &matrix,
+    std::ostream &output,
+    MatrixFormat format
+) {
+    return exportRows(
+        matrix.rows,
+        matrix.cols,
+        output,
+        format,
+        [&](size_t row, bool last, char *out) {
+            return formatRow(
+                matrix.rowBegin(row),
+                matrix.rowEnd(row),
+                matrix.cols,
+                format,
+                last,
+                out
+            );
+        }
+    );
+}
+
+template <typename Matrix>
+static bool exportToFile(
+    const Matrix &matrix,
+    const std::filesystem::path &path,
+    MatrixFormat format
+) {
+    std::ofstream output(path.string(), std::ios::binary);
+    if (!output) {
+        return false;
+    }
+
+    const bool result = exportMatrix(matrix, output, format);
+    output.close();
+
+    return result && output.good();
+}
+
+bool exportMatrix(
+    const BinaryMatrix &matrix,
+    const std::filesystem::path &path,
+    MatrixFormat format
+) {
+    return exportToFile(matrix, path, format);
+}
+
+bool exportMatrix(
+    const SparseBinaryMatrix &matrix,
+    const std::filesystem::path &path,
+    MatrixFormat format
+) {
+    return exportToFile(matrix, path, format);
+}
+
+std::string matrixExtension(MatrixFormat format) {
+    switch (format) {
+    case MatrixCSV:
+        return ".csv";
+    case MatrixJSON:
+        return ".json";
+    default:
+        return ".txt";
+    }
+}
@@ -0,0 +1,1274 @@
+#include "kernels.hpp"
+#include "core.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IBM_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile every level into this one file and only call the
+// functions of the levels the processor supports. MSVC accepts the
+// intrinsics without any attribute.
+#if defined(IBM_X86_64) && !defined(_MSC_VER)
+#define IBM_TARGET(features) __attribute__((target(features)))
+#else
+#define IBM_TARGET(features)
+#endif
+
+#define TARGET_SSE42 IBM_TARGET("sse4.2,popcnt")
+#define TARGET_AVX2 IBM_TARGET("avx2,popcnt")
+#define TARGET_AVX512 IBM_TARGET("avx512f,avx512bw,avx2,popcnt")
+
+#define CPU_LEVEL_VARIABLE "IBM_CPU_LEVEL"
+
+enum WordOp
+{
+    OpAnd,
+    OpOr,
+    OpXor,
+    OpAndNot
+};
+
+template <WordOp Op>
+static inline uint64_t applyWord(uint64_t a, uint64_t b) {
+    switch (Op) {
+    case OpAnd:
+        return a & b;
+    case OpOr:
+        return a | b;
+    case OpXor:
+        return a ^ b;
+    default:
+        return a & ~b;
+    }
+}
+
+// Bits of the tail word past `count` pixels
+static uint64_t packTail(const uint8_t *pixels, size_t count) {
+    uint64_t word = 0;
+
+    for (size_t bit = 0; bit < count; bit++) {
+        word |= uint64_t(pixels[bit] != 0) << bit;
+    }
+
+    return word;
+}
+
+static inline bool inRange(uint8_t value, uint8_t low, uint8_t high) {
+    return value >= low && value <= high;
+}
+
+static void thresholdTail(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *low,
+    const uint8_t *high,
+    bool wrapHue,
+    uint8_t *mask
+) {
+    for (size_t j = 0; j < count; j++, pixels += 3) {
+        const bool hue = wrapHue
+                             ? (pixels[0] >= low[0] || pixels[0] <= high[0])
+                             : inRange(pixels[0], low[0], high[0]);
+
+        mask[j] = hue && inRange(pixels[1], low[1], high[1])
+                          && inRange(pixels[2], low[2], high[2])
+                      ? 255
+                      : 0;
+    }
+}
+
+// Pixels [first, count) of a sweep, from word first / 64 on
+static void sweepTail(
+    const uint8_t *pixels,
+    size_t first,
+    size_t count,
+    const uint8_t *lows,
+    const uint8_t *highs,
+    const uint8_t *wraps,
+    size_t ranges,
+    uint64_t *const *words
+) {
+    for (size_t offset = first; offset < count; offset += 64) {
+        const auto bits = std::min(size_t(64), count - offset);
+
+        for (size_t r = 0; r < ranges; r++) {
+            const auto *low = lows + 3 * r, *high = highs + 3 * r;
+            const auto *pixel = pixels + 3 * offset;
+            uint64_t word = 0;
+
+            for (size_t bit = 0; bit < bits; bit++, pixel += 3) {
+                const bool hue = wraps[r] ? (pixel[0] >= low[0]
+                                             || pixel[0] <= high[0])
+                                          : inRange(pixel[0], low[0], high[0]);
+
+                word |= uint64_t(
+                            hue && inRange(pixel[1], low[1], high[1])
+                            && inRange(pixel[2], low[2], high[2])
+                        )
+                        << bit;
+            }
+
+            words[r][offset / 64] = word;
+        }
+    }
+}
+
+// Scalar level
+
+static size_t countBitsScalar(const uint64_t *words, size_t count) {
+    size_t result = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        result += popcount(words[i]);
+    }
+
+    return result;
+}
+
+template <WordOp Op>
+static size_t countOpScalar(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count
+) {
+    size_t result = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        result += popcount(applyWord<Op>(a[i], b[i]));
+    }
+
+    return result;
+}
+
+static void countAndOrScalar(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count,
+    size_t *counts
+) {
+    size_t both = 0, either = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        both += popcount(a[i] & b[i]);
+        either += popcount(a[i] | b[i]);
+    }
+
+    counts[0] = both;
+    counts[1] = either;
+}
+
+template <WordOp Op>
+static void applyScalar(
+    uint64_t *target,
+    const uint64_t *source,
+    size_t count
+) {
+    for (size_t i = 0; i < count; i++) {
+        target[i] = applyWord<Op>(target[i], source[i]);
+    }
+}
+
+static void invertScalar(uint64_t *words, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        words[i] = ~words[i];
+    }
+}
+
+static void packMaskScalar(
+    const uint8_t *pixels,
+    size_t count,
+    uint64_t *words
+) {
+    for (size_t offset = 0; offset < count; offset += 64) {
+        const auto bits = std::min(size_t(64), count - offset);
+        *words++ = packTail(pixels + offset, bits);
+    }
+}
+
+static void thresholdScalar(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *low,
+    const uint8_t *high,
+    bool wrapHue,
+    uint8_t *mask
+) {
+    thresholdTail(pixels, count, low, high, wrapHue, mask);
+}
+
+static void sweepScalar(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *lows,
+    const uint8_t *highs,
+    const uint8_t *wraps,
+    size_t ranges,
+    uint64_t *const *words
+) {
+    sweepTail(pixels, 0, count, lows, highs, wraps, ranges, words);
+}
+
+// Swap the off-diagonal quarters of every 2j x 2j block for j = 32, 16, ..., 1
+// (Hacker's Delight 7-3, with column 0 in the lowest bit). `from` is the first
+// step done here, the larger ones are done by the vector versions.
+static void transposeSteps(uint64_t *block, size_t from) {
+    uint64_t mask = 0x00000000FFFFFFFFull;
+    size_t j = 32;
+
+    for (; j > from; j >>= 1) {
+        mask ^= mask << (j >> 1);
+    }
+
+    for (; j != 0; j >>= 1, mask ^= mask << j) {
+        for (size_t k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            const auto t = ((block[k] >> j) ^ block[k | j]) & mask;
+
+            block[k | j] ^= t;
+            block[k] ^= t << j;
+        }
+    }
+}
+
+static void transposeScalar(uint64_t *block) {
+    transposeSteps(block, 32);
+}
+
+static const Kernels ScalarKernels = {
+    CpuScalar,
+    countBitsScalar,
+    countOpScalar<OpAnd>,
+    countOpScalar<OpOr>,
+    countOpScalar<OpXor>,
+    countOpScalar<OpAndNot>,
+    countAndOrScalar,
+    applyScalar<OpAnd>,
+    applyScalar<OpOr>,
+    applyScalar<OpXor>,
+    applyScalar<OpAndNot>,
+    invertScalar,
+    packMaskScalar,
+    thresholdScalar,
+    sweepScalar,
+    transposeScalar
+};
+
+#ifdef IBM_X86_64
+
+// SSE4.2 level
+
+template <WordOp Op>
+TARGET_SSE42 static inline __m128i apply128(__m128i a, __m128i b) {
+    switch (Op) {
+    case OpAnd:
+        return _mm_and_si128(a, b);
+    case OpOr:
+        return _mm_or_si128(a, b);
+    case OpXor:
+        return _mm_xor_si128(a, b);
+    default:
+        return _mm_andnot_si128(b, a);
+    }
+}
+
+TARGET_SSE42 static size_t countBitsSSE42(const uint64_t *words, size_t count) {
+    // Independent counters hide the popcnt latency
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        c0 += _mm_popcnt_u64(words[i]);
+        c1 += _mm_popcnt_u64(words[i + 1]);
+        c2 += _mm_popcnt_u64(words[i + 2]);
+        c3 += _mm_popcnt_u64(words[i + 3]);
+    }
+    for (; i < count; i++) {
+        c0 += _mm_popcnt_u64(words[i]);
+    }
+
+    return c0 + c1 + c2 + c3;
+}
+
+template <WordOp Op>
+TARGET_SSE42 static size_t countOpSSE42(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count
+) {
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        c0 += _mm_popcnt_u64(applyWord<Op>(a[i], b[i]));
+        c1 += _mm_popcnt_u64(applyWord<Op>(a[i + 1], b[i + 1]));
+        c2 += _mm_popcnt_u64(applyWord<Op>(a[i + 2], b[i + 2]));
+        c3 += _mm_popcnt_u64(applyWord<Op>(a[i + 3], b[i + 3]));
+    }
+    for (; i < count; i++) {
+        c0 += _mm_popcnt_u64(applyWord<Op>(a[i], b[i]));
+    }
+
+    return c0 + c1 + c2 + c3;
+}
+
+TARGET_SSE42 static void countAndOrSSE42(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count,
+    size_t *counts
+) {
+    uint64_t both0 = 0, both1 = 0, either0 = 0, either1 = 0;
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        both0 += _mm_popcnt_u64(a[i] & b[i]);
+        either0 += _mm_popcnt_u64(a[i] | b[i]);
+        both1 += _mm_popcnt_u64(a[i + 1] & b[i + 1]);
+        either1 += _mm_popcnt_u64(a[i + 1] | b[i + 1]);
+    }
+    for (; i < count; i++) {
+        both0 += _mm_popcnt_u64(a[i] & b[i]);
+        either0 += _mm_popcnt_u64(a[i] | b[i]);
+    }
+
+    counts[0] = both0 + both1;
+    counts[1] = either0 + either1;
+}
+
+template <WordOp Op>
+TARGET_SSE42 static void applySSE42(
+    uint64_t *target,
+    const uint64_t *source,
+    size_t count
+) {
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        const auto a = _mm_loadu_si128((const __m128i *)(target + i));
+        const auto b = _mm_loadu_si128((const __m128i *)(source + i));
+
+        _mm_storeu_si128((__m128i *)(target + i), apply128<Op>(a, b));
+    }
+    for (; i < count; i++) {
+        target[i] = applyWord<Op>(target[i], source[i]);
+    }
+}
+
+TARGET_SSE42 static void invertSSE42(uint64_t *words, size_t count) {
+    const auto ones = _mm_set1_epi32(-1);
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        const auto a = _mm_loadu_si128((const __m128i *)(words + i));
+        _mm_storeu_si128((__m128i *)(words + i), _mm_xor_si128(a, ones));
+    }
+    for (; i < count; i++) {
+        words[i] = ~words[i];
+    }
+}
+
+TARGET_SSE42 static void packMaskSSE42(
+    const uint8_t *pixels,
+    size_t count,
+    uint64_t *words
+) {
+    const auto zero = _mm_setzero_si128();
+    size_t offset = 0;
+
+    for (; offset + 64 <= count; offset += 64) {
+        uint64_t word = 0;
+
+        for (size_t k = 0; k < 4; k++) {
+            const auto v
+                = _mm_loadu_si128((const __m128i *)(pixels + offset + k * 16));
+            const auto zeros
+                = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+
+            word |= uint64_t(~zeros & 0xFFFF) << (k * 16);
+        }
+
+        *words++ = word;
+    }
+
+    if (offset < count) {
+        *words = packTail(pixels + offset, count - offset);
+    }
+}
+
+// pshufb masks gathering channel c of 16 pixels from the k-th 16 bytes
+struct ChannelShuffles
+{
+    uint8_t masks[3][3][16];
+
+    ChannelShuffles() {
+        for (size_t c = 0; c < 3; c++) {
+            for (size_t k = 0; k < 3; k++) {
+                for (size_t p = 0; p < 16; p++) {
+                    const auto index = 3 * p + c;
+                    this->masks[c][k][p]
+                        = index / 16 == k ? uint8_t(index % 16) : 0x80;
+                }
+            }
+        }
+    }
+};
+
+static const ChannelShuffles Shuffles;
+
+// The bounds repeated along 16 bytes of pixels starting at channel `first`
+static void repeatBounds(const uint8_t *bounds, size_t first, uint8_t *out) {
+    for (size_t p = 0; p < 16; p++) {
+        out[p] = bounds[(first + p) % 3];
+    }
+}
+
+TARGET_SSE42 static void thresholdSSE42(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *low,
+    const uint8_t *high,
+    bool wrapHue,
+    uint8_t *mask
+) {
+    // Bytes 16 * k start at channel (16 * k) % 3
+    const uint8_t wrap[3] = {uint8_t(wrapHue ? 0xFF : 0), 0, 0};
+    __m128i lows[3], highs[3], wraps[3], shuffles[3][3];
+
+    for (size_t k = 0; k < 3; k++) {
+        uint8_t bytes[16];
+        const auto first = (16 * k) % 3;
+
+        repeatBounds(low, first, bytes);
+        lows[k] = _mm_loadu_si128((const __m128i *)bytes);
+        repeatBounds(high, first, bytes);
+        highs[k] = _mm_loadu_si128((const __m128i *)bytes);
+        repeatBounds(wrap, first, bytes);
+        wraps[k] = _mm_loadu_si128((const __m128i *)bytes);
+
+        for (size_t c = 0; c < 3; c++) {
+            shuffles[c][k]
+                = _mm_loadu_si128((const __m128i *)Shuffles.masks[c][k]);
+        }
+    }
+
+    size_t j = 0;
+    for (; j + 16 <= count; j += 16) {
+        __m128i pass[3];
+
+        for (size_t k = 0; k < 3; k++) {
+            const auto v
+                = _mm_loadu_si128((const __m128i *)(pixels + 3 * j + 16 * k));
+            const auto ge = _mm_cmpeq_epi8(_mm_max_epu8(v, lows[k]), v);
+            const auto le = _mm_cmpeq_epi8(_mm_min_epu8(v, highs[k]), v);
+
+            // Wrapping hue bytes pass on either bound
+            pass[k] = _mm_or_si128(
+                _mm_and_si128(ge, le),
+                _mm_and_si128(wraps[k], _mm_or_si128(ge, le))
+            );
+        }
+
+        auto result = _mm_set1_epi32(-1);
+        for (size_t c = 0; c < 3; c++) {
+            const auto channel = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_shuffle_epi8(pass[0], shuffles[c][0]),
+                    _mm_shuffle_epi8(pass[1], shuffles[c][1])
+                ),
+                _mm_shuffle_epi8(pass[2], shuffles[c][2])
+            );
+
+            result = _mm_and_si128(result, channel);
+        }
+
+        _mm_storeu_si128((__m128i *)(mask + j), result);
+    }
+
+    thresholdTail(pixels + 3 * j, count - j, low, high, wrapHue, mask + j);
+}
+
+// Channels of the 16 pixels in the 48 bytes at `pixels`
+TARGET_SSE42 static inline void deinterleave16(
+    const uint8_t *pixels,
+    const __m128i (*shuffles)[3],
+    __m128i *channels
+) {
+    const auto a = _mm_loadu_si128((const __m128i *)pixels);
+    const auto b = _mm_loadu_si128((const __m128i *)(pixels + 16));
+    const auto c = _mm_loadu_si128((const __m128i *)(pixels + 32));
+
+    for (size_t k = 0; k < 3; k++) {
+        channels[k] = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(a, shuffles[k][0]),
+                _mm_shuffle_epi8(b, shuffles[k][1])
+            ),
+            _mm_shuffle_epi8(c, shuffles[k][2])
+        );
+    }
+}
+
+TARGET_SSE42 static inline void loadShuffles(__m128i (*shuffles)[3]) {
+    for (size_t c = 0; c < 3; c++) {
+        for (size_t k = 0; k < 3; k++) {
+            shuffles[c][k]
+                = _mm_loadu_si128((const __m128i *)Shuffles.masks[c][k]);
+        }
+    }
+}
+
+// 0xFF bytes of `v` within [low, high], or outside (high, low) with `wrap`
+TARGET_SSE42 static inline __m128i inRange128(
+    __m128i v,
+    uint8_t low,
+    uint8_t high,
+    bool wrap
+) {
+    const auto ge
+        = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8((char)low)), v);
+    const auto le
+        = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8((char)high)), v);
+
+    return wrap ? _mm_or_si128(ge, le) : _mm_and_si128(ge, le);
+}
+
+TARGET_SSE42 static void sweepSSE42(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *lows,
+    const uint8_t *highs,
+    const uint8_t *wraps,
+    size_t ranges,
+    uint64_t *const *words
+) {
+    __m128i shuffles[3][3];
+    loadShuffles(shuffles);
+
+    size_t j = 0;
+    for (; j + 64 <= count; j += 64) {
+        __m128i channels[4][3];
+        for (size_t k = 0; k < 4; k++) {
+            deinterleave16(pixels + 3 * (j + 16 * k), shuffles, channels[k]);
+        }
+
+        for (size_t r = 0; r < ranges; r++) {
+            const auto *low = lows + 3 * r, *high = highs + 3 * r;
+            uint64_t word = 0;
+
+            for (size_t k = 0; k < 4; k++) {
+                const auto pass = _mm_and_si128(
+                    inRange128(channels[k][0], low[0], high[0], wraps[r]),
+                    _mm_and_si128(
+                        inRange128(channels[k][1], low[1], high[1], false),
+                        inRange128(channels[k][2], low[2], high[2], false)
+                    )
+                );
+
+                word |= uint64_t((uint32_t)_mm_movemask_epi8(pass))
+                        << (16 * k);
+            }
+
+            words[r][j / 64] = word;
+        }
+    }
+
+    sweepTail(pixels, j, count, lows, highs, wraps, ranges, words);
+}
+
+TARGET_SSE42 static void transposeSSE42(uint64_t *block) {
+    uint64_t mask = 0x00000000FFFFFFFFull;
+
+    for (size_t j = 32; j >= 2; j >>= 1, mask ^= mask << j) {
+        const auto m = _mm_set1_epi64x((long long)mask);
+        const auto shift = _mm_cvtsi32_si128((int)j);
+
+        for (size_t base = 0; base < 64; base += 2 * j) {
+            for (size_t k = base; k < base + j; k += 2) {
+                auto *upper = (__m128i *)(block + k);
+                auto *lower = (__m128i *)(block + k + j);
+                const auto a = _mm_loadu_si128(upper);
+                const auto b = _mm_loadu_si128(lower);
+                const auto t = _mm_and_si128(
+                    _mm_xor_si128(_mm_srl_epi64(a, shift), b),
+                    m
+                );
+
+                _mm_storeu_si128(lower, _mm_xor_si128(b, t));
+                _mm_storeu_si128(
+                    upper,
+                    _mm_xor_si128(a, _mm_sll_epi64(t, shift))
+                );
+            }
+        }
+    }
+
+    transposeSteps(block, 1);
+}
+
+static const Kernels SSE42Kernels = {
+    CpuSSE42,
+    countBitsSSE42,
+    countOpSSE42<OpAnd>,
+    countOpSSE42<OpOr>,
+    countOpSSE42<OpXor>,
+    countOpSSE42<OpAndNot>,
+    countAndOrSSE42,
+    applySSE42<OpAnd>,
+    applySSE42<OpOr>,
+    applySSE42<OpXor>,
+    applySSE42<OpAndNot>,
+    invertSSE42,
+    packMaskSSE42,
+    thresholdSSE42,
+    sweepSSE42,
+    transposeSSE42
+};
+
+// AVX2 level
+
+template <WordOp Op>
+TARGET_AVX2 static inline __m256i apply256(__m256i a, __m256i b) {
+    switch (Op) {
+    case OpAnd:
+        return _mm256_and_si256(a, b);
+    case OpOr:
+        return _mm256_or_si256(a, b);
+    case OpXor:
+        return _mm256_xor_si256(a, b);
+    default:
+        return _mm256_andnot_si256(b, a);
+    }
+}
+
+// Per 64-bit lane bit counts from nibble lookups (Mula et al.)
+TARGET_AVX2 static inline __m256i popcount256(__m256i v) {
+    const auto table = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+    );
+    const auto nibble = _mm256_set1_epi8(0x0F);
+    const auto low = _mm256_and_si256(v, nibble);
+    const auto high = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    const auto counts = _mm256_add_epi8(
+        _mm256_shuffle_epi8(table, low),
+        _mm256_shuffle_epi8(table, high)
+    );
+
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+TARGET_AVX2 static inline uint64_t sum256(__m256i v) {
+    return uint64_t(_mm256_extract_epi64(v, 0))
+           + uint64_t(_mm256_extract_epi64(v, 1))
+           + uint64_t(_mm256_extract_epi64(v, 2))
+           + uint64_t(_mm256_extract_epi64(v, 3));
+}
+
+TARGET_AVX2 static size_t countBitsAVX2(const uint64_t *words, size_t count) {
+    auto total = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        const auto v = _mm256_loadu_si256((const __m256i *)(words + i));
+        total = _mm256_add_epi64(total, popcount256(v));
+    }
+
+    uint64_t result = sum256(total);
+    for (; i < count; i++) {
+        result += _mm_popcnt_u64(words[i]);
+    }
+
+    return result;
+}
+
+template <WordOp Op>
+TARGET_AVX2 static size_t countOpAVX2(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count
+) {
+    auto total = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        const auto x = _mm256_loadu_si256((const __m256i *)(a + i));
+        const auto y = _mm256_loadu_si256((const __m256i *)(b + i));
+
+        total = _mm256_add_epi64(total, popcount256(apply256<Op>(x, y)));
+    }
+
+    uint64_t result = sum256(total);
+    for (; i < count; i++) {
+        result += _mm_popcnt_u64(applyWord<Op>(a[i], b[i]));
+    }
+
+    return result;
+}
+
+TARGET_AVX2 static void countAndOrAVX2(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count,
+    size_t *counts
+) {
+    auto both = _mm256_setzero_si256(), either = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        const auto x = _mm256_loadu_si256((const __m256i *)(a + i));
+        const auto y = _mm256_loadu_si256((const __m256i *)(b + i));
+
+        both = _mm256_add_epi64(both, popcount256(_mm256_and_si256(x, y)));
+        either = _mm256_add_epi64(either, popcount256(_mm256_or_si256(x, y)));
+    }
+
+    counts[0] = sum256(both);
+    counts[1] = sum256(either);
+    for (; i < count; i++) {
+        counts[0] += _mm_popcnt_u64(a[i] & b[i]);
+        counts[1] += _mm_popcnt_u64(a[i] | b[i]);
+    }
+}
+
+template <WordOp Op>
+TARGET_AVX2 static void applyAVX2(
+    uint64_t *target,
+    const uint64_t *source,
+    size_t count
+) {
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        const auto a = _mm256_loadu_si256((const __m256i *)(target + i));
+        const auto b = _mm256_loadu_si256((const __m256i *)(source + i));
+
+        _mm256_storeu_si256((__m256i *)(target + i), apply256<Op>(a, b));
+    }
+    for (; i < count; i++) {
+        target[i] = applyWord<Op>(target[i], source[i]);
+    }
+}
+
+TARGET_AVX2 static void invertAVX2(uint64_t *words, size_t count) {
+    const auto ones = _mm256_set1_epi32(-1);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        const auto a = _mm256_loadu_si256((const __m256i *)(words + i));
+        _mm256_storeu_si256((__m256i *)(words + i), _mm256_xor_si256(a, ones));
+    }
+    for (; i < count; i++) {
+        words[i] = ~words[i];
+    }
+}
+
+TARGET_AVX2 static void packMaskAVX2(
+    const uint8_t *pixels,
+    size_t count,
+    uint64_t *words
+) {
+    const auto zero = _mm256_setzero_si256();
+    size_t offset = 0;
+
+    for (; offset + 64 <= count; offset += 64) {
+        const auto *p = pixels + offset;
+        const auto low = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)p),
+            zero
+        ));
+        const auto high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(p + 32)),
+            zero
+        ));
+
+        *words++ = ~(uint64_t(high) << 32 | low);
+    }
+
+    if (offset < count) {
+        *words = packTail(pixels + offset, count - offset);
+    }
+}
+
+TARGET_AVX2 static void transposeAVX2(uint64_t *block) {
+    uint64_t mask = 0x00000000FFFFFFFFull;
+
+    for (size_t j = 32; j >= 4; j >>= 1, mask ^= mask << j) {
+        const auto m = _mm256_set1_epi64x((long long)mask);
+        const auto shift = _mm_cvtsi32_si128((int)j);
+
+        for (size_t base = 0; base < 64; base += 2 * j) {
+            for (size_t k = base; k < base + j; k += 4) {
+                auto *upper = (__m256i *)(block + k);
+                auto *lower = (__m256i *)(block + k + j);
+                const auto a = _mm256_loadu_si256(upper);
+                const auto b = _mm256_loadu_si256(lower);
+                const auto t = _mm256_and_si256(
+                    _mm256_xor_si256(_mm256_srl_epi64(a, shift), b),
+                    m
+                );
+
+                _mm256_storeu_si256(lower, _mm256_xor_si256(b, t));
+                _mm256_storeu_si256(
+                    upper,
+                    _mm256_xor_si256(a, _mm256_sll_epi64(t, shift))
+                );
+            }
+        }
+    }
+
+    transposeSteps(block, 2);
+}
+
+TARGET_AVX2 static inline __m256i inRange256(
+    __m256i v,
+    uint8_t low,
+    uint8_t high,
+    bool wrap
+) {
+    const auto ge = _mm256_cmpeq_epi8(
+        _mm256_max_epu8(v, _mm256_set1_epi8((char)low)),
+        v
+    );
+    const auto le = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(v, _mm256_set1_epi8((char)high)),
+        v
+    );
+
+    return wrap ? _mm256_or_si256(ge, le) : _mm256_and_si256(ge, le);
+}
+
+// Pixels are split into channels 16 at a time as in SSE4.2, then the ranges
+// are evaluated 32 pixels at a time
+TARGET_AVX2 static void sweepAVX2(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *lows,
+    const uint8_t *highs,
+    const uint8_t *wraps,
+    size_t ranges,
+    uint64_t *const *words
+) {
+    __m128i shuffles[3][3];
+    loadShuffles(shuffles);
+
+    size_t j = 0;
+    for (; j + 64 <= count; j += 64) {
+        __m128i quarters[4][3];
+        for (size_t k = 0; k < 4; k++) {
+            deinterleave16(pixels + 3 * (j + 16 * k), shuffles, quarters[k]);
+        }
+
+        __m256i channels[2][3];
+        for (size_t h = 0; h < 2; h++) {
+            for (size_t c = 0; c < 3; c++) {
+                channels[h][c] = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(quarters[2 * h][c]),
+                    quarters[2 * h + 1][c],
+                    1
+                );
+            }
+        }
+
+        for (size_t r = 0; r < ranges; r++) {
+            const auto *low = lows + 3 * r, *high = highs + 3 * r;
+            uint64_t word = 0;
+
+            for (size_t h = 0; h < 2; h++) {
+                const auto pass = _mm256_and_si256(
+                    inRange256(channels[h][0], low[0], high[0], wraps[r]),
+                    _mm256_and_si256(
+                        inRange256(channels[h][1], low[1], high[1], false),
+                        inRange256(channels[h][2], low[2], high[2], false)
+                    )
+                );
+
+                word |= uint64_t((uint32_t)_mm256_movemask_epi8(pass))
+                        << (32 * h);
+            }
+
+            words[r][j / 64] = word;
+        }
+    }
+
+    sweepTail(pixels, j, count, lows, highs, wraps, ranges, words);
+}
+
+// The 3-channel threshold gains nothing from wider registers: pshufb does
+// not cross 128-bit lanes, so the SSE4.2 kernel is used by the levels above
+static const Kernels AVX2Kernels = {
+    CpuAVX2,
+    countBitsAVX2,
+    countOpAVX2<OpAnd>,
+    countOpAVX2<OpOr>,
+    countOpAVX2<OpXor>,
+    countOpAVX2<OpAndNot>,
+    countAndOrAVX2,
+    applyAVX2<OpAnd>,
+    applyAVX2<OpOr>,
+    applyAVX2<OpXor>,
+    applyAVX2<OpAndNot>,
+    invertAVX2,
+    packMaskAVX2,
+    thresholdSSE42,
+    sweepAVX2,
+    transposeAVX2
+};
+
+// AVX-512 level
+
+template <WordOp Op>
+TARGET_AVX512 static inline __m512i apply512(__m512i a, __m512i b) {
+    switch (Op) {
+    case OpAnd:
+        return _mm512_and_si512(a, b);
+    case OpOr:
+        return _mm512_or_si512(a, b);
+    case OpXor:
+        return _mm512_xor_si512(a, b);
+    default:
+        return _mm512_andnot_si512(b, a);
+    }
+}
+
+TARGET_AVX512 static inline __m512i popcount512(__m512i v) {
+    const auto table = _mm512_set4_epi32(
+        0x04030302,
+        0x03020201,
+        0x03020201,
+        0x02010100
+    );
+    const auto nibble = _mm512_set1_epi8(0x0F);
+    const auto low = _mm512_and_si512(v, nibble);
+    const auto high = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+    const auto counts = _mm512_add_epi8(
+        _mm512_shuffle_epi8(table, low),
+        _mm512_shuffle_epi8(table, high)
+    );
+
+    return _mm512_sad_epu8(counts, _mm512_setzero_si512());
+}
+
+TARGET_AVX512 static size_t countBitsAVX512(
+    const uint64_t *words,
+    size_t count
+) {
+    auto total = _mm512_setzero_si512();
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const auto v = _mm512_loadu_si512((const void *)(words + i));
+        total = _mm512_add_epi64(total, popcount512(v));
+    }
+
+    uint64_t result = (uint64_t)_mm512_reduce_add_epi64(total);
+    for (; i < count; i++) {
+        result += _mm_popcnt_u64(words[i]);
+    }
+
+    return result;
+}
+
+template <WordOp Op>
+TARGET_AVX512 static size_t countOpAVX512(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count
+) {
+    auto total = _mm512_setzero_si512();
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const auto x = _mm512_loadu_si512((const void *)(a + i));
+        const auto y = _mm512_loadu_si512((const void *)(b + i));
+
+        total = _mm512_add_epi64(total, popcount512(apply512<Op>(x, y)));
+    }
+
+    uint64_t result = (uint64_t)_mm512_reduce_add_epi64(total);
+    for (; i < count; i++) {
+        result += _mm_popcnt_u64(applyWord<Op>(a[i], b[i]));
+    }
+
+    return result;
+}
+
+TARGET_AVX512 static void countAndOrAVX512(
+    const uint64_t *a,
+    const uint64_t *b,
+    size_t count,
+    size_t *counts
+) {
+    auto both = _mm512_setzero_si512(), either = _mm512_setzero_si512();
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const auto x = _mm512_loadu_si512((const void *)(a + i));
+        const auto y = _mm512_loadu_si512((const void *)(b + i));
+
+        both = _mm512_add_epi64(both, popcount512(_mm512_and_si512(x, y)));
+        either = _mm512_add_epi64(either, popcount512(_mm512_or_si512(x, y)));
+    }
+
+    counts[0] = (uint64_t)_mm512_reduce_add_epi64(both);
+    counts[1] = (uint64_t)_mm512_reduce_add_epi64(either);
+    for (; i < count; i++) {
+        counts[0] += _mm_popcnt_u64(a[i] & b[i]);
+        counts[1] += _mm_popcnt_u64(a[i] | b[i]);
+    }
+}
+
+template <WordOp Op>
+TARGET_AVX512 static void applyAVX512(
+    uint64_t *target,
+    const uint64_t *source,
+    size_t count
+) {
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const auto a = _mm512_loadu_si512((const void *)(target + i));
+        const auto b = _mm512_loadu_si512((const void *)(source + i));
+
+        _mm512_storeu_si512((void *)(target + i), apply512<Op>(a, b));
+    }
+    for (; i < count; i++) {
+        target[i] = applyWord<Op>(target[i], source[i]);
+    }
+}
+
+TARGET_AVX512 static void invertAVX512(uint64_t *words, size_t count) {
+    const auto ones = _mm512_set1_epi32(-1);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const auto a = _mm512_loadu_si512((const void *)(words + i));
+        _mm512_storeu_si512((void *)(words + i), _mm512_xor_si512(a, ones));
+    }
+    for (; i < count; i++) {
+        words[i] = ~words[i];
+    }
+}
+
+TARGET_AVX512 static void packMaskAVX512(
+    const uint8_t *pixels,
+    size_t count,
+    uint64_t *words
+) {
+    size_t offset = 0;
+
+    for (; offset + 64 <= count; offset += 64) {
+        const auto v = _mm512_loadu_si512((const void *)(pixels + offset));
+        *words++ = (uint64_t)_mm512_test_epi8_mask(v, v);
+    }
+
+    if (offset < count) {
+        *words = packTail(pixels + offset, count - offset);
+    }
+}
+
+// Bits of the bytes of `v` within [low, high], or outside (high, low) with
+// `wrap`, compared straight into a mask register
+TARGET_AVX512 static inline uint64_t inRange512(
+    __m512i v,
+    uint8_t low,
+    uint8_t high,
+    bool wrap
+) {
+    const auto ge = _mm512_cmpge_epu8_mask(v, _mm512_set1_epi8((char)low));
+    const auto le = _mm512_cmple_epu8_mask(v, _mm512_set1_epi8((char)high));
+
+    return wrap ? (uint64_t)(ge | le) : (uint64_t)(ge & le);
+}
+
+TARGET_AVX512 static void sweepAVX512(
+    const uint8_t *pixels,
+    size_t count,
+    const uint8_t *lows,
+    const uint8_t *highs,
+    const uint8_t *wraps,
+    size_t ranges,
+    uint64_t *const *words
+) {
+    __m128i shuffles[3][3];
+    loadShuffles(shuffles);
+
+    size_t j = 0;
+    for (; j + 64 <= count; j += 64) {
+        __m128i quarters[4][3];
+        for (size_t k = 0; k < 4; k++) {
+            deinterleave16(pixels + 3 * (j + 16 * k), shuffles, quarters[k]);
+        }
+
+        __m512i channels[3];
+        for (size_t c = 0; c < 3; c++) {
+            auto v = _mm512_castsi128_si512(quarters[0][c]);
+            v = _mm512_inserti32x4(v, quarters[1][c], 1);
+            v = _mm512_inserti32x4(v, quarters[2][c], 2);
+            channels[c] = _mm512_inserti32x4(v, quarters[3][c], 3);
+        }
+
+        for (size_t r = 0; r < ranges; r++) {
+            const auto *low = lows + 3 * r, *high = highs + 3 * r;
+
+            words[r][j / 64]
+                = inRange512(channels[0], low[0], high[0], wraps[r])
+                  & inRange512(channels[1], low[1], high[1], false)
+                  & inRange512(channels[2], low[2], high[2], false);
+        }
+    }
+
+    sweepTail(pixels, j, count, lows, highs, wraps, ranges, words);
+}
+
+TARGET_AVX512 static void transposeAVX512(uint64_t *block) {
+    uint64_t mask = 0x00000000FFFFFFFFull;
+
+    for (size_t j = 32; j >= 8; j >>= 1, mask ^= mask << j) {
+        const auto m = _mm512_set1_epi64((long long)mask);
+        const auto shift = _mm_cvtsi32_si128((int)j);
+
+        for (size_t base = 0; base < 64; base += 2 * j) {
+            for (size_t k = base; k < base + j; k += 8) {
+                auto *upper = (void *)(block + k);
+                auto *lower = (void *)(block + k + j);
+                const auto a = _mm512_loadu_si512(upper);
+                const auto b = _mm512_loadu_si512(lower);
+                const auto t = _mm512_and_si512(
+                    _mm512_xor_si512(_mm512_srl_epi64(a, shift), b),
+                    m
+                );
+
+                _mm512_storeu_si512(lower, _mm512_xor_si512(b, t));
+                _mm512_storeu_si512(
+                    upper,
+                    _mm512_xor_si512(a, _mm512_sll_epi64(t, shift))
+                );
+            }
+        }
+    }
+
+    transposeSteps(block, 4);
+}
+
+static const Kernels AVX512Kernels = {
+    CpuAVX512,
+    countBitsAVX512,
+    countOpAVX512<OpAnd>,
+    countOpAVX512<OpOr>,
+    countOpAVX512<OpXor>,
+    countOpAVX512<OpAndNot>,
+    countAndOrAVX512,
+    applyAVX512<OpAnd>,
+    applyAVX512<OpOr>,
+    applyAVX512<OpXor>,
+    applyAVX512<OpAndNot>,
+    invertAVX512,
+    packMaskAVX512,
+    thresholdSSE42,
+    sweepAVX512,
+    transposeAVX512
+};
+
+#endif
+
+CpuLevel detectCpuLevel() {
+#if defined(IBM_X86_64) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+
+    const bool sse42 = (info[2] & (1 << 20)) && (info[2] & (1 << 23));
+    const bool osxsave = info[2] & (1 << 27);
+    if (!sse42) {
+        return CpuScalar;
+    }
+    if (!osxsave) {
+        return CpuSSE42;
+    }
+
+    // The OS must save the YMM (and for AVX-512 the ZMM and mask) registers
+    const auto xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+
+    const bool avx2 = (info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+    const bool avx512 = (info[1] & (1 << 16)) && (info[1] & (1 << 30))
+                        && (xcr0 & 0xE6) == 0xE6;
+
+    return avx512 ? CpuAVX512 : avx2 ? CpuAVX2 : CpuSSE42;
+#elif defined(IBM_X86_64)
+    // Also checks that the OS saves the extended registers
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx2")) {
+        return CpuAVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return CpuAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return CpuSSE42;
+    }
+
+    return CpuScalar;
+#else
+    return CpuScalar;
+#endif
+}
+
+CpuLevel selectCpuLevel() {
+    const auto detected = detectCpuLevel();
+    const char *value = std::getenv(CPU_LEVEL_VARIABLE);
+    if (value == nullptr) {
+        return detected;
+    }
+
+    for (int level = CpuScalar; level <= CpuAVX512; level++) {
+        if (strcmp(value, cpuLevelName((CpuLevel)level)) == 0) {
+            return std::min(detected, (CpuLevel)level);
+        }
+    }
+
+    return detected;
+}
+
+const char *cpuLevelName(CpuLevel level) {
+    switch (level) {
+    case CpuSSE42:
+        return "sse4.2";
+    case CpuAVX2:
+        return "avx2";
+    case CpuAVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+const Kernels &kernelsFor(CpuLevel level) {
+#ifdef IBM_X86_64
+    switch (level) {
+    case CpuSSE42:
+        return SSE42Kernels;
+    case CpuAVX2:
+        return AVX2Kernels;
+    case CpuAVX512:
+        return AVX512Kernels;
+    default:
+        break;
+    }
+#endif
+
+    return ScalarKernels;
+}
+
+const Kernels &kernels() {
+    static const Kernels &selected = kernelsFor(selectCpuLevel());
+
+    return selected;
+}
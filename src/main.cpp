@@ -1,4 +1,5 @@
 #include "app.hpp"
+#include "cli.hpp"
 
 namespace fs = std::filesystem;
 
@@ -18,5 +19,9 @@ static bool appStart(int argc, char const *argv[]) {
 }
 
 int main(int argc, char const *argv[]) {
+    if (isCliMode(argc, argv)) {
+        return cliStart(argc, argv);
+    }
+
     return (int)(!appStart(argc, argv));
 }
@@ -0,0 +1,296 @@
+#include "morphology.hpp"
+#include "pool.hpp"
+
+using Word = BinaryMatrix::Word;
+
+static const size_t WordBits = BinaryMatrix::WordBits;
+
+// Dilation accumulates with OR, cells outside of the matrix are false
+struct DilateOp
+{
+    static const bool Fill = false;
+
+    static Word apply(Word a, Word b) {
+        return a | b;
+    }
+};
+
+// Erosion accumulates with AND, cells outside of the matrix are true
+struct ErodeOp
+{
+    static const bool Fill = true;
+
+    static Word apply(Word a, Word b) {
+        return a & b;
+    }
+};
+
+StructuringElement::StructuringElement(Shape shape, size_t width, size_t height)
+    : shape(shape), width(width), height(height) {
+}
+
+StructuringElement::StructuringElement(Shape shape, size_t size)
+    : StructuringElement(shape, size, size) {
+}
+
+bool StructuringElement::isEmpty() const {
+    return !this->width || !this->height;
+}
+
+size_t StructuringElement::anchorX() const {
+    return this->width / 2;
+}
+
+size_t StructuringElement::anchorY() const {
+    return this->height / 2;
+}
+
+// dst[c] = src[c + offset] for every cell of the row,
+// cells coming from outside of the row words are false
+static void shiftRow(
+    const Word *src,
+    Word *dst,
+    size_t stride,
+    ptrdiff_t offset
+) {
+    const size_t shift = offset < 0 ? size_t(-offset) : size_t(offset);
+    const size_t words = shift / WordBits, bits = shift % WordBits;
+
+    for (size_t w = 0; w < stride; w++) {
+        Word value = 0;
+
+        if (offset >= 0) {
+            const size_t from = w + words;
+
+            if (from < stride) {
+                value = src[from] >> bits;
+
+                if (bits != 0 && from + 1 < stride) {
+                    value |= src[from + 1] << (WordBits - bits);
+                }
+            }
+        } else if (w >= words) {
+            const size_t from = w - words;
+            value = src[from] << bits;
+
+            if (bits != 0 && from > 0) {
+                value |= src[from - 1] >> (WordBits - bits);
+            }
+        }
+
+        dst[w] = value;
+    }
+}
+
+// Set cells [from, to) of the row
+static void fillRow(Word *row, size_t from, size_t to) {
+    while (from < to) {
+        const size_t bit = from % WordBits;
+        const size_t count = std::min(WordBits - bit, to - from);
+        const Word mask
+            = count == WordBits ? ~Word(0) : ((Word(1) << count) - 1) << bit;
+
+        row[from / WordBits] |= mask;
+        from += count;
+    }
+}
+
+// row[c] = Op over row[c + d] for d in [0, length) when going forward,
+// or for d in (-length, 0] when going backward. The covered span doubles on
+// every step, so a window of N cells costs log2(N) shifts.
+template <typename Op>
+static void accumulateRow(
+    Word *row,
+    Word *temp,
+    size_t stride,
+    size_t cols,
+    size_t length,
+    bool forward
+) {
+    for (size_t covered = 1; covered < length;) {
+        const size_t step = std::min(covered, length - covered);
+        const auto offset = forward ? ptrdiff_t(step) : -ptrdiff_t(step);
+
+        shiftRow(row, temp, stride, offset);
+        if (Op::Fill) {
+            if (forward) {
+                fillRow(temp, cols > step ? cols - step : 0, cols);
+            } else {
+                fillRow(temp, 0, std::min(step, cols));
+            }
+        }
+
+        for (size_t w = 0; w < stride; w++) {
+            row[w] = Op::apply(row[w], temp[w]);
+        }
+
+        covered += step;
+    }
+}
+
+// Same as accumulateRow, but across whole rows of the matrix
+template <typename Op>
+static void accumulateRows(BinaryMatrix &matrix, size_t length, bool forward) {
+    const auto rows = matrix.rows, stride = matrix.stride;
+
+    for (size_t covered = 1; covered < length;) {
+        const size_t step = std::min(covered, length - covered);
+
+        // Rows out of the matrix leave the value as is, so only the
+        // overlapping part is touched. The order keeps source rows intact.
+        for (size_t k = 0; k + step < rows; k++) {
+            const size_t i = forward ? k : rows - 1 - k;
+            const size_t from = forward ? i + step : i - step;
+
+            auto *target = matrix.row(i);
+            const auto *source = matrix.row(from);
+
+            for (size_t w = 0; w < stride; w++) {
+                target[w] = Op::apply(target[w], source[w]);
+            }
+        }
+
+        covered += step;
+    }
+}
+
+template <typename Op>
+static void combine(BinaryMatrix &target, const BinaryMatrix &other) {
+    for (size_t i = 0; i < target.data.size(); i++) {
+        target.data[i] = Op::apply(target.data[i], other.data[i]);
+    }
+}
+
+// result[c] = Op over matrix[c + d] for d in [low, high] within each row,
+// where low <= 0 <= high
+template <typename Op>
+static BinaryMatrix horizontal(
+    const BinaryMatrix &matrix,
+    ptrdiff_t low,
+    ptrdiff_t high
+) {
+    BinaryMatrix result = matrix;
+    if (low == 0 && high == 0) {
+        return result;
+    }
+
+    const auto stride = matrix.stride;
+    const auto tailMask = matrix.lastWordMask();
+    const auto rowBytes = stride * sizeof(Word);
+
+    // Rows are independent, each stripe has its own buffers
+    forEachStripe(matrix.rows, rowBytes, [&](size_t begin, size_t end) {
+        std::vector<Word> backward(stride), temp(stride);
+
+        for (size_t i = begin; i < end; i++) {
+            auto *forward = result.row(i);
+            std::copy(forward, forward + stride, backward.begin());
+
+            accumulateRow<Op>(
+                forward,
+                temp.data(),
+                stride,
+                matrix.cols,
+                high + 1,
+                true
+            );
+            accumulateRow<Op>(
+                backward.data(),
+                temp.data(),
+                stride,
+                matrix.cols,
+                1 - low,
+                false
+            );
+
+            for (size_t w = 0; w < stride; w++) {
+                forward[w] = Op::apply(forward[w], backward[w]);
+            }
+
+            forward[stride - 1] &= tailMask;
+        }
+    });
+
+    return result;
+}
+
+// result[r] = Op over matrix[r + d] for d in [low, high] within each column,
+// where low <= 0 <= high
+template <typename Op>
+static BinaryMatrix vertical(
+    const BinaryMatrix &matrix,
+    ptrdiff_t low,
+    ptrdiff_t high
+) {
+    BinaryMatrix result = matrix;
+    if (low == 0 && high == 0) {
+        return result;
+    }
+
+    BinaryMatrix backward = matrix;
+
+    accumulateRows<Op>(result, high + 1, true);
+    accumulateRows<Op>(backward, 1 - low, false);
+    combine<Op>(result, backward);
+
+    return result;
+}
+
+// Rectangles are decomposed into a horizontal and a vertical segment applied
+// one after another, crosses are the union of both segments
+template <typename Op>
+static BinaryMatrix apply(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element,
+    bool reflect
+) {
+    if (matrix.isEmpty() || element.isEmpty()) {
+        return matrix;
+    }
+
+    const auto ax = ptrdiff_t(element.anchorX());
+    const auto ay = ptrdiff_t(element.anchorY());
+    const auto bx = ptrdiff_t(element.width) - 1 - ax;
+    const auto by = ptrdiff_t(element.height) - 1 - ay;
+
+    const auto lowX = reflect ? -bx : -ax, highX = reflect ? ax : bx;
+    const auto lowY = reflect ? -by : -ay, highY = reflect ? ay : by;
+
+    if (element.shape == StructuringElement::Cross) {
+        auto result = horizontal<Op>(matrix, lowX, highX);
+        combine<Op>(result, vertical<Op>(matrix, lowY, highY));
+
+        return result;
+    }
+
+    return vertical<Op>(horizontal<Op>(matrix, lowX, highX), lowY, highY);
+}
+
+BinaryMatrix erode(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+) {
+    return apply<ErodeOp>(matrix, element, false);
+}
+
+BinaryMatrix dilate(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+) {
+    // Dilation uses the element reflected over its anchor
+    return apply<DilateOp>(matrix, element, true);
+}
+
+BinaryMatrix opening(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+) {
+    return dilate(erode(matrix, element), element);
+}
+
+BinaryMatrix closing(
+    const BinaryMatrix &matrix,
+    const StructuringElement &element
+) {
+    return erode(dilate(matrix, element), element);
+}
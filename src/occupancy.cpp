@@ -0,0 +1,356 @@
+#include "occupancy.hpp"
+#include "grid.hpp"
+#include "pool.hpp"
+
+using Word = BinaryMatrix::Word;
+
+// A level 0 tile seen in place. Full tiles have a fixed size, so their scan
+// unrolls; the last tile row may be shorter. Columns past the matrix in the
+// last word are padding, which is always zero.
+using TileView
+    = BinaryMatrixView<OccupancyIndex::TileRows, OccupancyIndex::TileCols>;
+using EdgeTileView = BinaryMatrixView<Dynamic, OccupancyIndex::TileCols>;
+
+// Bits [from, to) of a word, to - from must not be zero
+static Word bitRange(size_t from, size_t to) {
+    const size_t count = to - from;
+
+    return count == BinaryMatrix::WordBits ? ~Word(0)
+                                           : ((Word(1) << count) - 1) << from;
+}
+
+static bool rowHasTrue(const BinaryMatrix &level, size_t row) {
+    const auto *words = level.row(row);
+
+    for (size_t w = 0; w < level.stride; w++) {
+        if (words[w] != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+OccupancyIndex::OccupancyIndex(): matrix(nullptr) {
+}
+
+OccupancyIndex::OccupancyIndex(BinaryMatrix &matrix): matrix(nullptr) {
+    this->attach(matrix);
+}
+
+void OccupancyIndex::attach(BinaryMatrix &matrix) {
+    this->matrix = &matrix;
+    this->rebuild();
+}
+
+void OccupancyIndex::detach() {
+    this->matrix = nullptr;
+    this->levels.clear();
+}
+
+bool OccupancyIndex::isEmpty() const {
+    return this->levels.empty();
+}
+
+void OccupancyIndex::rebuild() {
+    this->levels.clear();
+    if (!this->matrix || this->matrix->isEmpty()) {
+        return;
+    }
+
+    const auto &matrix = *this->matrix;
+    const auto tileRows = (matrix.rows + TileRows - 1) / TileRows;
+    this->levels.emplace_back(tileRows, matrix.stride);
+
+    auto &base = this->levels[0];
+    const auto rowBytes = matrix.stride * sizeof(Word) * TileRows;
+
+    // Every tile row covers its own words of the level
+    forEachStripe(tileRows, rowBytes, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            for (size_t c = 0; c < matrix.stride; c++) {
+                if (this->tileHasTrue(r, c)) {
+                    base.set(r, c, BinaryMatrix::True);
+                }
+            }
+        }
+    });
+
+    while (this->levels.back().rows > 1 || this->levels.back().cols > 1) {
+        const auto &below = this->levels.back();
+        BinaryMatrix level((below.rows + 1) / 2, (below.cols + 1) / 2);
+
+        for (size_t r = 0; r < level.rows; r++) {
+            for (size_t c = 0; c < level.cols; c++) {
+                if (this->childrenHaveTrue(this->levels.size(), r, c)) {
+                    level.set(r, c, BinaryMatrix::True);
+                }
+            }
+        }
+
+        this->levels.push_back(std::move(level));
+    }
+}
+
+void OccupancyIndex::refresh(size_t from, size_t to) {
+    if (this->isEmpty()) {
+        return;
+    }
+
+    to = std::min(to, this->matrix->rows);
+    if (from >= to) {
+        return;
+    }
+
+    size_t first = from / TileRows, last = (to - 1) / TileRows;
+
+    for (size_t r = first; r <= last; r++) {
+        for (size_t c = 0; c < this->levels[0].cols; c++) {
+            this->levels[0].set(r, c, this->tileHasTrue(r, c));
+        }
+    }
+
+    for (size_t level = 1; level < this->levels.size(); level++) {
+        first /= 2;
+        last /= 2;
+
+        auto &current = this->levels[level];
+        for (size_t r = first; r <= last; r++) {
+            for (size_t c = 0; c < current.cols; c++) {
+                current.set(r, c, this->childrenHaveTrue(level, r, c));
+            }
+        }
+    }
+}
+
+void OccupancyIndex::set(size_t row, size_t col, BinaryMatrix::Type value) {
+    this->matrix->set(row, col, value);
+    if (this->isEmpty()) {
+        return;
+    }
+
+    this->propagate(row / TileRows, col / TileCols);
+}
+
+bool OccupancyIndex::hasTrue() const {
+    return !this->isEmpty() && this->levels.back().isTrue(0, 0);
+}
+
+bool OccupancyIndex::any(
+    size_t row,
+    size_t col,
+    size_t height,
+    size_t width
+) const {
+    if (this->isEmpty()) {
+        return false;
+    }
+
+    const auto bottom = std::min(this->matrix->rows, row + height);
+    const auto right = std::min(this->matrix->cols, col + width);
+    if (row >= bottom || col >= right) {
+        return false;
+    }
+
+    return this->anyIn(this->levels.size() - 1, 0, 0, row, col, bottom, right);
+}
+
+bool OccupancyIndex::findFirst(size_t &row, size_t &col) const {
+    if (!this->hasTrue()) {
+        return false;
+    }
+
+    // Down to the topmost occupied tile row, one of the two rows below an
+    // occupied one is occupied too
+    size_t tileRow = 0;
+    for (size_t level = this->levels.size() - 1; level-- > 0;) {
+        tileRow *= 2;
+        if (!rowHasTrue(this->levels[level], tileRow)) {
+            tileRow++;
+        }
+    }
+
+    const auto *tiles = this->levels[0].row(tileRow);
+    size_t w = 0;
+    while (tiles[w] == 0) {
+        w++;
+    }
+    const auto tileCol = w * BinaryMatrix::WordBits + lowestBit(tiles[w]);
+
+    const auto &matrix = *this->matrix;
+    const auto top = tileRow * TileRows;
+    const auto bottom = std::min(matrix.rows, top + TileRows);
+
+    for (size_t i = top; i < bottom; i++) {
+        const auto word = matrix.row(i)[tileCol];
+
+        if (word != 0) {
+            row = i;
+            col = tileCol * TileCols + lowestBit(word);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool OccupancyIndex::isTileOccupied(size_t row, size_t col) const {
+    return !this->isEmpty()
+           && this->levels[0].isTrue(row / TileRows, col / TileCols);
+}
+
+void OccupancyIndex::forEachTile(
+    const std::function<void(size_t, size_t, size_t, size_t)> &visit
+) const {
+    if (this->isEmpty()) {
+        return;
+    }
+
+    this->visitTiles(this->levels.size() - 1, 0, 0, visit);
+}
+
+bool OccupancyIndex::tileHasTrue(size_t tileRow, size_t tileCol) const {
+    auto &matrix = *this->matrix;
+    const auto top = tileRow * TileRows;
+    auto *words = matrix.row(top) + tileCol;
+
+    if (top + TileRows <= matrix.rows) {
+        return TileView(words, TileRows, TileCols, matrix.stride).hasTrue();
+    }
+
+    return EdgeTileView(words, matrix.rows - top, TileCols, matrix.stride)
+        .hasTrue();
+}
+
+bool OccupancyIndex::childrenHaveTrue(
+    size_t level,
+    size_t row,
+    size_t col
+) const {
+    const auto &below = this->levels[level - 1];
+    const auto bottom = std::min(below.rows, row * 2 + 2);
+    const auto right = std::min(below.cols, col * 2 + 2);
+
+    for (size_t r = row * 2; r < bottom; r++) {
+        for (size_t c = col * 2; c < right; c++) {
+            if (below.isTrue(r, c)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Bring the bits above a changed tile up to date, stopping at the first
+// level that does not change
+void OccupancyIndex::propagate(size_t tileRow, size_t tileCol) {
+    bool value = this->tileHasTrue(tileRow, tileCol);
+    if (this->levels[0].at(tileRow, tileCol) == value) {
+        return;
+    }
+    this->levels[0].set(tileRow, tileCol, value);
+
+    for (size_t level = 1; level < this->levels.size(); level++) {
+        tileRow /= 2;
+        tileCol /= 2;
+
+        // A new true cell sets every level above, a cleared one only empties
+        // the parent when its siblings are empty too
+        if (!value) {
+            value = this->childrenHaveTrue(level, tileRow, tileCol);
+        }
+
+        if (this->levels[level].at(tileRow, tileCol) == value) {
+            return;
+        }
+        this->levels[level].set(tileRow, tileCol, value);
+    }
+}
+
+bool OccupancyIndex::anyIn(
+    size_t level,
+    size_t row,
+    size_t col,
+    size_t top,
+    size_t left,
+    size_t bottom,
+    size_t right
+) const {
+    const auto &matrix = *this->matrix;
+    const auto cellTop = (row * TileRows) << level;
+    const auto cellLeft = (col * TileCols) << level;
+    const auto cellBottom
+        = std::min(matrix.rows, cellTop + (TileRows << level));
+    const auto cellRight
+        = std::min(matrix.cols, cellLeft + (TileCols << level));
+
+    if (cellTop >= bottom || cellBottom <= top || cellLeft >= right
+        || cellRight <= left || !this->levels[level].isTrue(row, col)) {
+        return false;
+    }
+
+    // Covered entirely, the bit alone answers
+    if (top <= cellTop && cellBottom <= bottom && left <= cellLeft
+        && cellRight <= right) {
+        return true;
+    }
+
+    if (level == 0) {
+        const auto from = std::max(left, cellLeft) - cellLeft;
+        const auto to = std::min(right, cellRight) - cellLeft;
+        const auto mask = bitRange(from, to);
+        const auto last = std::min(bottom, cellBottom);
+
+        for (size_t i = std::max(top, cellTop); i < last; i++) {
+            if (matrix.row(i)[col] & mask) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    const auto &below = this->levels[level - 1];
+    for (size_t r = row * 2; r < std::min(below.rows, row * 2 + 2); r++) {
+        for (size_t c = col * 2; c < std::min(below.cols, col * 2 + 2); c++) {
+            if (this->anyIn(level - 1, r, c, top, left, bottom, right)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void OccupancyIndex::visitTiles(
+    size_t level,
+    size_t row,
+    size_t col,
+    const std::function<void(size_t, size_t, size_t, size_t)> &visit
+) const {
+    if (!this->levels[level].isTrue(row, col)) {
+        return;
+    }
+
+    if (level == 0) {
+        const auto top = row * TileRows, left = col * TileCols;
+
+        visit(
+            top,
+            left,
+            std::min(this->matrix->rows, top + TileRows),
+            std::min(this->matrix->cols, left + TileCols)
+        );
+
+        return;
+    }
+
+    const auto &below = this->levels[level - 1];
+    for (size_t r = row * 2; r < std::min(below.rows, row * 2 + 2); r++) {
+        for (size_t c = col * 2; c < std::min(below.cols, col * 2 + 2); c++) {
+            this->visitTiles(level - 1, r, c, visit);
+        }
+    }
+}
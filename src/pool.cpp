@@ -0,0 +1,193 @@
+#include "pool.hpp"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+
+// Stripe size aimed at the per-core L2 cache
+#define STRIPE_BYTES (256 * 1024)
+// Images below this size are not worth the synchronization
+#define PARALLEL_MIN_BYTES (1024 * 1024)
+
+// Shared between the participants of one parallelFor call, helpers may
+// outlive the call when they start after all the chunks are taken
+struct ParallelForState
+{
+    size_t count, grain, chunks;
+    std::function<void(size_t, size_t)> body;
+    std::atomic<size_t> next, completed;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    ParallelForState(
+        size_t count,
+        size_t grain,
+        const std::function<void(size_t, size_t)> &body
+    )
+        : count(count),
+          grain(grain),
+          chunks((count + grain - 1) / grain),
+          body(body),
+          next(0),
+          completed(0) {
+    }
+
+    void run() {
+        for (size_t chunk; (chunk = this->next++) < this->chunks;) {
+            const auto begin = chunk * this->grain;
+            const auto end = std::min(this->count, begin + this->grain);
+
+            try {
+                this->body(begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (!this->error) {
+                    this->error = std::current_exception();
+                }
+            }
+
+            if (++this->completed == this->chunks) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->done.notify_all();
+            }
+        }
+    }
+};
+
+ThreadPool::ThreadPool(size_t threads): stopping(false) {
+    this->start(threads);
+}
+
+ThreadPool::~ThreadPool() {
+    this->stop();
+}
+
+size_t ThreadPool::size() const {
+    return this->workers.size() + 1;
+}
+
+void ThreadPool::resize(size_t threads) {
+    this->stop();
+    this->start(threads);
+}
+
+void ThreadPool::submit(const std::function<void()> &task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push_back(task);
+    }
+
+    this->wake.notify_one();
+}
+
+void ThreadPool::parallelFor(
+    size_t count,
+    size_t grain,
+    const std::function<void(size_t, size_t)> &body
+) {
+    grain = std::max(grain, size_t(1));
+    if (count == 0) {
+        return;
+    }
+    if (count <= grain || this->workers.empty()) {
+        body(0, count);
+
+        return;
+    }
+
+    auto state = std::make_shared<ParallelForState>(count, grain, body);
+    const auto helpers = std::min(state->chunks, this->size()) - 1;
+
+    for (size_t i = 0; i < helpers; i++) {
+        this->submit([state]() { state->run(); });
+    }
+
+    // The caller works too, so nested calls from a worker still progress
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&]() {
+        return state->completed == state->chunks;
+    });
+
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool;
+
+    return pool;
+}
+
+void ThreadPool::start(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    this->stopping = false;
+
+    // The calling thread is the last participant
+    for (size_t i = 0; i + 1 < threads; i++) {
+        this->workers.emplace_back([this]() {
+            while (true) {
+                std::function<void()> task;
+
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->wake.wait(lock, [this]() {
+                        return this->stopping || !this->tasks.empty();
+                    });
+
+                    if (this->tasks.empty()) {
+                        return;
+                    }
+
+                    task = std::move(this->tasks.front());
+                    this->tasks.pop_front();
+                }
+
+                task();
+            }
+        });
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+
+    this->wake.notify_all();
+
+    for (auto &&worker : this->workers) {
+        worker.join();
+    }
+
+    this->workers.clear();
+}
+
+size_t stripeRows(size_t rowBytes) {
+    return std::max(size_t(1), STRIPE_BYTES / std::max(rowBytes, size_t(1)));
+}
+
+void forEachStripe(
+    size_t rows,
+    size_t rowBytes,
+    const std::function<void(size_t, size_t)> &body
+) {
+    auto &pool = ThreadPool::shared();
+
+    if (rows * rowBytes < PARALLEL_MIN_BYTES || pool.size() == 1) {
+        if (rows > 0) {
+            body(0, rows);
+        }
+
+        return;
+    }
+
+    pool.parallelFor(rows, stripeRows(rowBytes), body);
+}
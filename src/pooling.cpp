@@ -0,0 +1,192 @@
+#include "pooling.hpp"
+#include "pool.hpp"
+
+using Word = BinaryMatrix::Word;
+
+// Number of true cells in [from, to) of a packed row
+static size_t countRange(const Word *row, size_t from, size_t to) {
+    const auto wordBits = BinaryMatrix::WordBits;
+    if (from >= to) {
+        return 0;
+    }
+
+    const size_t first = from / wordBits, last = (to - 1) / wordBits;
+    const Word head = ~Word(0) << (from % wordBits);
+    const Word tail = ~Word(0) >> (wordBits - 1 - (to - 1) % wordBits);
+
+    if (first == last) {
+        return popcount(row[first] & head & tail);
+    }
+
+    size_t count = popcount(row[first] & head) + popcount(row[last] & tail);
+    for (size_t w = first + 1; w < last; w++) {
+        count += popcount(row[w]);
+    }
+
+    return count;
+}
+
+// Start of the grid block `index` out of `blocks` over `size` cells
+static size_t blockStart(size_t index, size_t size, size_t blocks) {
+    return index * size / blocks;
+}
+
+// End of the grid block, at least one cell past its start
+static size_t blockEnd(size_t index, size_t size, size_t blocks) {
+    const auto start = blockStart(index, size, blocks);
+
+    return std::min(
+        size,
+        std::max(blockStart(index + 1, size, blocks), start + 1)
+    );
+}
+
+BinaryMatrix poolMatrix(
+    const BinaryMatrix &matrix,
+    size_t rows,
+    size_t cols,
+    PoolingMode mode
+) {
+    BinaryMatrix result(rows, cols);
+    if (matrix.isEmpty() || result.isEmpty()) {
+        return result;
+    }
+
+    // Grid rows are independent, every one of them reads its own source rows
+    const auto sourceBytes = matrix.stride * sizeof(Word);
+    const auto rowBytes = sourceBytes * (matrix.rows + rows - 1) / rows;
+
+    forEachStripe(rows, rowBytes, [&](size_t begin, size_t end) {
+        std::vector<size_t> counts(cols);
+
+        for (size_t r = begin; r < end; r++) {
+            const auto top = blockStart(r, matrix.rows, rows);
+            const auto bottom = blockEnd(r, matrix.rows, rows);
+            std::fill(counts.begin(), counts.end(), 0);
+
+            for (size_t i = top; i < bottom; i++) {
+                const auto *words = matrix.row(i);
+
+                for (size_t c = 0; c < cols; c++) {
+                    counts[c] += countRange(
+                        words,
+                        blockStart(c, matrix.cols, cols),
+                        blockEnd(c, matrix.cols, cols)
+                    );
+                }
+            }
+
+            for (size_t c = 0; c < cols; c++) {
+                const auto width = blockEnd(c, matrix.cols, cols)
+                                   - blockStart(c, matrix.cols, cols);
+                const auto area = (bottom - top) * width;
+
+                bool value = false;
+                switch (mode) {
+                case PoolAny:
+                    value = counts[c] > 0;
+                    break;
+                case PoolAll:
+                    value = counts[c] == area;
+                    break;
+                case PoolMajority:
+                    value = counts[c] * 2 > area;
+                    break;
+                }
+
+                if (value) {
+                    result.set(r, c, BinaryMatrix::True);
+                }
+            }
+        }
+    });
+
+    return result;
+}
+
+SummedAreaTable::SummedAreaTable(): rows(0), cols(0) {
+}
+
+SummedAreaTable::SummedAreaTable(const BinaryMatrix &matrix)
+    : rows(matrix.rows), cols(matrix.cols) {
+    if (matrix.isEmpty()) {
+        return;
+    }
+
+    const auto width = this->cols + 1;
+    this->sums.assign((this->rows + 1) * width, 0);
+
+    // Row prefix sums first, those are independent
+    forEachStripe(
+        this->rows,
+        width * sizeof(uint32_t),
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const auto *words = matrix.row(i);
+                auto *sums = &this->sums[(i + 1) * width + 1];
+                uint32_t sum = 0;
+
+                for (size_t j = 0; j < this->cols; j++) {
+                    const auto word = words[j / BinaryMatrix::WordBits];
+                    sum += (word >> (j % BinaryMatrix::WordBits)) & 1;
+                    sums[j] = sum;
+                }
+            }
+        }
+    );
+
+    // Then accumulate down the columns, a plain vector add per row
+    for (size_t i = 2; i <= this->rows; i++) {
+        auto *current = &this->sums[i * width];
+        const auto *previous = current - width;
+
+        for (size_t j = 1; j < width; j++) {
+            current[j] += previous[j];
+        }
+    }
+}
+
+bool SummedAreaTable::isEmpty() const {
+    return this->sums.empty();
+}
+
+size_t SummedAreaTable::count(
+    size_t row,
+    size_t col,
+    size_t height,
+    size_t width
+) const {
+    if (this->isEmpty() || row >= this->rows || col >= this->cols) {
+        return 0;
+    }
+
+    const auto bottom = row + std::min(height, this->rows - row);
+    const auto right = col + std::min(width, this->cols - col);
+
+    return this->at(bottom, right) - this->at(row, right)
+           - this->at(bottom, col) + this->at(row, col);
+}
+
+double SummedAreaTable::density(
+    size_t row,
+    size_t col,
+    size_t height,
+    size_t width
+) const {
+    if (row >= this->rows || col >= this->cols) {
+        return 0;
+    }
+
+    height = std::min(height, this->rows - row);
+    width = std::min(width, this->cols - col);
+    if (height == 0 || width == 0) {
+        return 0;
+    }
+
+    return double(this->count(row, col, height, width))
+           / double(height * width);
+}
+
+uint32_t SummedAreaTable::at(size_t row, size_t col) const {
+    return this->sums[row * (this->cols + 1) + col];
+}
@@ -0,0 +1,414 @@
+#include "profiler.hpp"
+#include "pool.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define IBM_PERF_EVENTS
+#endif
+
+StageProfile::StageProfile(const std::string &name)
+    : name(name), calls(0), seconds(0), bytes(0), counters{} {
+}
+
+double StageProfile::ipc() const {
+    const auto cycles = this->counters[PerfCycles];
+
+    return cycles > 0 ? (double)this->counters[PerfInstructions] / cycles : 0;
+}
+
+double StageProfile::bytesPerCycle() const {
+    const auto cycles = this->counters[PerfCycles];
+
+    return cycles > 0 ? (double)this->bytes / cycles : 0;
+}
+
+PerfSample::PerfSample(): generation(0) {
+}
+
+Profiler::Profiler()
+    : enabled(false), generation(0), poolSize(0), probed(false), available{} {
+}
+
+Profiler::~Profiler() {
+    this->closeThreads();
+}
+
+void Profiler::enable() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->openThreads();
+    this->enabled = true;
+}
+
+void Profiler::disable() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->enabled = false;
+    this->closeThreads();
+}
+
+bool Profiler::isEnabled() const {
+    return this->enabled.load(std::memory_order_relaxed);
+}
+
+bool Profiler::hasCounter(PerfCounter counter) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    return this->available[counter];
+}
+
+bool Profiler::hasCounters() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for (int c = 0; c < PerfCounterCount; c++) {
+        if (!this->available[c]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string Profiler::unavailableReason() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    return this->problem;
+}
+
+std::vector<StageProfile> Profiler::stages() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    return this->stageList;
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stageList.clear();
+}
+
+#ifdef IBM_PERF_EVENTS
+
+struct CounterValue
+{
+    uint64_t value, enabled, running;
+};
+
+static int openCounter(PerfCounter counter, long thread) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // User space only, which is what unprivileged processes may count
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    switch (counter) {
+    case PerfCycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PerfInstructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PerfCacheMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL
+                      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    default:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+
+    return (int)syscall(SYS_perf_event_open, &attr, thread, -1, -1, 0);
+}
+
+static std::string describeError(int error) {
+    switch (error) {
+    case EACCES:
+    case EPERM:
+        return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+    case ENOENT:
+    case ENODEV:
+    case EOPNOTSUPP:
+        return "not supported by this CPU or virtual machine";
+    case ENOSYS:
+        return "perf events are disabled in this kernel";
+    default:
+        return strerror(error);
+    }
+}
+
+// Count, time enabled and time running, left at 0 when unreadable
+static void readCounter(int descriptor, uint64_t *value) {
+    CounterValue read;
+    if (::read(descriptor, &read, sizeof(read)) == sizeof(read)) {
+        value[0] = read.value;
+        value[1] = read.enabled;
+        value[2] = read.running;
+    }
+}
+
+// Threads of the process, pool workers included
+static std::vector<long> listThreads() {
+    std::vector<long> result;
+    DIR *directory = opendir("/proc/self/task");
+    if (directory == nullptr) {
+        return result;
+    }
+
+    while (const auto *entry = readdir(directory)) {
+        if (entry->d_name[0] != '.') {
+            result.push_back(strtol(entry->d_name, nullptr, 10));
+        }
+    }
+    closedir(directory);
+
+    return result;
+}
+
+void Profiler::openThreads() {
+    this->poolSize = ThreadPool::shared().size();
+
+    for (auto thread : listThreads()) {
+        this->openThread(thread);
+    }
+}
+
+void Profiler::openThread(long thread) {
+    for (auto &&counters : this->threads) {
+        if (counters.thread == thread) {
+            return;
+        }
+    }
+
+    ThreadCounters counters;
+    counters.thread = thread;
+
+    for (int c = 0; c < PerfCounterCount; c++) {
+        counters.descriptors[c] = -1;
+
+        // A counter that failed once is not tried on other threads
+        if (this->probed && !this->available[c]) {
+            continue;
+        }
+
+        counters.descriptors[c] = openCounter((PerfCounter)c, thread);
+        if (!this->probed) {
+            this->available[c] = counters.descriptors[c] >= 0;
+
+            if (!this->available[c] && this->problem.empty()) {
+                this->problem = std::string(counterName((PerfCounter)c))
+                                + ": " + describeError(errno);
+            }
+        }
+    }
+
+    this->probed = true;
+    this->threads.push_back(counters);
+}
+
+void Profiler::addThread() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->enabled) {
+        this->openThread((long)syscall(SYS_gettid));
+    }
+}
+
+void Profiler::closeThreads() {
+    for (auto &&counters : this->threads) {
+        for (int c = 0; c < PerfCounterCount; c++) {
+            if (counters.descriptors[c] >= 0) {
+                close(counters.descriptors[c]);
+            }
+        }
+    }
+    this->threads.clear();
+    this->generation++;
+}
+
+void Profiler::sample(PerfSample &values) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->enabled && this->poolSize != ThreadPool::shared().size()) {
+        this->openThreads();
+    }
+
+    values.generation = this->generation;
+    values.values.assign(3 * PerfCounterCount * this->threads.size(), 0);
+
+    // Counters of finished threads keep their last value
+    auto *value = values.values.data();
+    for (auto &&counters : this->threads) {
+        for (int c = 0; c < PerfCounterCount; c++, value += 3) {
+            if (counters.descriptors[c] >= 0) {
+                readCounter(counters.descriptors[c], value);
+            }
+        }
+    }
+}
+
+#else
+
+void Profiler::openThreads() {
+    if (!this->probed) {
+        this->probed = true;
+        this->problem = "hardware counters need Linux perf events";
+    }
+}
+
+void Profiler::openThread(long) {
+}
+
+void Profiler::addThread() {
+}
+
+void Profiler::closeThreads() {
+}
+
+void Profiler::sample(PerfSample &values) {
+    values.generation = 0;
+    values.values.clear();
+}
+
+#endif
+
+void Profiler::record(
+    const char *stage,
+    double seconds,
+    uint64_t bytes,
+    const PerfSample &before,
+    const PerfSample &after
+) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    StageProfile *profile = nullptr;
+    for (auto &&existing : this->stageList) {
+        if (existing.name == stage) {
+            profile = &existing;
+        }
+    }
+    if (profile == nullptr) {
+        this->stageList.push_back(StageProfile(stage));
+        profile = &this->stageList.back();
+    }
+
+    profile->calls++;
+    profile->seconds += seconds;
+    profile->bytes += bytes;
+
+    // Counters closed in between, only the time is known
+    if (before.generation != after.generation) {
+        return;
+    }
+
+    // Threads counted since `before` have no delta
+    const auto count
+        = std::min(before.values.size(), after.values.size()) / 3;
+    for (size_t i = 0; i < count; i++) {
+        const auto *from = &before.values[3 * i], *to = &after.values[3 * i];
+        const auto running = to[2] - from[2];
+        if (to[0] < from[0] || to[2] < from[2] || running == 0) {
+            continue;
+        }
+
+        const double share = (double)(to[1] - from[1]) / running;
+        profile->counters[i % PerfCounterCount]
+            += (uint64_t)((to[0] - from[0]) * share);
+    }
+}
+
+void Profiler::print(std::ostream &output) const {
+    const auto stages = this->stages();
+    const bool counted = this->hasCounter(PerfCycles)
+                         && this->hasCounter(PerfInstructions);
+    const auto misses = [&](const StageProfile &stage, PerfCounter counter) {
+        return this->hasCounter(counter)
+                   ? std::to_string(stage.counters[counter])
+                   : std::string("-");
+    };
+
+    output << std::left << std::setw(14) << "Stage" << std::right
+           << std::setw(8) << "Calls" << std::setw(12) << "Time, ms";
+    if (counted) {
+        output << std::setw(8) << "IPC" << std::setw(10) << "B/cycle"
+               << std::setw(14) << "LLC misses" << std::setw(14)
+               << "Br. misses";
+    }
+    output << "\n";
+
+    for (auto &&stage : stages) {
+        output << std::left << std::setw(14) << stage.name << std::right
+               << std::setw(8) << stage.calls << std::setw(12) << std::fixed
+               << std::setprecision(2) << stage.seconds * 1000;
+
+        if (counted) {
+            output << std::setw(8) << stage.ipc() << std::setw(10)
+                   << stage.bytesPerCycle() << std::setw(14)
+                   << misses(stage, PerfCacheMisses) << std::setw(14)
+                   << misses(stage, PerfBranchMisses);
+        }
+        output << "\n";
+    }
+
+    const auto reason = this->unavailableReason();
+    if (!reason.empty()) {
+        output << "Hardware counters unavailable (" << reason << ")"
+               << (counted ? "" : ", wall time only") << "\n";
+    }
+    output.flush();
+}
+
+const char *Profiler::counterName(PerfCounter counter) {
+    switch (counter) {
+    case PerfCycles:
+        return "cycles";
+    case PerfInstructions:
+        return "instructions";
+    case PerfCacheMisses:
+        return "LLC misses";
+    default:
+        return "branch misses";
+    }
+}
+
+Profiler &Profiler::shared() {
+    static Profiler profiler;
+
+    return profiler;
+}
+
+ProfileScope::ProfileScope(const char *stage, uint64_t bytes)
+    : stage(stage), bytes(bytes), active(Profiler::shared().isEnabled()) {
+    if (!this->active) {
+        return;
+    }
+
+    Profiler::shared().sample(this->before);
+    this->start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+    if (!this->active) {
+        return;
+    }
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - this->start;
+    PerfSample after;
+    Profiler::shared().sample(after);
+
+    Profiler::shared()
+        .record(this->stage, elapsed.count(), this->bytes, this->before, after);
+}
+
+void ProfileScope::addBytes(uint64_t bytes) {
+    this->bytes += bytes;
+}
@@ -0,0 +1,134 @@
+#include "progressive.hpp"
+#include "pool.hpp"
+#include "scratch.hpp"
+
+#include <chrono>
+
+ProgressiveThreshold::ProgressiveThreshold()
+    : level(0),
+      range(cv::Scalar(), cv::Scalar()),
+      started(false),
+      nextRow(0) {
+}
+
+void ProgressiveThreshold::attach(const cv::Mat &image) {
+    this->image = image;
+    this->started = false;
+    this->nextRow = 0;
+
+    // Smallest power of two that brings the image under the preview size
+    this->level = 0;
+    const auto rows = (size_t)image.rows, cols = (size_t)image.cols;
+    while ((rows >> this->level) * (cols >> this->level) > PreviewPixels) {
+        this->level++;
+    }
+
+    if (this->level == 0) {
+        this->coarse = image;
+
+        return;
+    }
+
+    const cv::Size size(
+        std::max(image.cols >> this->level, 1),
+        std::max(image.rows >> this->level, 1)
+    );
+    cv::resize(image, this->coarse, size, 0, 0, cv::INTER_AREA);
+}
+
+void ProgressiveThreshold::detach() {
+    this->image.release();
+    this->coarse.release();
+    this->level = 0;
+    this->started = false;
+    this->nextRow = 0;
+}
+
+bool ProgressiveThreshold::isAttached() const {
+    return !this->image.empty();
+}
+
+void ProgressiveThreshold::restart(const ColorRange &range) {
+    if (!this->isAttached()) {
+        throw Exception("No image to threshold!");
+    }
+
+    this->range = range;
+    this->started = true;
+    this->nextRow = 0;
+
+    cv::cvtColor(this->coarse, this->coarseHSV, cv::COLOR_BGR2HSV);
+    this->range.threshold(this->coarseHSV, this->coarseMask);
+
+    this->fullMask.create(this->image.rows, this->image.cols, CV_8UC1);
+}
+
+bool ProgressiveThreshold::refine(double seconds) {
+    if (!this->started) {
+        return false;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now()
+                          + std::chrono::duration<double>(seconds);
+    const auto rows = (size_t)this->image.rows;
+    const auto rowBytes = this->image.cols * this->image.elemSize();
+
+    while (this->nextRow < rows) {
+        const auto first = this->nextRow;
+        const auto last = std::min(rows, first + BandRows);
+
+        // Rows of the band spread over the pool like a whole image would
+        forEachStripe(last - first, rowBytes, [&](size_t begin, size_t end) {
+            const auto from = (int)(first + begin), to = (int)(first + end);
+            auto stripeHSV = ScratchArena::local().band(
+                ScratchHSV,
+                to - from,
+                this->image.cols,
+                CV_8UC3
+            );
+            cv::Mat stripeMask = this->fullMask.rowRange(from, to);
+
+            cv::cvtColor(
+                this->image.rowRange(from, to),
+                stripeHSV,
+                cv::COLOR_BGR2HSV
+            );
+            this->range.threshold(stripeHSV, stripeMask);
+        });
+
+        this->nextRow = last;
+        if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+    }
+
+    return this->isComplete();
+}
+
+bool ProgressiveThreshold::isStarted() const {
+    return this->started;
+}
+
+bool ProgressiveThreshold::isComplete() const {
+    return this->started && this->nextRow >= (size_t)this->image.rows;
+}
+
+double ProgressiveThreshold::progress() const {
+    if (!this->started || this->image.rows == 0) {
+        return 0;
+    }
+
+    return (double)this->nextRow / this->image.rows;
+}
+
+int ProgressiveThreshold::coarseLevel() const {
+    return this->level;
+}
+
+const cv::Mat &ProgressiveThreshold::preview() const {
+    return this->coarseMask;
+}
+
+cv::Mat &ProgressiveThreshold::mask() {
+    return this->fullMask;
+}
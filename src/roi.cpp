@@ -0,0 +1,200 @@
+#include "roi.hpp"
+#include "pool.hpp"
+#include "scratch.hpp"
+
+#include <functional>
+
+RegionOfInterest::RegionOfInterest() {
+}
+
+RegionOfInterest::RegionOfInterest(const cv::Rect &rect): rects{rect} {
+}
+
+bool RegionOfInterest::isEmpty() const {
+    return this->rects.empty();
+}
+
+void RegionOfInterest::add(const cv::Rect &rect) {
+    this->rects.push_back(rect);
+}
+
+void RegionOfInterest::clear() {
+    this->rects.clear();
+}
+
+std::vector<cv::Rect> RegionOfInterest::clip(const cv::Size &frame) const {
+    const cv::Rect whole(0, 0, frame.width, frame.height);
+    if (this->rects.empty()) {
+        return {whole};
+    }
+
+    std::vector<cv::Rect> result;
+    for (auto &&rect : this->rects) {
+        const auto clipped = rect & whole;
+
+        if (clipped.width > 0 && clipped.height > 0) {
+            result.push_back(clipped);
+        }
+    }
+
+    return result;
+}
+
+cv::Rect RegionOfInterest::bounds(const cv::Size &frame) const {
+    const auto clipped = this->clip(frame);
+    if (clipped.empty()) {
+        return cv::Rect();
+    }
+
+    auto result = clipped[0];
+    for (auto &&rect : clipped) {
+        result |= rect;
+    }
+
+    return result;
+}
+
+bool RegionOfInterest::coversFrame(const cv::Size &frame) const {
+    return this->bounds(frame) == cv::Rect(0, 0, frame.width, frame.height);
+}
+
+// Run body(rect, begin, end) over row stripes of every clipped rectangle,
+// rows relative to the rectangle. Rectangles go one after another, so that
+// overlapping ones never write the same cells at once.
+static void forEachRegionStripe(
+    const cv::Mat &image,
+    const std::vector<cv::Rect> &rects,
+    const std::function<void(const cv::Rect &, size_t, size_t)> &body
+) {
+    for (auto &&rect : rects) {
+        forEachStripe(
+            rect.height,
+            rect.width * image.elemSize(),
+            [&](size_t begin, size_t end) { body(rect, begin, end); }
+        );
+    }
+}
+
+// Thresholded rows [begin, end) of the rectangle in the thread scratch
+static cv::Mat thresholdStripe(
+    const cv::Mat &image,
+    const ColorRange &range,
+    const cv::Rect &rect,
+    size_t begin,
+    size_t end
+) {
+    auto &arena = ScratchArena::local();
+    const int rows = (int)(end - begin);
+    const cv::Rect stripe(rect.x, rect.y + (int)begin, rect.width, rows);
+
+    auto hsv = arena.band(ScratchHSV, rows, rect.width, CV_8UC3);
+    auto mask = arena.band(ScratchMask, rows, rect.width, CV_8UC1);
+
+    cv::cvtColor(image(stripe), hsv, cv::COLOR_BGR2HSV);
+    range.threshold(hsv, mask);
+
+    return mask;
+}
+
+// Mask of the bounds, cleared unless a single rectangle fills it
+static cv::Mat prepareMask(
+    const std::vector<cv::Rect> &rects,
+    const cv::Rect &bounds,
+    cv::Mat &mask
+) {
+    mask.create(bounds.height, bounds.width, CV_8UC1);
+    if (rects.size() > 1 || rects[0] != bounds) {
+        mask.setTo(cv::Scalar(0));
+    }
+
+    return mask;
+}
+
+void thresholdRegion(
+    const cv::Mat &image,
+    const ColorRange &range,
+    const RegionOfInterest &roi,
+    cv::Mat &mask
+) {
+    const auto rects = roi.clip(image.size());
+    if (rects.empty()) {
+        mask.release();
+
+        return;
+    }
+
+    const auto bounds = roi.bounds(image.size());
+    prepareMask(rects, bounds, mask);
+
+    forEachRegionStripe(
+        image,
+        rects,
+        [&](const cv::Rect &rect, size_t begin, size_t end) {
+            const auto stripe = thresholdStripe(image, range, rect, begin, end);
+            const cv::Rect target(
+                rect.x - bounds.x,
+                rect.y - bounds.y + (int)begin,
+                rect.width,
+                (int)(end - begin)
+            );
+            cv::Mat view = mask(target);
+
+            // Overlapping rectangles add up
+            if (rects.size() == 1) {
+                stripe.copyTo(view);
+            } else {
+                cv::bitwise_or(view, stripe, view);
+            }
+        }
+    );
+}
+
+void classifyRegion(
+    const cv::Mat &image,
+    const ColorClassifier &classifier,
+    const RegionOfInterest &roi,
+    cv::Mat &mask
+) {
+    const auto rects = roi.clip(image.size());
+    if (rects.empty()) {
+        mask.release();
+
+        return;
+    }
+
+    const auto bounds = roi.bounds(image.size());
+    prepareMask(rects, bounds, mask);
+
+    for (auto &&rect : rects) {
+        cv::Mat view = mask(rect - bounds.tl());
+
+        // Cells already true from an overlapping rectangle are kept
+        if (rects.size() == 1) {
+            classifier.classify(image(rect), view);
+        } else {
+            cv::Mat part;
+            classifier.classify(image(rect), part);
+            cv::bitwise_or(view, part, view);
+        }
+    }
+}
+
+void clearOutsideRegion(
+    cv::Mat &mask,
+    const RegionOfInterest &roi,
+    const cv::Size &frame
+) {
+    const auto rects = roi.clip(frame);
+    if (rects.size() < 2) {
+        return;
+    }
+
+    const auto bounds = roi.bounds(frame);
+    cv::Mat keep = cv::Mat::zeros(bounds.height, bounds.width, CV_8UC1);
+
+    for (auto &&rect : rects) {
+        keep(rect - bounds.tl()).setTo(cv::Scalar(255));
+    }
+
+    cv::bitwise_and(mask, keep, mask);
+}
@@ -0,0 +1,61 @@
+#include "scratch.hpp"
+
+std::atomic<size_t> ScratchArena::totalAllocationCount(0);
+std::atomic<size_t> ScratchArena::totalAllocatedBytes(0);
+
+ScratchArena::ScratchArena()
+    : slots(ScratchSlotCount), allocationCount(0), allocatedBytes(0) {
+}
+
+cv::Mat &ScratchArena::mat(ScratchSlot slot, int rows, int cols, int type) {
+    auto &buffer = this->slots[slot];
+
+    if (buffer.rows != rows || buffer.cols != cols || buffer.type() != type) {
+        buffer.create(rows, cols, type);
+
+        const auto size = buffer.total() * buffer.elemSize();
+        this->allocationCount++;
+        this->allocatedBytes += size;
+        totalAllocationCount++;
+        totalAllocatedBytes += size;
+    }
+
+    return buffer;
+}
+
+cv::Mat ScratchArena::band(ScratchSlot slot, int rows, int cols, int type) {
+    const auto &buffer = this->slots[slot];
+    const int height = buffer.cols == cols && buffer.type() == type
+                           ? std::max(buffer.rows, rows)
+                           : rows;
+
+    return this->mat(slot, height, cols, type).rowRange(0, rows);
+}
+
+void ScratchArena::release() {
+    for (auto &&buffer : this->slots) {
+        buffer.release();
+    }
+}
+
+size_t ScratchArena::allocations() const {
+    return this->allocationCount;
+}
+
+size_t ScratchArena::bytes() const {
+    return this->allocatedBytes;
+}
+
+size_t ScratchArena::totalAllocations() {
+    return totalAllocationCount;
+}
+
+size_t ScratchArena::totalBytes() {
+    return totalAllocatedBytes;
+}
+
+ScratchArena &ScratchArena::local() {
+    static thread_local ScratchArena arena;
+
+    return arena;
+}
@@ -0,0 +1,221 @@
+#include "sparse.hpp"
+#include "pool.hpp"
+
+// Sparse form is only picked when it is at least this many times smaller
+#define SPARSE_MIN_GAIN 2
+
+SparseBinaryMatrix::SparseBinaryMatrix(): SparseBinaryMatrix(0, 0) {
+}
+
+SparseBinaryMatrix::SparseBinaryMatrix(size_t rows, size_t cols) {
+    this->reset(rows, cols);
+}
+
+SparseBinaryMatrix::SparseBinaryMatrix(const BinaryMatrix &matrix) {
+    this->reset(matrix.rows, matrix.cols);
+    if (matrix.isEmpty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < matrix.rows; i++) {
+        const auto *words = matrix.row(i);
+
+        for (size_t w = 0; w < matrix.stride; w++) {
+            auto word = words[w];
+
+            while (word != 0) {
+                this->columns.push_back(
+                    uint32_t(w * BinaryMatrix::WordBits + lowestBit(word))
+                );
+                word &= word - 1;
+            }
+        }
+
+        this->rowOffsets[i + 1] = this->columns.size();
+    }
+}
+
+bool SparseBinaryMatrix::isEmpty() const {
+    return !this->rows || !this->cols;
+}
+
+bool SparseBinaryMatrix::isValid() const {
+    if (this->rowOffsets.size() != this->rows + 1
+        || this->rowOffsets.front() != 0
+        || this->rowOffsets.back() != this->columns.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < this->rows; i++) {
+        if (this->rowOffsets[i] > this->rowOffsets[i + 1]) {
+            return false;
+        }
+
+        const auto *end = this->rowEnd(i);
+        for (auto *col = this->rowBegin(i); col != end; col++) {
+            if (*col >= this->cols || (col + 1 != end && col[0] >= col[1])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool SparseBinaryMatrix::hasTrue() const {
+    return !this->columns.empty();
+}
+
+void SparseBinaryMatrix::reset(size_t rows, size_t cols) {
+    this->rows = rows;
+    this->cols = cols;
+    this->rowOffsets.assign(rows + 1, 0);
+    this->columns.clear();
+}
+
+BinaryMatrix::Type SparseBinaryMatrix::at(size_t row, size_t col) const {
+    return std::binary_search(this->rowBegin(row), this->rowEnd(row), col)
+               ? BinaryMatrix::True
+               : BinaryMatrix::False;
+}
+
+bool SparseBinaryMatrix::isTrue(size_t row, size_t col) const {
+    return this->at(row, col) == BinaryMatrix::True;
+}
+
+bool SparseBinaryMatrix::isFalse(size_t row, size_t col) const {
+    return this->at(row, col) == BinaryMatrix::False;
+}
+
+size_t SparseBinaryMatrix::count() const {
+    return this->columns.size();
+}
+
+const uint32_t *SparseBinaryMatrix::rowBegin(size_t row) const {
+    return this->columns.data() + this->rowOffsets[row];
+}
+
+const uint32_t *SparseBinaryMatrix::rowEnd(size_t row) const {
+    return this->columns.data() + this->rowOffsets[row + 1];
+}
+
+std::vector<unsigned int> SparseBinaryMatrix::sumRows() const {
+    if (this->isEmpty()) {
+        return {};
+    }
+
+    std::vector<unsigned int> result(this->rows);
+    for (size_t i = 0; i < this->rows; i++) {
+        result[i]
+            = (unsigned int)(this->rowOffsets[i + 1] - this->rowOffsets[i]);
+    }
+
+    return result;
+}
+
+std::vector<unsigned int> SparseBinaryMatrix::sumCols() const {
+    if (this->isEmpty()) {
+        return {};
+    }
+
+    std::vector<unsigned int> result(this->cols, 0);
+    for (auto &&col : this->columns) {
+        result[col]++;
+    }
+
+    return result;
+}
+
+SparseBinaryMatrix SparseBinaryMatrix::transpose() const {
+    SparseBinaryMatrix matrix(this->cols, this->rows);
+    if (this->isEmpty()) {
+        return matrix;
+    }
+
+    // Counting sort by column, rows come out sorted since they are
+    // visited in order
+    for (auto &&col : this->columns) {
+        matrix.rowOffsets[col + 1]++;
+    }
+    for (size_t j = 0; j < this->cols; j++) {
+        matrix.rowOffsets[j + 1] += matrix.rowOffsets[j];
+    }
+
+    matrix.columns.resize(this->columns.size());
+    std::vector<size_t> next(
+        matrix.rowOffsets.begin(),
+        matrix.rowOffsets.end() - 1
+    );
+
+    for (size_t i = 0; i < this->rows; i++) {
+        for (auto *col = this->rowBegin(i); col != this->rowEnd(i); col++) {
+            matrix.columns[next[*col]++] = uint32_t(i);
+        }
+    }
+
+    return matrix;
+}
+
+BinaryMatrix SparseBinaryMatrix::toDense() const {
+    BinaryMatrix matrix(this->rows, this->cols);
+
+    for (size_t i = 0; i < this->rows; i++) {
+        for (auto *col = this->rowBegin(i); col != this->rowEnd(i); col++) {
+            matrix.set(i, *col, BinaryMatrix::True);
+        }
+    }
+
+    return matrix;
+}
+
+void SparseBinaryMatrix::assignMask(const cv::Mat &mask) {
+    this->reset(mask.rows, mask.cols);
+    if (this->isEmpty()) {
+        return;
+    }
+
+    const auto channels = (size_t)mask.channels();
+    const auto rowBytes = this->cols * mask.elemSize();
+
+    // Count the matches of every row first, then fill the columns at the
+    // offsets found by the prefix sum
+    forEachStripe(this->rows, rowBytes, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const auto *pixel = mask.ptr<uchar>((int)i);
+            size_t count = 0;
+
+            for (size_t j = 0; j < this->cols; j++, pixel += channels) {
+                count += *pixel != 0;
+            }
+
+            this->rowOffsets[i + 1] = count;
+        }
+    });
+
+    for (size_t i = 0; i < this->rows; i++) {
+        this->rowOffsets[i + 1] += this->rowOffsets[i];
+    }
+
+    this->columns.resize(this->rowOffsets.back());
+
+    forEachStripe(this->rows, rowBytes, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const auto *pixel = mask.ptr<uchar>((int)i);
+            auto *columns = this->columns.data() + this->rowOffsets[i];
+
+            for (size_t j = 0; j < this->cols; j++, pixel += channels) {
+                if (*pixel != 0) {
+                    *columns++ = uint32_t(j);
+                }
+            }
+        }
+    });
+}
+
+bool SparseBinaryMatrix::isPreferred(size_t count, size_t rows, size_t cols) {
+    const auto dense
+        = rows * BinaryMatrix::wordsFor(cols) * sizeof(BinaryMatrix::Word);
+    const auto sparse = count * sizeof(uint32_t) + (rows + 1) * sizeof(size_t);
+
+    return sparse * SPARSE_MIN_GAIN < dense;
+}
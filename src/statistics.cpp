@@ -0,0 +1,198 @@
+#include "statistics.hpp"
+
+#include "pool.hpp"
+
+#include <cmath>
+
+// Matrices smaller than this (in words) are not worth spreading over threads
+#define PARALLEL_MIN_WORDS (1 << 16)
+#define PARALLEL_MIN_ROWS 64
+
+// Sums over a band of rows, merged into the final result afterwards
+struct RegionPartial
+{
+    size_t count, left, right;
+    // Sum of row * col over all true cells
+    uint64_t sumRowCol;
+    std::vector<unsigned int> colSums;
+
+    RegionPartial(size_t cols)
+        : count(0), left(SIZE_MAX), right(0), sumRowCol(0), colSums(cols, 0) {
+    }
+};
+
+static void accumulateRows(
+    const BinaryMatrix &matrix,
+    size_t from,
+    size_t to,
+    unsigned int *rowSums,
+    RegionPartial &partial
+) {
+    const auto wordBits = BinaryMatrix::WordBits;
+    auto *colSums = partial.colSums.data();
+
+    for (size_t i = from; i < to; i++) {
+        const auto *words = matrix.row(i);
+
+        // Skip empty leading and trailing words
+        size_t first = 0, last = matrix.stride;
+        while (first < last && words[first] == 0) {
+            first++;
+        }
+        while (last > first && words[last - 1] == 0) {
+            last--;
+        }
+
+        if (first == last) {
+            rowSums[i] = 0;
+
+            continue;
+        }
+
+        partial.left = std::min(
+            partial.left,
+            first * wordBits + lowestBit(words[first])
+        );
+        partial.right = std::max(
+            partial.right,
+            (last - 1) * wordBits + highestBit(words[last - 1])
+        );
+
+        unsigned int sum = 0;
+        uint64_t sumCols = 0;
+
+        for (size_t w = first; w < last; w++) {
+            auto word = words[w];
+            sum += popcount(word);
+
+            while (word != 0) {
+                const auto j = w * wordBits + lowestBit(word);
+
+                colSums[j]++;
+                sumCols += j;
+                word &= word - 1;
+            }
+        }
+
+        rowSums[i] = sum;
+        partial.count += sum;
+        partial.sumRowCol += uint64_t(i) * sumCols;
+    }
+}
+
+RegionStatistics::RegionStatistics()
+    : count(0),
+      top(0),
+      left(0),
+      bottom(0),
+      right(0),
+      centroidRow(0),
+      centroidCol(0),
+      mu20(0),
+      mu02(0),
+      mu11(0) {
+}
+
+RegionStatistics::RegionStatistics(const BinaryMatrix &matrix)
+    : RegionStatistics() {
+    if (matrix.isEmpty()) {
+        return;
+    }
+
+    const auto rows = matrix.rows, cols = matrix.cols;
+    this->rowSums.assign(rows, 0);
+
+    // One band per pool thread, each with its own column sums
+    size_t bands = 1;
+    if (matrix.data.size() >= PARALLEL_MIN_WORDS) {
+        bands = std::min(ThreadPool::shared().size(), rows / PARALLEL_MIN_ROWS);
+        bands = std::max(bands, size_t(1));
+    }
+
+    std::vector<RegionPartial> partials(bands, RegionPartial(cols));
+    const auto band = (rows + bands - 1) / bands;
+
+    ThreadPool::shared().parallelFor(bands, 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            const auto from = std::min(rows, t * band);
+            const auto to = std::min(rows, from + band);
+
+            accumulateRows(matrix, from, to, this->rowSums.data(), partials[t]);
+        }
+    });
+
+    // Reduce the partial results
+    this->colSums = std::move(partials[0].colSums);
+    uint64_t sumRowCol = 0;
+    size_t left = SIZE_MAX, right = 0;
+
+    for (size_t t = 0; t < bands; t++) {
+        const auto &partial = partials[t];
+
+        this->count += partial.count;
+        sumRowCol += partial.sumRowCol;
+        left = std::min(left, partial.left);
+        right = std::max(right, partial.right);
+
+        if (t > 0) {
+            for (size_t j = 0; j < cols; j++) {
+                this->colSums[j] += partial.colSums[j];
+            }
+        }
+    }
+
+    if (this->count == 0) {
+        return;
+    }
+
+    uint64_t sumRow = 0, sumRow2 = 0, sumCol = 0, sumCol2 = 0;
+    size_t top = SIZE_MAX, bottom = 0;
+
+    for (size_t i = 0; i < rows; i++) {
+        const uint64_t sum = this->rowSums[i];
+        if (sum == 0) {
+            continue;
+        }
+
+        top = std::min(top, i);
+        bottom = i;
+        sumRow += sum * i;
+        sumRow2 += sum * i * i;
+    }
+
+    for (size_t j = 0; j < cols; j++) {
+        const uint64_t sum = this->colSums[j];
+
+        sumCol += sum * j;
+        sumCol2 += sum * j * j;
+    }
+
+    this->top = top;
+    this->bottom = bottom;
+    this->left = left;
+    this->right = right;
+
+    const auto n = double(this->count);
+    this->centroidRow = double(sumRow) / n;
+    this->centroidCol = double(sumCol) / n;
+
+    this->mu20 = double(sumCol2) - double(sumCol) * this->centroidCol;
+    this->mu02 = double(sumRow2) - double(sumRow) * this->centroidRow;
+    this->mu11 = double(sumRowCol) - double(sumCol) * this->centroidRow;
+}
+
+bool RegionStatistics::isEmpty() const {
+    return this->count == 0;
+}
+
+size_t RegionStatistics::boxWidth() const {
+    return this->isEmpty() ? 0 : this->right - this->left + 1;
+}
+
+size_t RegionStatistics::boxHeight() const {
+    return this->isEmpty() ? 0 : this->bottom - this->top + 1;
+}
+
+double RegionStatistics::orientation() const {
+    return 0.5 * std::atan2(2 * this->mu11, this->mu20 - this->mu02);
+}
@@ -0,0 +1,120 @@
+#include "sweep.hpp"
+#include "kernels.hpp"
+#include "pool.hpp"
+#include "profiler.hpp"
+#include "scratch.hpp"
+
+#include <mutex>
+
+using Word = BinaryMatrix::Word;
+
+RangeSweep::RangeSweep(): pixels(0) {
+}
+
+bool RangeSweep::hasMasks() const {
+    return !this->masks.empty();
+}
+
+double RangeSweep::coverage(size_t index) const {
+    return this->pixels > 0 ? (double)this->counts[index] / this->pixels : 0;
+}
+
+RangeSweep sweepColorRanges(
+    const cv::Mat &image,
+    const std::vector<ColorRange> &ranges,
+    bool withMasks
+) {
+    RangeSweep result;
+    const auto count = ranges.size();
+    result.counts.assign(count, 0);
+    result.pixels = image.total();
+
+    if (withMasks) {
+        result.masks.assign(count, BinaryMatrix(image.rows, image.cols));
+    }
+    if (image.empty() || count == 0) {
+        return result;
+    }
+
+    ProfileScope scope("sweep", image.total() * image.elemSize());
+
+    // Bounds of every range in the kernel layout. Ranges that cannot match
+    // get bounds that nothing passes.
+    std::vector<uint8_t> lows(3 * count), highs(3 * count), wraps(count);
+    for (size_t r = 0; r < count; r++) {
+        bool wrap;
+        if (!ranges[r].bounds(&lows[3 * r], &highs[3 * r], wrap)) {
+            lows[3 * r] = 255;
+            highs[3 * r] = 0;
+            wrap = false;
+        }
+
+        wraps[r] = wrap;
+    }
+
+    const auto &k = kernels();
+    const auto cols = (size_t)image.cols;
+    const auto stride = BinaryMatrix::wordsFor(cols);
+    std::mutex mutex;
+
+    forEachStripe(
+        image.rows,
+        cols * (image.elemSize() + 3),
+        [&](size_t begin, size_t end) {
+            const auto rows = (int)(end - begin);
+            auto hsv = ScratchArena::local().band(
+                ScratchHSV,
+                rows,
+                image.cols,
+                CV_8UC3
+            );
+            cv::cvtColor(
+                image.rowRange((int)begin, (int)end),
+                hsv,
+                cv::COLOR_BGR2HSV
+            );
+
+            // Rows of bits go to the masks, or to one reused row per range
+            // when only the counts are wanted
+            thread_local std::vector<Word> buffer;
+            thread_local std::vector<Word *> targets;
+            targets.resize(count);
+            if (!withMasks) {
+                buffer.resize(count * stride);
+                for (size_t r = 0; r < count; r++) {
+                    targets[r] = &buffer[r * stride];
+                }
+            }
+
+            std::vector<size_t> counts(count, 0);
+            for (size_t i = begin; i < end; i++) {
+                if (withMasks) {
+                    for (size_t r = 0; r < count; r++) {
+                        targets[r] = result.masks[r].row(i);
+                    }
+                }
+
+                k.sweepRow(
+                    hsv.ptr<uchar>((int)(i - begin)),
+                    cols,
+                    lows.data(),
+                    highs.data(),
+                    wraps.data(),
+                    count,
+                    targets.data()
+                );
+
+                for (size_t r = 0; r < count; r++) {
+                    counts[r] += k.countBits(targets[r], stride);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t r = 0; r < count; r++) {
+                result.counts[r] += counts[r];
+            }
+        }
+    );
+
+    return result;
+}
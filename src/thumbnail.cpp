@@ -0,0 +1,231 @@
+#include "thumbnail.hpp"
+#include "cache.hpp"
+
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+#define THUMBNAIL_EXTENSION ".jpg"
+// Eviction goes below the capacity, so that it does not run on every store
+#define THUMBNAIL_LOW_WATER(capacity) ((capacity) / 10 * 9)
+
+ThumbnailCache::Entry::Entry(): requested(0), failed(false) {
+}
+
+ThumbnailCache::ThumbnailCache()
+    : capacity(0), bytes(0), frame(0), stopping(false) {
+}
+
+ThumbnailCache::~ThumbnailCache() {
+    this->close();
+}
+
+bool ThumbnailCache::open(
+    const fs::path &directory,
+    uint64_t capacity,
+    size_t workers
+) {
+    this->close();
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (!fs::is_directory(directory, error)) {
+        return false;
+    }
+
+    this->directory = directory;
+    this->capacity = capacity;
+    this->stopping = false;
+
+    // Measuring a large directory must not hold up the caller
+    this->workers.push_back(std::thread([this]() {
+        this->evict(this->capacity);
+        this->work();
+    }));
+    for (size_t i = 1; i < workers; i++) {
+        this->workers.push_back(std::thread([this]() { this->work(); }));
+    }
+
+    return true;
+}
+
+void ThumbnailCache::close() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->queue.clear();
+    }
+    this->wake.notify_all();
+
+    for (auto &&worker : this->workers) {
+        worker.join();
+    }
+    this->workers.clear();
+    this->entries.clear();
+    this->directory.clear();
+}
+
+bool ThumbnailCache::isOpen() const {
+    return !this->workers.empty();
+}
+
+void ThumbnailCache::nextFrame(size_t keep) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->frame++;
+
+    for (auto it = this->entries.begin(); it != this->entries.end();) {
+        if (it->second.requested + keep < this->frame) {
+            it = this->entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+cv::Mat ThumbnailCache::request(const fs::path &path) {
+    if (!this->isOpen()) {
+        return cv::Mat();
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto result = this->entries.emplace(path.string(), Entry());
+    auto &entry = result.first->second;
+    entry.requested = this->frame;
+
+    if (result.second) {
+        this->queue.push_back(path.string());
+        this->wake.notify_one();
+    }
+
+    return entry.image;
+}
+
+size_t ThumbnailCache::pending() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    return this->queue.size();
+}
+
+cv::Mat ThumbnailCache::generate(const fs::path &path, int size) {
+    auto image = cv::imread(path.string(), cv::IMREAD_REDUCED_COLOR_8);
+    if (!image.empty() && std::max(image.cols, image.rows) < size) {
+        image = cv::imread(path.string(), cv::IMREAD_COLOR);
+    }
+    if (image.empty()) {
+        return image;
+    }
+
+    const double scale = (double)size / std::max(image.cols, image.rows);
+    if (scale >= 1) {
+        return image;
+    }
+
+    cv::Mat thumbnail;
+    cv::resize(
+        image,
+        thumbnail,
+        cv::Size(
+            std::max(1, (int)std::lround(image.cols * scale)),
+            std::max(1, (int)std::lround(image.rows * scale))
+        ),
+        0,
+        0,
+        cv::INTER_AREA
+    );
+
+    return thumbnail;
+}
+
+fs::path ThumbnailCache::entryPath(const fs::path &file) const {
+    std::error_code error;
+    const auto size = fs::file_size(file, error);
+    if (error) {
+        return fs::path();
+    }
+    const auto modified = fs::last_write_time(file, error);
+    if (error) {
+        return fs::path();
+    }
+
+    // A changed file gets a new entry, the old one is evicted in time
+    const auto identity = fs::absolute(file).string() + "\n"
+                          + std::to_string(size) + "\n"
+                          + std::to_string(modified.time_since_epoch().count())
+                          + "\n" + std::to_string(THUMBNAIL_SIZE);
+    const auto name = ContentHash::of(identity.data(), identity.size()).hex();
+
+    return this->directory / name.substr(0, 2) / (name + THUMBNAIL_EXTENSION);
+}
+
+cv::Mat ThumbnailCache::make(const fs::path &file) {
+    const auto path = this->entryPath(file);
+    if (path.empty()) {
+        return cv::Mat();
+    }
+
+    std::error_code error;
+    auto image = cv::imread(path.string(), cv::IMREAD_COLOR);
+    if (!image.empty()) {
+        fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+
+        return image;
+    }
+
+    image = generate(file);
+    std::vector<uchar> encoded;
+    if (image.empty() || !cv::imencode(THUMBNAIL_EXTENSION, image, encoded)) {
+        return image;
+    }
+
+    if (writeFileAtomically(path, encoded.data(), encoded.size())
+        && (this->bytes += encoded.size()) > this->capacity) {
+        this->evict(THUMBNAIL_LOW_WATER(this->capacity));
+    }
+
+    return image;
+}
+
+void ThumbnailCache::evict(uint64_t target) {
+    std::lock_guard<std::mutex> lock(this->evicting);
+    this->bytes = evictOldest(this->directory, THUMBNAIL_EXTENSION, target);
+}
+
+void ThumbnailCache::work() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true) {
+        this->wake.wait(lock, [&]() {
+            return this->stopping || !this->queue.empty();
+        });
+        if (this->stopping) {
+            return;
+        }
+
+        const auto file = this->queue.front();
+        this->queue.pop_front();
+
+        // Scrolled past since the request, queued again when shown
+        auto found = this->entries.find(file);
+        if (found == this->entries.end()) {
+            continue;
+        }
+        if (found->second.requested + 1 < this->frame) {
+            this->entries.erase(found);
+
+            continue;
+        }
+        if (!found->second.image.empty() || found->second.failed) {
+            continue;
+        }
+
+        lock.unlock();
+        const auto image = this->make(file);
+        lock.lock();
+
+        found = this->entries.find(file);
+        if (found != this->entries.end()) {
+            found->second.image = image;
+            found->second.failed = image.empty();
+        }
+    }
+}
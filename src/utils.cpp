@@ -1,8 +1,7 @@
 #include "utils.hpp"
-
-ColorRange::ColorRange(const cv::Scalar &from, const cv::Scalar &to)
-    : from(from), to(to) {
-}
+#include "classifier.hpp"
+#include "pool.hpp"
+#include "profiler.hpp"
 
 Texture2D::Texture2D(): glTexture(nullptr) {
 }
@@ -17,11 +16,26 @@ Texture2D::Texture2D(): glTexture(nullptr) {
 
 void Texture2D::reset() {
     if (this->glTexture != nullptr) {
+        glDeleteTextures(1, this->glTexture);
         delete this->glTexture;
         this->glTexture = nullptr;
     }
 }
 
+// Show the red channel of the bound texture as gray. False when the context
+// has no texture swizzling (before GL 3.3 without ARB_texture_swizzle).
+static bool swizzleGray() {
+    static const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+
+    // Errors left by earlier calls would be taken for ours
+    for (int i = 0; i < 16 && glGetError() != GL_NO_ERROR; i++) {
+    }
+
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+
+    return glGetError() == GL_NO_ERROR;
+}
+
 void Texture2D::render(const cv::Mat &mat) {
     bool hasGLTexture = this->glTexture != nullptr;
     if (hasGLTexture) {
@@ -55,18 +69,63 @@ void Texture2D::render(const cv::Mat &mat) {
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Rows are read as they are laid out in memory, masks are not padded to
+    // 4 bytes and views into larger images have longer rows
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(mat.step / mat.elemSize()));
+
+    // 0/255 masks are uploaded with one byte per pixel and shown gray by the
+    // GPU. Without swizzling they are expanded to BGRA for the upload only.
+    if (imgType == CV_8UC1 && swizzleGray()) {
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_R8,
+            mat.cols,
+            mat.rows,
+            0,
+            GL_RED,
+            GL_UNSIGNED_BYTE,
+            mat.data
+        );
+    } else if (imgType == CV_8UC1) {
+        auto &display = ScratchArena::local().mat(
+            ScratchDisplay,
+            mat.rows,
+            mat.cols,
+            CV_8UC4
+        );
+        cv::cvtColor(mat, display, cv::COLOR_GRAY2BGRA);
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_RGBA,
+            display.cols,
+            display.rows,
+            0,
+            _GL_BGRA_PLATFORM,
+            GL_UNSIGNED_BYTE,
+            display.data
+        );
+    } else {
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            gl_internal_formats[cn],
+            mat.cols,
+            mat.rows,
+            0,
+            gl_formats[cn],
+            gl_types[depth],
+            mat.data
+        );
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        gl_internal_formats[cn],
-        mat.cols,
-        mat.rows,
-        0,
-        gl_formats[cn],
-        gl_types[depth],
-        mat.data
-    );
 }
 
 void Texture2D::bind() {
@@ -94,6 +153,7 @@ void Image::load() {
         this->cv,
         cv::COLOR_BGR2BGRA
     );
+    this->contentHash = ContentHash::ofFile(this->path);
 
     this->loaded = true;
 }
@@ -104,188 +164,170 @@ void Image::validate() const {
     }
 }
 
-void Image::processMaskByColorRange(const ColorRange &colorRange) {
+void Image::processMaskByColorRange(
+    const ColorRange &colorRange,
+    const RegionOfInterest &roi
+) {
     this->validate();
 
-    cv::Mat mask, hsv;
-    cv::cvtColor(this->cv, hsv, cv::COLOR_BGR2HSV);
-    cv::inRange(hsv, colorRange.from, colorRange.to, mask);
-
-    // Check if there are any white pixels on mask
-    bool hasColor = cv::sum(mask)[0] > 0;
-    if (hasColor) {
-        cv::cvtColor(mask, mask, cv::COLOR_GRAY2BGRA);
-    }
+    const auto &image = this->cv;
+    const auto bounds = roi.bounds(image.size());
+    ProfileScope scope("threshold", bounds.area() * image.elemSize());
+
+    // Only the region is converted, into a mask of its bounds
+    if (!roi.coversFrame(image.size())) {
+        auto &mask = this->scratch.mat(
+            ScratchMask,
+            bounds.height,
+            bounds.width,
+            CV_8UC1
+        );
+        thresholdRegion(image, colorRange, roi, mask);
 
-    this->mask = mask;
-    this->maskProcessed = hasColor;
-    this->maskTexture.reset();
-}
+        this->maskOrigin = bounds.tl();
+        this->applyMask(mask);
 
-bool Image::saveMask(const std::filesystem::path &path) {
-    if (this->maskProcessed == false || this->mask.cols == 0
-        || this->mask.rows == 0) {
-        throw Exception("Mask has not been processed yet!");
+        return;
     }
 
-    return cv::imwrite(path.string(), this->mask);
-}
-
-int Image::width() const {
-    return this->cv.cols;
-}
-
-int Image::height() const {
-    return this->cv.rows;
-}
-
-bool Image::isLoaded() const {
-    return this->loaded;
-}
-
-bool Image::isMaskProcessed() const {
-    return this->maskProcessed;
-}
+    const int rows = image.rows, cols = image.cols;
+    auto &mask = this->scratch.mat(ScratchMask, rows, cols, CV_8UC1);
+    auto &hsv = this->scratch.mat(ScratchHSV, rows, cols, CV_8UC3);
+
+    // Stripes write into views of the full size buffers
+    forEachStripe(
+        image.rows,
+        image.cols * image.elemSize(),
+        [&](size_t begin, size_t end) {
+            cv::Mat stripeHSV = hsv.rowRange((int)begin, (int)end);
+            cv::Mat stripeMask = mask.rowRange((int)begin, (int)end);
+
+            cv::cvtColor(
+                image.rowRange((int)begin, (int)end),
+                stripeHSV,
+                cv::COLOR_BGR2HSV
+            );
+            colorRange.threshold(stripeHSV, stripeMask);
+        }
+    );
 
-Exception::Exception(const std::string &message): message(message) {
+    this->maskOrigin = cv::Point(0, 0);
+    this->applyMask(mask);
 }
 
-BinaryMatrix::BinaryMatrix(): BinaryMatrix(0, 0) {
-}
+void Image::processMaskByClassifier(
+    const ColorClassifier &classifier,
+    const RegionOfInterest &roi
+) {
+    this->validate();
 
-BinaryMatrix::BinaryMatrix(size_t rows, size_t cols) {
-    this->reset(rows, cols);
-}
+    const auto &image = this->cv;
+    const auto bounds = roi.bounds(image.size());
+    auto &mask
+        = this->scratch.mat(ScratchMask, bounds.height, bounds.width, CV_8UC1);
 
-BinaryMatrix::BinaryMatrix(
-    size_t rows,
-    size_t cols,
-    const std::vector<std::vector<BinaryMatrix::Type>> &data
-)
-    : rows(rows), cols(cols) {
-    if (data.size() == rows) {
-        this->data = data;
+    if (roi.coversFrame(image.size())) {
+        classifier.classify(image, mask);
+    } else {
+        classifyRegion(image, classifier, roi, mask);
     }
-}
 
-bool BinaryMatrix::isEmpty() const {
-    return !this->rows || !this->cols || this->data.empty();
+    this->maskOrigin = bounds.tl();
+    this->applyMask(mask);
 }
 
-bool BinaryMatrix::isValid() const {
-    if (this->rows != this->data.size()) {
-        return false;
-    }
+void Image::processMaskByMatrix(const BinaryMatrix &matrix) {
+    this->validate();
 
-    for (auto &&row : this->data) {
-        if (row.size() != this->cols) {
-            return false;
-        }
+    const auto &image = this->cv;
+    if ((size_t)image.rows != matrix.rows
+        || (size_t)image.cols != matrix.cols) {
+        throw Exception("Binary matrix does not match the image size!");
     }
+    this->maskOrigin = cv::Point(0, 0);
 
-    return true;
-}
+    auto &mask
+        = this->scratch.mat(ScratchMask, image.rows, image.cols, CV_8UC1);
 
-bool BinaryMatrix::hasTrue() const {
-    if (this->isEmpty()) {
-        return false;
-    }
+    forEachStripe(matrix.rows, matrix.cols, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const auto *words = matrix.row(i);
+            auto *pixels = mask.ptr<uchar>((int)i);
 
-    for (auto &&irows : this->data) {
-        for (auto &&jcol : irows) {
-            if (jcol == BinaryMatrix::True) {
-                return true;
+            for (size_t j = 0; j < matrix.cols; j++) {
+                const auto word = words[j / BinaryMatrix::WordBits];
+
+                pixels[j] = (word >> (j % BinaryMatrix::WordBits)) & 1 ? 255
+                                                                       : 0;
             }
         }
-    }
-
-    return false;
-}
-
-void BinaryMatrix::clear() {
-    this->data.clear();
-    this->cols = 0;
-    this->rows = 0;
-}
+    });
 
-BinaryMatrix::Type BinaryMatrix::at(size_t row, size_t col) const {
-    return this->data[row][col];
+    this->applyMask(mask);
 }
 
-void BinaryMatrix::set(size_t row, size_t col, BinaryMatrix::Type value) {
-    this->data[row][col] = value;
-}
-
-void BinaryMatrix::reset(size_t rows, size_t cols) {
-    this->clear();
-
-    this->rows = rows;
-    this->cols = cols;
+void Image::previewMaskByColorRange(
+    const ColorRange &colorRange,
+    const RegionOfInterest &roi
+) {
+    this->validate();
 
-    if (rows > 0 && cols > 0) {
-        this->data.assign(
-            rows,
-            std::vector<BinaryMatrix::Type>(cols, BinaryMatrix::False)
-        );
+    if (!this->progressive.isAttached()
+        || this->previewRegion.rects != roi.rects) {
+        this->progressive.attach(this->cv(roi.bounds(this->cv.size())));
+        this->previewRegion = roi;
     }
-}
+    this->progressive.restart(colorRange);
 
-bool BinaryMatrix::isTrue(size_t row, size_t col) const {
-    return this->at(row, col) == BinaryMatrix::True;
+    this->previewMask = this->progressive.preview();
+    this->previewTexture.reset();
 }
 
-bool BinaryMatrix::isFalse(size_t row, size_t col) const {
-    return this->at(row, col) == BinaryMatrix::False;
-}
-
-std::vector<unsigned int> BinaryMatrix::sumRows() const {
-    if (this->isEmpty()) {
-        return {};
+bool Image::refinePreviewMask(double seconds) {
+    if (!this->isPreviewing() || !this->progressive.refine(seconds)) {
+        return false;
     }
 
-    std::vector<unsigned int> result(this->rows);
+    // The preview thresholds all of the bounds, gaps between the
+    // rectangles are cleared afterwards
+    auto &full = this->progressive.mask();
+    clearOutsideRegion(full, this->previewRegion, this->cv.size());
 
-    for (size_t i = 0; i < this->rows; i++) {
-        unsigned int sum = 0;
+    // The next preview writes over the refined buffer, the mask keeps a copy
+    auto &mask
+        = this->scratch.mat(ScratchMask, full.rows, full.cols, CV_8UC1);
+    full.copyTo(mask);
 
-        for (size_t j = 0; j < this->cols; j++) {
-            sum += (unsigned int)(this->at(i, j) == BinaryMatrix::True ? 1 : 0);
-        }
-
-        result[i] = sum;
-    }
+    this->maskOrigin = this->previewRegion.bounds(this->cv.size()).tl();
+    this->applyMask(mask);
 
-    return result;
+    return true;
 }
 
-std::vector<unsigned int> BinaryMatrix::sumCols() const {
-    if (this->isEmpty()) {
-        return {};
-    }
-
-    std::vector<unsigned int> result(this->cols);
-
-    for (size_t j = 0; j < this->cols; j++) {
-        unsigned int sum = 0;
-
-        for (size_t i = 0; i < this->rows; i++) {
-            sum += (unsigned int)(this->at(i, j) == BinaryMatrix::True ? 1 : 0);
-        }
+bool Image::isPreviewing() const {
+    return this->progressive.isStarted() && !this->progressive.isComplete();
+}
 
-        result[j] = sum;
-    }
+void Image::applyMask(const cv::Mat &mask) {
+    // Kept single channel, the texture is shown gray by the GPU and the
+    // matrix is packed straight from it
+    this->mask = mask;
+    this->maskProcessed = cv::countNonZero(mask) > 0;
+    this->maskTexture.reset();
+}
 
-    return result;
+int Image::width() const {
+    return this->cv.cols;
 }
 
-BinaryMatrix BinaryMatrix::transpose() const {
-    BinaryMatrix matrix(this->cols, this->rows);
+int Image::height() const {
+    return this->cv.rows;
+}
 
-    for (size_t i = 0; i < this->rows; i++) {
-        for (size_t j = 0; j < this->cols; j++) {
-            matrix.set(j, i, this->at(i, j));
-        }
-    }
+bool Image::isLoaded() const {
+    return this->loaded;
+}
 
-    return matrix;
+bool Image::isMaskProcessed() const {
+    return this->maskProcessed;
 }
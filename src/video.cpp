@@ -0,0 +1,479 @@
+#include "video.hpp"
+#include "exporter.hpp"
+#include "kernels.hpp"
+#include "profiler.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#define PACKED_STREAM_MAGIC "IBMS"
+#define PACKED_ENCODING_WORDS 0
+#define PACKED_ENCODING_SPARSE 1
+
+bool IFrameSource::read(
+    cv::Mat &frame,
+    ContentHash &hash,
+    const std::function<bool(const ContentHash &)> &
+) {
+    hash = ContentHash();
+
+    return this->read(frame);
+}
+
+VideoFrameSource::VideoFrameSource(const std::string &path): path(path) {
+}
+
+bool VideoFrameSource::open() {
+    return this->capture.open(this->path) && this->capture.isOpened();
+}
+
+bool VideoFrameSource::read(cv::Mat &frame) {
+    return this->capture.read(frame) && !frame.empty();
+}
+
+void VideoFrameSource::close() {
+    this->capture.release();
+}
+
+SequenceFrameSource::SequenceFrameSource(const std::string &pattern)
+    : pattern(pattern), next(0) {
+}
+
+bool SequenceFrameSource::open() {
+    this->files.clear();
+    this->next = 0;
+
+    cv::glob(this->pattern, this->files, false);
+    std::sort(this->files.begin(), this->files.end());
+
+    return !this->files.empty();
+}
+
+bool SequenceFrameSource::read(cv::Mat &frame) {
+    while (this->readNextFile()) {
+        cv::imdecode(this->buffer, cv::ImreadModes::IMREAD_COLOR, &frame);
+        if (!frame.empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SequenceFrameSource::read(
+    cv::Mat &frame,
+    ContentHash &hash,
+    const std::function<bool(const ContentHash &)> &skip
+) {
+    while (this->readNextFile()) {
+        hash = ContentHash::of(this->buffer.data(), this->buffer.size());
+        if (skip(hash)) {
+            return true;
+        }
+
+        cv::imdecode(this->buffer, cv::ImreadModes::IMREAD_COLOR, &frame);
+        if (!frame.empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SequenceFrameSource::readNextFile() {
+    while (this->next < this->files.size()) {
+        std::ifstream file(this->files[this->next++], std::ios::binary);
+        if (!file) {
+            continue;
+        }
+
+        // The encoded bytes and the decoded frame both keep their buffers
+        file.seekg(0, std::ios::end);
+        const auto size = file.tellg();
+        if (size < 0) {
+            continue;
+        }
+        this->buffer.resize((size_t)size);
+        file.seekg(0, std::ios::beg);
+        file.read((char *)this->buffer.data(), this->buffer.size());
+
+        // Partly read files would be hashed and cached as they are
+        if (file) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SequenceFrameSource::close() {
+    this->files.clear();
+    this->buffer.clear();
+}
+
+void IFrameSink::write(size_t index, const SparseBinaryMatrix &matrix) {
+    this->write(index, matrix.toDense());
+}
+
+MatrixFileSink::MatrixFileSink(
+    const std::filesystem::path &directory,
+    const std::string &stem
+)
+    : directory(directory), stem(stem), good(true) {
+}
+
+bool MatrixFileSink::open() {
+    std::filesystem::create_directories(this->directory);
+    this->good = std::filesystem::is_directory(this->directory);
+
+    return this->good;
+}
+
+void MatrixFileSink::write(size_t index, const BinaryMatrix &matrix) {
+    const auto filename
+        = this->stem + "." + std::to_string(index) + std::string(".txt");
+
+    this->good = exportMatrix(matrix, this->directory / filename, MatrixText)
+                 && this->good;
+}
+
+void MatrixFileSink::write(size_t index, const SparseBinaryMatrix &matrix) {
+    const auto filename
+        = this->stem + "." + std::to_string(index) + std::string(".txt");
+
+    this->good = exportMatrix(matrix, this->directory / filename, MatrixText)
+                 && this->good;
+}
+
+bool MatrixFileSink::close() {
+    return this->good;
+}
+
+ContourFileSink::ContourFileSink(
+    const std::filesystem::path &directory,
+    const std::string &stem,
+    ContourFormat format,
+    double epsilon
+)
+    : directory(directory),
+      stem(stem),
+      format(format),
+      epsilon(epsilon),
+      good(true) {
+}
+
+bool ContourFileSink::open() {
+    std::filesystem::create_directories(this->directory);
+    this->good = std::filesystem::is_directory(this->directory);
+
+    return this->good;
+}
+
+void ContourFileSink::write(size_t index, const BinaryMatrix &matrix) {
+    const auto filename = this->stem + "." + std::to_string(index)
+                          + contourExtension(this->format);
+    const auto contours = findContours(matrix, this->epsilon);
+
+    this->good = exportContours(
+                     contours,
+                     matrix.rows,
+                     matrix.cols,
+                     this->directory / filename,
+                     this->format
+                 )
+                 && this->good;
+}
+
+bool ContourFileSink::close() {
+    return this->good;
+}
+
+PackedStreamSink::PackedStreamSink(const std::filesystem::path &path)
+    : path(path) {
+}
+
+bool PackedStreamSink::open() {
+    this->stream.open(this->path.string(), std::ios::binary);
+    this->stream.write(PACKED_STREAM_MAGIC, 4);
+
+    return this->stream.good();
+}
+
+void PackedStreamSink::write(size_t, const BinaryMatrix &matrix) {
+    const uint32_t header[3]
+        = {(uint32_t)matrix.rows, (uint32_t)matrix.cols, PACKED_ENCODING_WORDS};
+
+    this->stream.write((const char *)header, sizeof(header));
+    this->stream.write(
+        (const char *)matrix.data.data(),
+        matrix.data.size() * sizeof(BinaryMatrix::Word)
+    );
+}
+
+void PackedStreamSink::write(size_t, const SparseBinaryMatrix &matrix) {
+    const uint32_t header[3] = {
+        (uint32_t)matrix.rows,
+        (uint32_t)matrix.cols,
+        PACKED_ENCODING_SPARSE
+    };
+
+    this->stream.write((const char *)header, sizeof(header));
+
+    // Offsets are stored as 64-bit whatever size_t is
+    for (auto offset : matrix.rowOffsets) {
+        const auto value = uint64_t(offset);
+        this->stream.write((const char *)&value, sizeof(value));
+    }
+
+    this->stream.write(
+        (const char *)matrix.columns.data(),
+        matrix.columns.size() * sizeof(uint32_t)
+    );
+}
+
+bool PackedStreamSink::close() {
+    this->stream.close();
+
+    return this->stream.good();
+}
+
+PipelineReport::PipelineReport(): frames(0), cached(0), seconds(0) {
+}
+
+double PipelineReport::fps() const {
+    return this->seconds > 0 ? this->frames / this->seconds : 0;
+}
+
+FramePipeline::FramePipeline(
+    IFrameSource &source,
+    IFrameSink &sink,
+    const ColorRange &colorRange,
+    ResultCache *cache
+)
+    : source(source), sink(sink), colorRange(colorRange), cache(cache) {
+}
+
+PipelineReport FramePipeline::run() {
+    PipelineReport report;
+    if (!this->source.open()) {
+        throw Exception("Frame source cannot be opened!");
+    }
+    if (!this->sink.open()) {
+        this->source.close();
+
+        throw Exception("Frame sink cannot be opened!");
+    }
+
+    cv::Mat frames[2];
+    bool ready[2] = {false, false};
+    // Set instead of the frame when the result came from the cache
+    BinaryMatrix cachedMatrices[2];
+    bool cached[2] = {false, false};
+    ContentHash hashes[2];
+    bool finished = false, stopped = false;
+    // Thrown by the decoder, which then finishes, rethrown after the join
+    std::exception_ptr error;
+    // While profiling, decoding waits for the consumer to finish the frame,
+    // so that counters of the stages do not include each other's work
+    const bool serial = Profiler::shared().isEnabled();
+    bool busy = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Decoder fills the buffers in turn, waiting for the consumer to
+    // release the next one
+    std::thread decoder([&]() {
+        if (serial) {
+            Profiler::shared().addThread();
+        }
+
+        for (size_t k = 0;; k ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() {
+                    const bool waiting = serial && (busy || ready[k ^ 1]);
+
+                    return (!ready[k] && !waiting) || stopped;
+                });
+
+                if (stopped) {
+                    return;
+                }
+            }
+
+            bool decoded;
+            cached[k] = false;
+            ProfileScope scope("decode");
+
+            try {
+                if (this->cache) {
+                    decoded = this->source.read(
+                        frames[k],
+                        hashes[k],
+                        [&](const ContentHash &hash) {
+                            return cached[k] = this->cache->load(
+                                resultKey(hash, this->colorRange),
+                                cachedMatrices[k]
+                            );
+                        }
+                    );
+                } else {
+                    decoded = this->source.read(frames[k]);
+                }
+            } catch (...) {
+                error = std::current_exception();
+                decoded = false;
+            }
+            if (decoded && !cached[k]) {
+                scope.addBytes(frames[k].total() * frames[k].elemSize());
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!decoded) {
+                finished = true;
+                changed.notify_all();
+
+                return;
+            }
+
+            ready[k] = true;
+            changed.notify_all();
+        }
+    });
+
+    cv::Mat hsv, mask;
+    BinaryMatrix matrix;
+    SparseBinaryMatrix sparse;
+
+    try {
+        for (size_t k = 0;; k ^= 1) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return ready[k] || finished; });
+
+                // Frames come in order, so an empty buffer after the end
+                // means there is nothing left
+                if (!ready[k]) {
+                    break;
+                }
+                busy = true;
+            }
+
+            const bool fromCache = cached[k];
+            const auto hash = hashes[k];
+            bool useSparse;
+
+            if (fromCache) {
+                // Swapped, so both sides keep a buffer to reuse
+                std::swap(matrix, cachedMatrices[k]);
+
+                const auto count = kernels().countBits(
+                    matrix.data.data(),
+                    matrix.data.size()
+                );
+                useSparse = SparseBinaryMatrix::isPreferred(
+                    count,
+                    matrix.rows,
+                    matrix.cols
+                );
+                if (useSparse) {
+                    sparse = SparseBinaryMatrix(matrix);
+                }
+
+                report.cached++;
+            } else {
+                {
+                    ProfileScope scope(
+                        "threshold",
+                        frames[k].total() * frames[k].elemSize()
+                    );
+                    cv::cvtColor(frames[k], hsv, cv::COLOR_BGR2HSV);
+                    this->colorRange.threshold(hsv, mask);
+                }
+
+                ProfileScope scope("pack", mask.total());
+
+                // Pick the representation from the density of the mask
+                useSparse = SparseBinaryMatrix::isPreferred(
+                    (size_t)cv::countNonZero(mask),
+                    mask.rows,
+                    mask.cols
+                );
+                if (useSparse) {
+                    sparse.assignMask(mask);
+                } else {
+                    matrix.assignMask(mask);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready[k] = false;
+                changed.notify_all();
+            }
+
+            {
+                ProfileScope scope("write");
+
+                if (useSparse) {
+                    this->sink.write(report.frames++, sparse);
+                } else {
+                    this->sink.write(report.frames++, matrix);
+                }
+            }
+
+            if (this->cache && !fromCache && hash.isValid()) {
+                const auto key = resultKey(hash, this->colorRange);
+
+                if (useSparse) {
+                    this->cache->store(key, sparse.toDense());
+                } else {
+                    this->cache->store(key, matrix);
+                }
+            }
+
+            if (serial) {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy = false;
+                changed.notify_all();
+            }
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+            changed.notify_all();
+        }
+
+        decoder.join();
+        this->source.close();
+        this->sink.close();
+
+        throw;
+    }
+
+    decoder.join();
+
+    if (error) {
+        this->source.close();
+        this->sink.close();
+
+        std::rethrow_exception(error);
+    }
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+    report.seconds = elapsed.count();
+
+    this->source.close();
+    if (!this->sink.close()) {
+        throw Exception("Frame sink write error!");
+    }
+
+    return report;
+}